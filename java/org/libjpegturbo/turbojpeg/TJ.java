@@ -548,11 +548,20 @@ public final class TJ {
    * <li> <code>1</code> Optimal Huffman tables will be computed for the JPEG
    * image.  For lossless transformation, this can also be specified using
    * {@link TJTransform#OPT_OPTIMIZE}.
+   * <li> <code>2</code> Approximately optimal Huffman tables will be computed
+   * for the JPEG image from a representative subset of its MCU rows, and the
+   * image will then be compressed in a single pass.  This applies only to
+   * 8-bit-per-sample baseline (non-progressive, non-arithmetic) compression
+   * of packed-pixel images.  Otherwise, or if the image is too small for
+   * sampling to be worthwhile, <code>2</code> is equivalent to
+   * <code>1</code>.
    * </ul>
    *
    * <p>Optimized baseline entropy coding will improve compression slightly
    * (generally 5% or less), but it will reduce compression performance
-   * considerably.
+   * considerably.  Approximately optimal baseline entropy coding achieves
+   * most of the same improvement at a fraction of the cost, and it does not
+   * require the whole image to be buffered in the DCT domain.
    */
   public static final int PARAM_OPTIMIZE = 11;
   /**
@@ -813,6 +822,12 @@ public final class TJ {
    * compression, and lossless transformation <i>[default: <code>0</code> (no
    * limit)]</i>
    * </ul>
+   * <p>
+   * On Un*x systems, intermediate buffers that do not fit within this limit
+   * are stored in an anonymous temporary file (created in the directory
+   * specified by the <code>TMPDIR</code> environment variable, or in /tmp if
+   * <code>TMPDIR</code> is not set.)  On Windows, exceeding this limit causes
+   * an error.
    */
   public static final int PARAM_MAXMEMORY = 23;
   /**
@@ -830,6 +845,23 @@ public final class TJ {
    * </ul>
    */
   public static final int PARAM_MAXPIXELS = 24;
+  /**
+   * Target JPEG image size [8-bit-per-sample lossy compression only]
+   *
+   * <p>Setting this parameter causes the compressor to generate a JPEG image
+   * using the highest quality level that produces a JPEG image no larger than
+   * the specified size.  If {@link #PARAM_QUALITY} is set, then its value is
+   * the highest quality level that will be considered.  If the JPEG image is
+   * too large even with a quality level of 1, then that JPEG image is
+   * generated, and the compressor issues a warning.
+   *
+   * <p><b>Value</b>
+   * <ul>
+   * <li> maximum size (in bytes) of the JPEG image <i>[default:
+   * <code>0</code> (no limit)]</i>
+   * </ul>
+   */
+  public static final int PARAM_TARGETSIZE = 25;
 
 
   /**
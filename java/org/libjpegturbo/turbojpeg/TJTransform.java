@@ -157,6 +157,16 @@ public class TJTransform extends Rectangle {
    * coding will improve compression slightly (generally 5% or less.)
    */
   public static final int OPT_OPTIMIZE    = (1 << 8);
+  /**
+   * This option will requantize the DCT coefficients of the JPEG image
+   * generated by this particular transform, using the standard quantization
+   * tables scaled to the JPEG quality level specified in
+   * {@link TJ#PARAM_QUALITY}.  This reduces the size of the JPEG image without
+   * fully decompressing and recompressing it.  Quantization table entries that
+   * are finer than the corresponding entries in the source image are raised
+   * to match the source.
+   */
+  public static final int OPT_REQUANT     = (1 << 9);
 
 
   /**
@@ -217,12 +217,57 @@ rgb_ycc_start(j_compress_ptr cinfo)
   my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
   JLONG *rgb_ycc_tab;
   JLONG i;
+  /* The color matrix applies only to RGB->YCbCr conversion.  RGB->grayscale
+   * conversion always uses the JFIF luminance weights.
+   */
+  J_COLOR_MATRIX matrix = cinfo->jpeg_color_space == JCS_YCbCr ?
+                          cinfo->master->color_matrix : JCM_BT601;
 
   /* Allocate and fill in the conversion tables. */
   cconvert->rgb_ycc_tab = rgb_ycc_tab = (JLONG *)
     (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
                                 (TABLE_SIZE * sizeof(JLONG)));
 
+  if (matrix != JCM_BT601) {
+    /* Derive the constants from the luminance weights Kr and Kb:
+     *      Y  = ys * (Kr * R + Kg * G + Kb * B)  + y_offset
+     *      Cb = cs * (B - Y') / (2 * (1 - Kb))  + _CENTERJSAMPLE
+     *      Cr = cs * (R - Y') / (2 * (1 - Kr))  + _CENTERJSAMPLE
+     * where Kg = 1 - Kr - Kb, Y' is the unscaled luminance, and ys, cs, and
+     * y_offset compress the full sample range into the limited range (if
+     * applicable.)  The G coefficients are derived from the others so that
+     * grays still map exactly to Cb = Cr = _CENTERJSAMPLE.
+     */
+    double kr = JCM_KR(matrix), kb = JCM_KB(matrix), ys = 1.0, cs = 1.0;
+    JLONG y_r, y_g, y_b, c_half, cb_r, cb_g, cr_g, cr_b, y_offset = 0;
+
+    if (JCM_IS_LIMITED(matrix)) {
+      ys = (double)(219 << (BITS_IN_JSAMPLE - 8)) / _MAXJSAMPLE;
+      cs = (double)(224 << (BITS_IN_JSAMPLE - 8)) / _MAXJSAMPLE;
+      y_offset = (JLONG)(16 << (BITS_IN_JSAMPLE - 8)) << SCALEBITS;
+    }
+    y_r = FIX(ys * kr);
+    y_b = FIX(ys * kb);
+    y_g = FIX(ys) - y_r - y_b;
+    c_half = FIX(cs * 0.5);
+    cb_r = FIX(cs * 0.5 * kr / (1.0 - kb));
+    cb_g = c_half - cb_r;
+    cr_b = FIX(cs * 0.5 * kb / (1.0 - kr));
+    cr_g = c_half - cr_b;
+
+    for (i = 0; i <= _MAXJSAMPLE; i++) {
+      rgb_ycc_tab[i + R_Y_OFF] = y_r * i;
+      rgb_ycc_tab[i + G_Y_OFF] = y_g * i;
+      rgb_ycc_tab[i + B_Y_OFF] = y_b * i + y_offset + ONE_HALF;
+      rgb_ycc_tab[i + R_CB_OFF] = (-cb_r) * i;
+      rgb_ycc_tab[i + G_CB_OFF] = (-cb_g) * i;
+      rgb_ycc_tab[i + B_CB_OFF] = c_half * i + CBCR_OFFSET + ONE_HALF - 1;
+      rgb_ycc_tab[i + G_CR_OFF] = (-cr_g) * i;
+      rgb_ycc_tab[i + B_CR_OFF] = (-cr_b) * i;
+    }
+    return;
+  }
+
   for (i = 0; i <= _MAXJSAMPLE; i++) {
     rgb_ycc_tab[i + R_Y_OFF] = FIX(0.29900) * i;
     rgb_ycc_tab[i + G_Y_OFF] = FIX(0.58700) * i;
@@ -389,21 +434,34 @@ rgb_rgb_convert(j_compress_ptr cinfo, _JSAMPARRAY input_buf,
  * This version handles Adobe-style CMYK->YCCK conversion,
  * where we convert R=1-C, G=1-M, and B=1-Y to YCbCr using the same
  * conversion as above, while passing K (black) unchanged.
- * We assume rgb_ycc_start has been called.
+ *
+ * There are no SIMD extensions for this conversion, so rather than looking up
+ * the products in rgb_ycc_tab[], we compute them using 32-bit integer
+ * arithmetic.  The results are identical, but the loop contains no table
+ * lookups, so the compiler can vectorize it.  (The largest intermediate value,
+ * which occurs with 12-bit samples, is less than 2^29.)
  */
 
+#define Y_R   ((int)FIX(0.29900))
+#define Y_G   ((int)FIX(0.58700))
+#define Y_B   ((int)FIX(0.11400))
+#define CB_R  ((int)FIX(0.16874))
+#define CB_G  ((int)FIX(0.33126))
+#define CR_G  ((int)FIX(0.41869))
+#define CR_B  ((int)FIX(0.08131))
+#define HALF  ((int)FIX(0.50000))
+
 METHODDEF(void)
 cmyk_ycck_convert(j_compress_ptr cinfo, _JSAMPARRAY input_buf,
                   _JSAMPIMAGE output_buf, JDIMENSION output_row, int num_rows)
 {
 #if BITS_IN_JSAMPLE != 16
-  my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
   register int r, g, b;
-  register JLONG *ctab = cconvert->rgb_ycc_tab;
   register _JSAMPROW inptr;
   register _JSAMPROW outptr0, outptr1, outptr2, outptr3;
   register JDIMENSION col;
   JDIMENSION num_cols = cinfo->image_width;
+  const int cbcr_offset = (int)CBCR_OFFSET + (int)ONE_HALF - 1;
 
   while (--num_rows >= 0) {
     inptr = *input_buf++;
@@ -425,14 +483,14 @@ cmyk_ycck_convert(j_compress_ptr cinfo, _JSAMPARRAY input_buf,
        * need the general RIGHT_SHIFT macro.
        */
       /* Y */
-      outptr0[col] = (_JSAMPLE)((ctab[r + R_Y_OFF] + ctab[g + G_Y_OFF] +
-                                 ctab[b + B_Y_OFF]) >> SCALEBITS);
+      outptr0[col] = (_JSAMPLE)((Y_R * r + Y_G * g + Y_B * b +
+                                 (int)ONE_HALF) >> SCALEBITS);
       /* Cb */
-      outptr1[col] = (_JSAMPLE)((ctab[r + R_CB_OFF] + ctab[g + G_CB_OFF] +
-                                 ctab[b + B_CB_OFF]) >> SCALEBITS);
+      outptr1[col] = (_JSAMPLE)((HALF * b - CB_R * r - CB_G * g +
+                                 cbcr_offset) >> SCALEBITS);
       /* Cr */
-      outptr2[col] = (_JSAMPLE)((ctab[r + R_CR_OFF] + ctab[g + G_CR_OFF] +
-                                 ctab[b + B_CR_OFF]) >> SCALEBITS);
+      outptr2[col] = (_JSAMPLE)((HALF * r - CR_G * g - CR_B * b +
+                                 cbcr_offset) >> SCALEBITS);
     }
   }
 #else
@@ -440,6 +498,15 @@ cmyk_ycck_convert(j_compress_ptr cinfo, _JSAMPARRAY input_buf,
 #endif
 }
 
+#undef Y_R
+#undef Y_G
+#undef Y_B
+#undef CB_R
+#undef CB_G
+#undef CR_G
+#undef CR_B
+#undef HALF
+
 
 /*
  * Convert some rows of samples to the JPEG colorspace.
@@ -659,7 +726,8 @@ _jinit_color_converter(j_compress_ptr cinfo)
       ERREXIT(cinfo, JERR_BAD_J_COLORSPACE);
     if (IsExtRGB(cinfo->in_color_space)) {
 #ifdef WITH_SIMD
-      if (jsimd_can_rgb_ycc())
+      /* The SIMD routines implement only the JFIF color matrix. */
+      if (cinfo->master->color_matrix == JCM_BT601 && jsimd_can_rgb_ycc())
         cconvert->pub._color_convert = jsimd_rgb_ycc_convert;
       else
 #endif
@@ -702,7 +770,6 @@ _jinit_color_converter(j_compress_ptr cinfo)
     if (cinfo->num_components != 4)
       ERREXIT(cinfo, JERR_BAD_J_COLORSPACE);
     if (cinfo->in_color_space == JCS_CMYK) {
-      cconvert->pub.start_pass = rgb_ycc_start;
       cconvert->pub._color_convert = cmyk_ycck_convert;
     } else if (cinfo->in_color_space == JCS_YCCK) {
 #if defined(WITH_SIMD) && defined(__mips__)
@@ -60,6 +60,9 @@ typedef struct {
   /* work area for FDCT subroutine */
   DCTELEM *workspace;
 
+  /* index of next block in the forward DCT cache */
+  size_t dct_cache_pos;
+
 #ifdef DCT_FLOAT_SUPPORTED
   /* Same as above for the floating-point case. */
   float_DCT_method_ptr float_dct;
@@ -220,6 +223,102 @@ compute_reciprocal(UINT16 divisor, DCTELEM *dtbl)
   else return 1;
 }
 
+
+/*
+ * Cache of quantization divisors.
+ *
+ * Computing the reciprocals requires a division for each coefficient, so we
+ * retain the divisors for the most recently used quantization tables in the
+ * permanent pool and reuse them when compressing subsequent images with the
+ * same tables and DCT method.  Entries are matched by table contents.
+ */
+
+#define DIVISOR_CACHE_SIZE  4
+
+typedef struct {
+  J_DCT_METHOD dct_method;
+  UINT16 quantval[DCTSIZE2];
+  boolean reciprocal_ok;        /* compute_reciprocal() returned 1 for all */
+  DCTELEM divisors[DCTSIZE2 * 4];
+} divisor_cache_entry;
+
+struct jpeg_divisor_cache {
+  divisor_cache_entry entries[DIVISOR_CACHE_SIZE];
+  int num_entries;
+  int next;                     /* next entry to replace */
+};
+
+
+/*
+ * The SIMD quantization routines cannot handle divisors for which
+ * compute_reciprocal() returned 0, so fall back to the C routine for this
+ * image if any such divisors are in use.
+ */
+
+LOCAL(void)
+check_reciprocals(my_fdct_ptr fdct, boolean reciprocal_ok)
+{
+#ifdef WITH_SIMD
+  if (!reciprocal_ok && fdct->quantize == jsimd_quantize)
+    fdct->quantize = quantize;
+#endif
+}
+
+
+/*
+ * Look up a quantization table in the cache.  If a match is found, then the
+ * divisors are copied into dtbl, and TRUE is returned.
+ */
+
+LOCAL(boolean)
+get_cached_divisors(j_compress_ptr cinfo, JQUANT_TBL *qtbl, DCTELEM *dtbl)
+{
+  struct jpeg_divisor_cache *cache = cinfo->master->divisor_cache;
+  divisor_cache_entry *entry;
+  int i;
+
+  if (cache == NULL)
+    return FALSE;
+
+  for (i = 0; i < cache->num_entries; i++) {
+    entry = &cache->entries[i];
+    if (entry->dct_method == cinfo->dct_method &&
+        !memcmp(entry->quantval, qtbl->quantval, sizeof(entry->quantval))) {
+      memcpy(dtbl, entry->divisors, sizeof(entry->divisors));
+      check_reciprocals((my_fdct_ptr)cinfo->fdct, entry->reciprocal_ok);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+/*
+ * Add a quantization table and its divisors to the cache, replacing the least
+ * recently added entry if the cache is full.
+ */
+
+LOCAL(void)
+cache_divisors(j_compress_ptr cinfo, JQUANT_TBL *qtbl, DCTELEM *dtbl,
+               boolean reciprocal_ok)
+{
+  struct jpeg_divisor_cache *cache = cinfo->master->divisor_cache;
+  divisor_cache_entry *entry;
+
+  if (cache == NULL)
+    return;
+
+  entry = &cache->entries[cache->next];
+  if (cache->num_entries < DIVISOR_CACHE_SIZE)
+    cache->num_entries++;
+  cache->next = (cache->next + 1) % DIVISOR_CACHE_SIZE;
+
+  entry->dct_method = cinfo->dct_method;
+  memcpy(entry->quantval, qtbl->quantval, sizeof(entry->quantval));
+  entry->reciprocal_ok = reciprocal_ok;
+  memcpy(entry->divisors, dtbl, sizeof(entry->divisors));
+}
+
 #endif
 
 
@@ -240,6 +339,13 @@ start_pass_fdctmgr(j_compress_ptr cinfo)
   jpeg_component_info *compptr;
   JQUANT_TBL *qtbl;
   DCTELEM *dtbl;
+  boolean done[NUM_QUANT_TBLS];
+#if BITS_IN_JSAMPLE == 8
+  boolean reciprocal_ok;
+#endif
+
+  fdct->dct_cache_pos = 0;
+  memset(done, 0, sizeof(done));
 
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
@@ -249,8 +355,12 @@ start_pass_fdctmgr(j_compress_ptr cinfo)
         cinfo->quant_tbl_ptrs[qtblno] == NULL)
       ERREXIT1(cinfo, JERR_NO_QUANT_TABLE, qtblno);
     qtbl = cinfo->quant_tbl_ptrs[qtblno];
-    /* Compute divisors for this quant table */
-    /* We may do this more than once for same table, but it's not a big deal */
+    /* Compute divisors for this quant table, unless we already did so for
+     * another component.
+     */
+    if (done[qtblno])
+      continue;
+    done[qtblno] = TRUE;
     switch (cinfo->dct_method) {
 #ifdef DCT_ISLOW_SUPPORTED
     case JDCT_ISLOW:
@@ -263,19 +373,23 @@ start_pass_fdctmgr(j_compress_ptr cinfo)
                                       (DCTSIZE2 * 4) * sizeof(DCTELEM));
       }
       dtbl = fdct->divisors[qtblno];
-      for (i = 0; i < DCTSIZE2; i++) {
 #if BITS_IN_JSAMPLE == 8
-#ifdef WITH_SIMD
-        if (!compute_reciprocal(qtbl->quantval[i] << 3, &dtbl[i]) &&
-            fdct->quantize == jsimd_quantize)
-          fdct->quantize = quantize;
-#else
-        compute_reciprocal(qtbl->quantval[i] << 3, &dtbl[i]);
+      if (get_cached_divisors(cinfo, qtbl, dtbl))
+        break;
+      reciprocal_ok = TRUE;
 #endif
+      for (i = 0; i < DCTSIZE2; i++) {
+#if BITS_IN_JSAMPLE == 8
+        if (!compute_reciprocal(qtbl->quantval[i] << 3, &dtbl[i]))
+          reciprocal_ok = FALSE;
 #else
         dtbl[i] = ((DCTELEM)qtbl->quantval[i]) << 3;
 #endif
       }
+#if BITS_IN_JSAMPLE == 8
+      check_reciprocals(fdct, reciprocal_ok);
+      cache_divisors(cinfo, qtbl, dtbl, reciprocal_ok);
+#endif
       break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
@@ -307,21 +421,18 @@ start_pass_fdctmgr(j_compress_ptr cinfo)
                                         (DCTSIZE2 * 4) * sizeof(DCTELEM));
         }
         dtbl = fdct->divisors[qtblno];
+#if BITS_IN_JSAMPLE == 8
+        if (get_cached_divisors(cinfo, qtbl, dtbl))
+          break;
+        reciprocal_ok = TRUE;
+#endif
         for (i = 0; i < DCTSIZE2; i++) {
 #if BITS_IN_JSAMPLE == 8
-#ifdef WITH_SIMD
           if (!compute_reciprocal(
                 DESCALE(MULTIPLY16V16((JLONG)qtbl->quantval[i],
                                       (JLONG)aanscales[i]),
-                        CONST_BITS - 3), &dtbl[i]) &&
-              fdct->quantize == jsimd_quantize)
-            fdct->quantize = quantize;
-#else
-          compute_reciprocal(
-            DESCALE(MULTIPLY16V16((JLONG)qtbl->quantval[i],
-                                  (JLONG)aanscales[i]),
-                    CONST_BITS-3), &dtbl[i]);
-#endif
+                        CONST_BITS - 3), &dtbl[i]))
+            reciprocal_ok = FALSE;
 #else
           dtbl[i] = (DCTELEM)
             DESCALE(MULTIPLY16V16((JLONG)qtbl->quantval[i],
@@ -329,6 +440,10 @@ start_pass_fdctmgr(j_compress_ptr cinfo)
                     CONST_BITS - 3);
 #endif
         }
+#if BITS_IN_JSAMPLE == 8
+        check_reciprocals(fdct, reciprocal_ok);
+        cache_divisors(cinfo, qtbl, dtbl, reciprocal_ok);
+#endif
       }
       break;
 #endif
@@ -489,6 +604,47 @@ quantize(JCOEFPTR coef_block, DCTELEM *divisors, DCTELEM *workspace)
 }
 
 
+#if BITS_IN_JSAMPLE == 8
+
+/*
+ * Version of forward_DCT() that fills or replays the forward DCT cache.
+ * The unquantized output of the integer DCT methods is scaled up by at most
+ * 8 * 2 relative to a true DCT, so it always fits in a JCOEF with 8-bit
+ * samples.
+ */
+
+LOCAL(void)
+forward_DCT_cached(j_compress_ptr cinfo, _JSAMPARRAY sample_data,
+                   JBLOCKROW coef_blocks, JDIMENSION start_row,
+                   JDIMENSION start_col, JDIMENSION num_blocks,
+                   DCTELEM *divisors)
+{
+  my_fdct_ptr fdct = (my_fdct_ptr)cinfo->fdct;
+  DCTELEM *workspace = fdct->workspace;
+  JBLOCKROW cache_ptr = fdct->pub.dct_cache + fdct->dct_cache_pos;
+  JDIMENSION bi;
+  int i;
+
+  fdct->dct_cache_pos += num_blocks;
+  sample_data += start_row;
+
+  for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
+    if (fdct->pub.dct_cache_valid) {
+      for (i = 0; i < DCTSIZE2; i++)
+        workspace[i] = (DCTELEM)cache_ptr[bi][i];
+    } else {
+      (*fdct->convsamp) (sample_data, start_col, workspace);
+      (*fdct->dct) (workspace);
+      for (i = 0; i < DCTSIZE2; i++)
+        cache_ptr[bi][i] = (JCOEF)workspace[i];
+    }
+    (*fdct->quantize) (coef_blocks[bi], divisors, workspace);
+  }
+}
+
+#endif
+
+
 /*
  * Perform forward DCT on one or more blocks of a component.
  *
@@ -515,6 +671,14 @@ forward_DCT(j_compress_ptr cinfo, jpeg_component_info *compptr,
   quantize_method_ptr do_quantize = fdct->quantize;
   workspace = fdct->workspace;
 
+#if BITS_IN_JSAMPLE == 8
+  if (fdct->pub.dct_cache != NULL) {
+    forward_DCT_cached(cinfo, sample_data, coef_blocks, start_row, start_col,
+                       num_blocks, divisors);
+    return;
+  }
+#endif
+
   sample_data += start_row;     /* fold in the vertical offset once */
 
   for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
@@ -738,6 +902,9 @@ _jinit_forward_dct(j_compress_ptr cinfo)
       (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
                                   sizeof(DCTELEM) * DCTSIZE2);
 
+  fdct->pub.dct_cache = NULL;
+  fdct->pub.dct_cache_valid = FALSE;
+
   /* Mark divisor tables unallocated */
   for (i = 0; i < NUM_QUANT_TBLS; i++) {
     fdct->divisors[i] = NULL;
@@ -745,4 +912,16 @@ _jinit_forward_dct(j_compress_ptr cinfo)
     fdct->float_divisors[i] = NULL;
 #endif
   }
+
+#if BITS_IN_JSAMPLE == 8
+  /* Allocate the divisor cache, if we haven't already done so */
+  if (cinfo->dct_method != JDCT_FLOAT &&
+      cinfo->master->divisor_cache == NULL) {
+    cinfo->master->divisor_cache = (struct jpeg_divisor_cache *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                  sizeof(struct jpeg_divisor_cache));
+    memset(cinfo->master->divisor_cache, 0,
+           sizeof(struct jpeg_divisor_cache));
+  }
+#endif
 }
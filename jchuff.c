@@ -221,6 +221,117 @@ start_pass_huff(j_compress_ptr cinfo, boolean gather_statistics)
 }
 
 
+/*
+ * Cache of derived Huffman tables.
+ *
+ * As in the decompressor (see jdhuff.c), we retain the derived values for the
+ * most recently used Huffman tables in the permanent pool, so that compressing
+ * a series of images with the same tables does not recompute them for each
+ * image.  Entries are matched by table contents.
+ */
+
+#define C_DERIVED_CACHE_SIZE  8
+
+typedef struct {
+  boolean isDC;
+  boolean lossless;             /* DC symbols were validated for lossless */
+  UINT8 bits[17];
+  UINT8 huffval[256];
+  c_derived_tbl dtbl;
+} c_derived_cache_entry;
+
+struct jpeg_c_derived_cache {
+  c_derived_cache_entry entries[C_DERIVED_CACHE_SIZE];
+  int num_entries;
+  int next;                     /* next entry to replace */
+};
+
+
+/*
+ * Look up a Huffman table in the cache.  If a match is found, then the
+ * derived values are copied into dtbl, and TRUE is returned.
+ */
+
+LOCAL(boolean)
+get_cached_c_derived_tbl(j_compress_ptr cinfo, boolean isDC, JHUFF_TBL *htbl,
+                         c_derived_tbl *dtbl)
+{
+  struct jpeg_c_derived_cache *cache = cinfo->master->huff_cache;
+  c_derived_cache_entry *entry;
+  int i, l, numsymbols = 0;
+
+  if (cache == NULL)
+    return FALSE;
+
+  for (l = 1; l <= 16; l++)
+    numsymbols += htbl->bits[l];
+  if (numsymbols > 256)
+    return FALSE;
+
+  for (i = 0; i < cache->num_entries; i++) {
+    entry = &cache->entries[i];
+    if (entry->isDC == isDC && entry->lossless == cinfo->master->lossless &&
+        !memcmp(entry->bits, htbl->bits, sizeof(entry->bits)) &&
+        !memcmp(entry->huffval, htbl->huffval, numsymbols)) {
+      memcpy(dtbl, &entry->dtbl, sizeof(c_derived_tbl));
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+/*
+ * Add a validated Huffman table and its derived values to the cache,
+ * replacing the least recently added entry if the cache is full.
+ */
+
+LOCAL(void)
+cache_c_derived_tbl(j_compress_ptr cinfo, boolean isDC, JHUFF_TBL *htbl,
+                    c_derived_tbl *dtbl)
+{
+  struct jpeg_c_derived_cache *cache = cinfo->master->huff_cache;
+  c_derived_cache_entry *entry;
+
+  if (cache == NULL)
+    return;
+
+  entry = &cache->entries[cache->next];
+  if (cache->num_entries < C_DERIVED_CACHE_SIZE)
+    cache->num_entries++;
+  cache->next = (cache->next + 1) % C_DERIVED_CACHE_SIZE;
+
+  entry->isDC = isDC;
+  entry->lossless = cinfo->master->lossless;
+  memcpy(entry->bits, htbl->bits, sizeof(entry->bits));
+  memcpy(entry->huffval, htbl->huffval, sizeof(entry->huffval));
+  memcpy(&entry->dtbl, dtbl, sizeof(c_derived_tbl));
+}
+
+
+/*
+ * Allocate the cache of derived Huffman tables, if it has not already been
+ * allocated.  The cache is allocated in its entirety when the first Huffman
+ * encoder is initialized, so that its size does not depend on the tables
+ * that have been used.
+ *
+ * This is called by jinit_huff_encoder, jinit_phuff_encoder, and
+ * jinit_lhuff_encoder.
+ */
+
+GLOBAL(void)
+jpeg_init_c_derived_cache(j_compress_ptr cinfo)
+{
+  if (cinfo->master->huff_cache == NULL) {
+    cinfo->master->huff_cache = (struct jpeg_c_derived_cache *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                  sizeof(struct jpeg_c_derived_cache));
+    memset(cinfo->master->huff_cache, 0,
+           sizeof(struct jpeg_c_derived_cache));
+  }
+}
+
+
 /*
  * Compute the derived values for a Huffman table.
  * This routine also performs some validation checks on the table.
@@ -258,6 +369,10 @@ jpeg_make_c_derived_tbl(j_compress_ptr cinfo, boolean isDC, int tblno,
                                   sizeof(c_derived_tbl));
   dtbl = *pdtbl;
 
+  /* Reuse the derived values from a previous image, if possible. */
+  if (get_cached_c_derived_tbl(cinfo, isDC, htbl, dtbl))
+    return;
+
   /* Figure C.1: make table of Huffman code length for each symbol */
 
   p = 0;
@@ -315,6 +430,8 @@ jpeg_make_c_derived_tbl(j_compress_ptr cinfo, boolean isDC, int tblno,
     dtbl->ehufco[i] = huffcode[p];
     dtbl->ehufsi[i] = huffsize[p];
   }
+
+  cache_c_derived_tbl(cinfo, isDC, htbl, dtbl);
 }
 
 
@@ -1100,6 +1217,21 @@ jpeg_gen_optimal_table(j_compress_ptr cinfo, JHUFF_TBL *htbl, long freq[])
 }
 
 
+/*
+ * Add the symbol counts from a statistics-gathering pass to the caller's
+ * running totals.
+ */
+
+LOCAL(void)
+accumulate_counts(long *totals, const long *counts)
+{
+  int i;
+
+  for (i = 0; i < 257; i++)
+    totals[i] += counts[i];
+}
+
+
 /*
  * Finish up a statistics-gathering pass and create the new Huffman tables.
  */
@@ -1125,6 +1257,9 @@ finish_pass_gather(j_compress_ptr cinfo)
     dctbl = compptr->dc_tbl_no;
     actbl = compptr->ac_tbl_no;
     if (!did_dc[dctbl]) {
+      if (entropy->pub.huff_counts != NULL)
+        accumulate_counts(entropy->pub.huff_counts[0][dctbl],
+                          entropy->dc_count_ptrs[dctbl]);
       htblptr = &cinfo->dc_huff_tbl_ptrs[dctbl];
       if (*htblptr == NULL)
         *htblptr = jpeg_alloc_huff_table((j_common_ptr)cinfo);
@@ -1132,6 +1267,9 @@ finish_pass_gather(j_compress_ptr cinfo)
       did_dc[dctbl] = TRUE;
     }
     if (!did_ac[actbl]) {
+      if (entropy->pub.huff_counts != NULL)
+        accumulate_counts(entropy->pub.huff_counts[1][actbl],
+                          entropy->ac_count_ptrs[actbl]);
       htblptr = &cinfo->ac_huff_tbl_ptrs[actbl];
       if (*htblptr == NULL)
         *htblptr = jpeg_alloc_huff_table((j_common_ptr)cinfo);
@@ -1160,6 +1298,7 @@ jinit_huff_encoder(j_compress_ptr cinfo)
                                 sizeof(huff_entropy_encoder));
   cinfo->entropy = (struct jpeg_entropy_encoder *)entropy;
   entropy->pub.start_pass = start_pass_huff;
+  entropy->pub.huff_counts = NULL;
 
   /* Mark tables unallocated */
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
@@ -1168,4 +1307,6 @@ jinit_huff_encoder(j_compress_ptr cinfo)
     entropy->dc_count_ptrs[i] = entropy->ac_count_ptrs[i] = NULL;
 #endif
   }
+
+  jpeg_init_c_derived_cache(cinfo);
 }
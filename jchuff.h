@@ -39,6 +39,9 @@ typedef struct {
 EXTERN(void) jpeg_make_c_derived_tbl(j_compress_ptr cinfo, boolean isDC,
                                      int tblno, c_derived_tbl **pdtbl);
 
+/* Allocate the cache of derived tables shared by the Huffman encoders */
+EXTERN(void) jpeg_init_c_derived_cache(j_compress_ptr cinfo);
+
 /* Generate an optimal table definition given the specified counts */
 EXTERN(void) jpeg_gen_optimal_table(j_compress_ptr cinfo, JHUFF_TBL *htbl,
                                     long freq[]);
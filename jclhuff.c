@@ -582,6 +582,8 @@ jinit_lhuff_encoder(j_compress_ptr cinfo)
     entropy->count_ptrs[i] = NULL;
 #endif
   }
+
+  jpeg_init_c_derived_cache(cinfo);
 }
 
 #endif /* C_LOSSLESS_SUPPORTED */
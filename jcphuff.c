@@ -1087,6 +1087,8 @@ jinit_phuff_encoder(j_compress_ptr cinfo)
     entropy->count_ptrs[i] = NULL;
   }
   entropy->bit_buffer = NULL;   /* needed only in AC refinement scan */
+
+  jpeg_init_c_derived_cache(cinfo);
 }
 
 #endif /* C_PROGRESSIVE_SUPPORTED */
@@ -312,7 +312,7 @@ h2v2_smooth_downsample(j_compress_ptr cinfo, jpeg_component_info *compptr,
   int data_unit = cinfo->master->lossless ? 1 : DCTSIZE;
   JDIMENSION output_cols = compptr->width_in_blocks * data_unit;
   register _JSAMPROW inptr0, inptr1, above_ptr, below_ptr, outptr;
-  JLONG membersum, neighsum, memberscale, neighscale;
+  int membersum, neighsum, memberscale, neighscale;
 
   /* Expand input data enough to let all the output samples be generated
    * by the standard loop.  Special-casing padded output would be more
@@ -332,6 +332,11 @@ h2v2_smooth_downsample(j_compress_ptr cinfo, jpeg_component_info *compptr,
    * pixels, or SF/2 overall.  In order to use integer arithmetic, these
    * factors are scaled by 2^16 = 65536.
    * Also recall that SF = smoothing_factor / 1024.
+   *
+   * The sums fit in 32 bits for 8-bit and 12-bit samples (the largest, with
+   * 12-bit samples, is less than 2^29), and smoothing is never enabled with
+   * 16-bit (lossless) samples, so we use int rather than JLONG.  That allows
+   * the compiler to vectorize the main loop.
    */
 
   memberscale = 16384 - cinfo->smoothing_factor * 80; /* scaled (1-5*SF)/4 */
@@ -401,7 +406,7 @@ fullsize_smooth_downsample(j_compress_ptr cinfo, jpeg_component_info *compptr,
   int data_unit = cinfo->master->lossless ? 1 : DCTSIZE;
   JDIMENSION output_cols = compptr->width_in_blocks * data_unit;
   register _JSAMPROW inptr, above_ptr, below_ptr, outptr;
-  JLONG membersum, neighsum, memberscale, neighscale;
+  int membersum, neighsum, memberscale, neighscale;
   int colsum, lastcolsum, nextcolsum;
 
   /* Expand input data enough to let all the output samples be generated
@@ -415,9 +420,14 @@ fullsize_smooth_downsample(j_compress_ptr cinfo, jpeg_component_info *compptr,
    * smoothed pixel, while the main pixel contributes (1-8*SF).  In order
    * to use integer arithmetic, these factors are multiplied by 2^16 = 65536.
    * Also recall that SF = smoothing_factor / 1024.
+   *
+   * As in h2v2_smooth_downsample(), the sums fit in an int.  The main loop
+   * recomputes the neighboring column sums for each pixel rather than carrying
+   * them over from the previous pixel, so there is no loop-carried dependency
+   * to prevent the compiler from vectorizing it.
    */
 
-  memberscale = 65536L - cinfo->smoothing_factor * 512L; /* scaled 1-8*SF */
+  memberscale = 65536 - cinfo->smoothing_factor * 512; /* scaled 1-8*SF */
   neighscale = cinfo->smoothing_factor * 64; /* scaled SF */
 
   for (outrow = 0; outrow < compptr->v_samp_factor; outrow++) {
@@ -427,25 +437,29 @@ fullsize_smooth_downsample(j_compress_ptr cinfo, jpeg_component_info *compptr,
     below_ptr = input_data[outrow + 1];
 
     /* Special case for first column */
-    colsum = (*above_ptr++) + (*below_ptr++) + inptr[0];
-    membersum = *inptr++;
-    nextcolsum = above_ptr[0] + below_ptr[0] + inptr[0];
+    colsum = above_ptr[0] + below_ptr[0] + inptr[0];
+    membersum = inptr[0];
+    nextcolsum = above_ptr[1] + below_ptr[1] + inptr[1];
     neighsum = colsum + (colsum - membersum) + nextcolsum;
     membersum = membersum * memberscale + neighsum * neighscale;
-    *outptr++ = (_JSAMPLE)((membersum + 32768) >> 16);
-    lastcolsum = colsum;  colsum = nextcolsum;
-
-    for (colctr = output_cols - 2; colctr > 0; colctr--) {
-      membersum = *inptr++;
-      above_ptr++;  below_ptr++;
-      nextcolsum = above_ptr[0] + below_ptr[0] + inptr[0];
-      neighsum = lastcolsum + (colsum - membersum) + nextcolsum;
+    outptr[0] = (_JSAMPLE)((membersum + 32768) >> 16);
+
+    for (colctr = 1; colctr < output_cols - 1; colctr++) {
+      membersum = inptr[colctr];
+      neighsum = above_ptr[colctr - 1] + above_ptr[colctr] +
+                 above_ptr[colctr + 1] + below_ptr[colctr - 1] +
+                 below_ptr[colctr] + below_ptr[colctr + 1] +
+                 inptr[colctr - 1] + inptr[colctr + 1];
       membersum = membersum * memberscale + neighsum * neighscale;
-      *outptr++ = (_JSAMPLE)((membersum + 32768) >> 16);
-      lastcolsum = colsum;  colsum = nextcolsum;
+      outptr[colctr] = (_JSAMPLE)((membersum + 32768) >> 16);
     }
 
     /* Special case for last column */
+    colctr = output_cols - 1;
+    lastcolsum = above_ptr[colctr - 1] + below_ptr[colctr - 1] +
+                 inptr[colctr - 1];
+    colsum = above_ptr[colctr] + below_ptr[colctr] + inptr[colctr];
+    inptr += colctr;  outptr += colctr;
     membersum = *inptr;
     neighsum = lastcolsum + (colsum - membersum) + colsum;
     membersum = membersum * memberscale + neighsum * neighscale;
@@ -283,6 +283,14 @@ _jpeg_crop_scanline(j_decompress_ptr cinfo, JDIMENSION *xoffset,
                                 (long)align) - 1;
   }
 
+#ifdef UPSAMPLE_MERGING_SUPPORTED
+  /* The merged upsampler works with any chroma component width, and
+   * _jinit_upsampler() must not be called on its private state.
+   */
+  if (master->using_merged_upsample)
+    reinit_upsampler = FALSE;
+#endif
+
   if (reinit_upsampler) {
     cinfo->master->jinit_upsampler_no_alloc = TRUE;
     _jinit_upsampler(cinfo);
@@ -416,6 +424,26 @@ read_and_discard_scanlines(j_decompress_ptr cinfo, JDIMENSION num_lines)
 }
 
 
+/*
+ * Called by _jpeg_skip_scanlines() after the output scanline has been moved.
+ * The merged upsampler keeps its own count of the remaining rows.  If skipping
+ * has moved to the start of a new row group, then any spare row that the
+ * merged upsampler was holding belongs to the skipped region.
+ */
+
+LOCAL(void)
+update_merged_upsampler(j_decompress_ptr cinfo, boolean new_row_group)
+{
+#ifdef UPSAMPLE_MERGING_SUPPORTED
+  my_merged_upsample_ptr upsample = (my_merged_upsample_ptr)cinfo->upsample;
+
+  if (new_row_group)
+    upsample->spare_full = FALSE;
+  upsample->rows_to_go = cinfo->output_height - cinfo->output_scanline;
+#endif
+}
+
+
 /*
  * Called by _jpeg_skip_scanlines().  This partially skips a decompress block
  * by incrementing the rowgroup counter.
@@ -539,7 +567,8 @@ _jpeg_skip_scanlines(j_decompress_ptr cinfo, JDIMENSION num_lines)
     if (!master->using_merged_upsample) {
       upsample->next_row_out = cinfo->max_v_samp_factor;
       upsample->rows_to_go = cinfo->output_height - cinfo->output_scanline;
-    }
+    } else
+      update_merged_upsampler(cinfo, TRUE);
   }
 
   /* Skipping is much simpler when context rows are not required. */
@@ -554,7 +583,8 @@ _jpeg_skip_scanlines(j_decompress_ptr cinfo, JDIMENSION num_lines)
       if (!master->using_merged_upsample) {
         upsample->next_row_out = cinfo->max_v_samp_factor;
         upsample->rows_to_go = cinfo->output_height - cinfo->output_scanline;
-      }
+      } else
+        update_merged_upsampler(cinfo, TRUE);
     }
   }
 
@@ -591,6 +621,8 @@ _jpeg_skip_scanlines(j_decompress_ptr cinfo, JDIMENSION num_lines)
     }
     if (!master->using_merged_upsample)
       upsample->rows_to_go = cinfo->output_height - cinfo->output_scanline;
+    else
+      update_merged_upsampler(cinfo, FALSE);
     return num_lines;
   }
 
@@ -635,6 +667,8 @@ _jpeg_skip_scanlines(j_decompress_ptr cinfo, JDIMENSION num_lines)
    */
   if (!master->using_merged_upsample)
     upsample->rows_to_go = cinfo->output_height - cinfo->output_scanline;
+  else
+    update_merged_upsampler(cinfo, FALSE);
 
   /* Always skip the requested number of lines. */
   return num_lines;
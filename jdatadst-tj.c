@@ -22,9 +22,16 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jerror.h"
+#include "turbojpeg.h"
 
 void jpeg_mem_dest_tj(j_compress_ptr cinfo, unsigned char **outbuffer,
                       size_t *outsize, boolean alloc);
+void jpeg_chunk_dest_tj(j_compress_ptr cinfo, size_t chunksize,
+                        size_t *outsize);
+void jpeg_get_chunks_tj(j_compress_ptr cinfo, const tjchunk **chunks,
+                        int *numchunks);
+void jpeg_free_chunks_tj(j_compress_ptr cinfo);
+void jpeg_count_dest_tj(j_compress_ptr cinfo, size_t *outsize);
 
 
 #define OUTPUT_BUF_SIZE  4096   /* choose an efficiently fwrite'able size */
@@ -41,6 +48,16 @@ typedef struct {
   JOCTET *buffer;               /* start of buffer */
   size_t bufsize;
   boolean alloc;
+
+  /* Chunked output */
+  tjchunk *chunks;              /* chunk list (retained between images) */
+  int numchunks;                /* number of chunks used by current image */
+  int maxchunks;                /* number of chunks allocated */
+  size_t chunksize;             /* size of each allocated chunk */
+
+  /* Byte counting */
+  JOCTET *scratch;              /* scratch buffer (OUTPUT_BUF_SIZE bytes) */
+  size_t count;                 /* bytes counted in previous buffers */
 } my_mem_destination_mgr;
 
 typedef my_mem_destination_mgr *my_mem_dest_ptr;
@@ -133,25 +150,91 @@ term_mem_destination(j_compress_ptr cinfo)
 
 
 /*
- * Prepare for output to a memory buffer.
- * The caller may supply an own initial buffer with appropriate size.
- * Otherwise, or when the actual data output exceeds the given size,
- * the library adapts the buffer size as necessary.
- * The standard library functions malloc/free are used for allocating
- * larger memory, so the buffer is available to the application after
- * finishing compression, and then the application is responsible for
- * freeing the requested memory.
+ * Move on to the next chunk of the chunk list, allocating it if necessary.
+ * Chunks are retained between images, so no allocation is necessary once the
+ * chunk list is large enough to hold the largest image.
  */
 
-GLOBAL(void)
-jpeg_mem_dest_tj(j_compress_ptr cinfo, unsigned char **outbuffer,
-                 size_t *outsize, boolean alloc)
+LOCAL(void)
+next_chunk(j_compress_ptr cinfo)
 {
-  boolean reused = FALSE;
-  my_mem_dest_ptr dest;
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+  tjchunk *chunk;
+
+  if (dest->numchunks == dest->maxchunks) {
+    int maxchunks = dest->maxchunks ? dest->maxchunks * 2 : 16;
+    tjchunk *chunks;
+
+    if ((chunks = (tjchunk *)realloc(dest->chunks,
+                                     sizeof(tjchunk) * maxchunks)) == NULL)
+      ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    memset(&chunks[dest->maxchunks], 0,
+           sizeof(tjchunk) * (maxchunks - dest->maxchunks));
+    dest->chunks = chunks;
+    dest->maxchunks = maxchunks;
+  }
+  chunk = &dest->chunks[dest->numchunks];
+  if (chunk->buf == NULL &&
+      (chunk->buf = (unsigned char *)malloc(dest->chunksize)) == NULL)
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+  chunk->size = 0;
+  dest->numchunks++;
 
-  if (outbuffer == NULL || outsize == NULL)     /* sanity check */
-    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+  dest->pub.next_output_byte = chunk->buf;
+  dest->pub.free_in_buffer = dest->chunksize;
+}
+
+
+/*
+ * Empty the output buffer (chunked output) --- called whenever the current
+ * chunk fills up.  Rather than growing the output buffer and copying the data
+ * written so far, we simply move on to the next chunk.
+ */
+
+METHODDEF(boolean)
+empty_chunk_output_buffer(j_compress_ptr cinfo)
+{
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+
+  dest->chunks[dest->numchunks - 1].size = dest->chunksize;
+  next_chunk(cinfo);
+
+  return TRUE;
+}
+
+
+/*
+ * Terminate destination (chunked output) --- called by jpeg_finish_compress
+ * after all data has been written.
+ */
+
+METHODDEF(void)
+term_chunk_destination(j_compress_ptr cinfo)
+{
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+  size_t total;
+
+  dest->chunks[dest->numchunks - 1].size =
+    dest->chunksize - dest->pub.free_in_buffer;
+  /* The compressor empties the output buffer as soon as it fills up, so the
+   * last chunk may be empty.
+   */
+  if (dest->chunks[dest->numchunks - 1].size == 0 && dest->numchunks > 1)
+    dest->numchunks--;
+  total = (size_t)(dest->numchunks - 1) * dest->chunksize;
+  *dest->outsize = total + dest->chunks[dest->numchunks - 1].size;
+}
+
+
+/*
+ * Create the destination object, or check that the existing one was created
+ * by this module.
+ */
+
+LOCAL(my_mem_dest_ptr)
+get_mem_dest(j_compress_ptr cinfo)
+{
+  my_mem_dest_ptr dest;
 
   /* The destination object is made permanent so that multiple JPEG images
    * can be written to the same buffer without re-executing jpeg_mem_dest.
@@ -163,6 +246,10 @@ jpeg_mem_dest_tj(j_compress_ptr cinfo, unsigned char **outbuffer,
     dest = (my_mem_dest_ptr)cinfo->dest;
     dest->newbuffer = NULL;
     dest->buffer = NULL;
+    dest->chunks = NULL;
+    dest->numchunks = dest->maxchunks = 0;
+    dest->chunksize = 0;
+    dest->scratch = NULL;
   } else if (cinfo->dest->init_destination != init_mem_destination) {
     /* It is unsafe to reuse the existing destination manager unless it was
      * created by this function.
@@ -170,12 +257,42 @@ jpeg_mem_dest_tj(j_compress_ptr cinfo, unsigned char **outbuffer,
     ERREXIT(cinfo, JERR_BUFFER_SIZE);
   }
 
-  dest = (my_mem_dest_ptr)cinfo->dest;
+  return (my_mem_dest_ptr)cinfo->dest;
+}
+
+
+/*
+ * Prepare for output to a memory buffer.
+ * The caller may supply an own initial buffer with appropriate size.
+ * Otherwise, or when the actual data output exceeds the given size,
+ * the library adapts the buffer size as necessary.
+ * The standard library functions malloc/free are used for allocating
+ * larger memory, so the buffer is available to the application after
+ * finishing compression, and then the application is responsible for
+ * freeing the requested memory.
+ */
+
+GLOBAL(void)
+jpeg_mem_dest_tj(j_compress_ptr cinfo, unsigned char **outbuffer,
+                 size_t *outsize, boolean alloc)
+{
+  boolean reused = FALSE;
+  my_mem_dest_ptr dest;
+
+  if (outbuffer == NULL || outsize == NULL)     /* sanity check */
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+
+  dest = get_mem_dest(cinfo);
   dest->pub.init_destination = init_mem_destination;
   dest->pub.empty_output_buffer = empty_mem_output_buffer;
   dest->pub.term_destination = term_mem_destination;
   if (dest->buffer == *outbuffer && *outbuffer != NULL && alloc)
     reused = TRUE;
+  else if (dest->buffer != *outbuffer)
+    /* The buffer allocated by the previous compression operation now belongs
+     * to the caller, so it must not be freed if the new buffer is grown.
+     */
+    dest->newbuffer = NULL;
   dest->outbuffer = outbuffer;
   dest->outsize = outsize;
   dest->alloc = alloc;
@@ -196,3 +313,137 @@ jpeg_mem_dest_tj(j_compress_ptr cinfo, unsigned char **outbuffer,
     dest->bufsize = *outsize;
   dest->pub.free_in_buffer = dest->bufsize;
 }
+
+
+/*
+ * Prepare for output to a list of fixed-size chunks owned by the destination
+ * object.  The chunks can be retrieved with jpeg_get_chunks_tj() after
+ * finishing compression, and they remain valid until the next image is
+ * written or jpeg_free_chunks_tj() is called.  The total size of the JPEG
+ * image is stored in *outsize by jpeg_finish_compress().
+ */
+
+GLOBAL(void)
+jpeg_chunk_dest_tj(j_compress_ptr cinfo, size_t chunksize, size_t *outsize)
+{
+  my_mem_dest_ptr dest;
+
+  if (outsize == NULL || chunksize == 0)        /* sanity check */
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+
+  dest = get_mem_dest(cinfo);
+  if (dest->chunksize != chunksize) {
+    jpeg_free_chunks_tj(cinfo);
+    dest->chunksize = chunksize;
+  }
+  dest->pub.init_destination = init_mem_destination;
+  dest->pub.empty_output_buffer = empty_chunk_output_buffer;
+  dest->pub.term_destination = term_chunk_destination;
+  dest->outsize = outsize;
+
+  /* Start the first chunk */
+  dest->numchunks = 0;
+  next_chunk(cinfo);
+}
+
+
+/*
+ * Return the chunk list of the most recent image written with chunked
+ * output.
+ */
+
+GLOBAL(void)
+jpeg_get_chunks_tj(j_compress_ptr cinfo, const tjchunk **chunks,
+                   int *numchunks)
+{
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+
+  if (dest == NULL || dest->pub.init_destination != init_mem_destination ||
+      dest->pub.term_destination != term_chunk_destination) {
+    *chunks = NULL;  *numchunks = 0;
+    return;
+  }
+  *chunks = dest->chunks;
+  *numchunks = dest->numchunks;
+}
+
+
+/*
+ * Release the memory used by the chunk list.  This must be called before the
+ * JPEG object is destroyed.
+ */
+
+GLOBAL(void)
+jpeg_free_chunks_tj(j_compress_ptr cinfo)
+{
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+  int i;
+
+  if (dest == NULL || dest->pub.init_destination != init_mem_destination)
+    return;
+  for (i = 0; i < dest->maxchunks; i++)
+    free(dest->chunks[i].buf);
+  free(dest->chunks);
+  dest->chunks = NULL;
+  dest->numchunks = dest->maxchunks = 0;
+}
+
+
+/*
+ * Empty the output buffer (byte counting) --- called whenever the scratch
+ * buffer fills up.  The data is discarded.
+ */
+
+METHODDEF(boolean)
+empty_count_output_buffer(j_compress_ptr cinfo)
+{
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+
+  dest->count += OUTPUT_BUF_SIZE;
+  dest->pub.next_output_byte = dest->scratch;
+  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+
+  return TRUE;
+}
+
+
+/*
+ * Terminate destination (byte counting) --- called by jpeg_finish_compress
+ * after all data has been written.
+ */
+
+METHODDEF(void)
+term_count_destination(j_compress_ptr cinfo)
+{
+  my_mem_dest_ptr dest = (my_mem_dest_ptr)cinfo->dest;
+
+  *dest->outsize = dest->count + OUTPUT_BUF_SIZE - dest->pub.free_in_buffer;
+}
+
+
+/*
+ * Prepare to count the bytes of a JPEG image without storing it.  The size of
+ * the JPEG image is stored in *outsize by jpeg_finish_compress().
+ */
+
+GLOBAL(void)
+jpeg_count_dest_tj(j_compress_ptr cinfo, size_t *outsize)
+{
+  my_mem_dest_ptr dest;
+
+  if (outsize == NULL)                          /* sanity check */
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+
+  dest = get_mem_dest(cinfo);
+  if (dest->scratch == NULL)
+    dest->scratch = (JOCTET *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                  OUTPUT_BUF_SIZE * sizeof(JOCTET));
+  dest->pub.init_destination = init_mem_destination;
+  dest->pub.empty_output_buffer = empty_count_output_buffer;
+  dest->pub.term_destination = term_count_destination;
+  dest->outsize = outsize;
+  dest->count = 0;
+  dest->pub.next_output_byte = dest->scratch;
+  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+}
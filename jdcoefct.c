@@ -417,10 +417,92 @@ smoothing_ok(j_decompress_ptr cinfo)
     prev_coef_bits_latch += SAVED_COEFS;
   }
 
+  /* Allocate block row workspace if not already done.  The DC rows have two
+   * extra columns on either side.
+   */
+  if (smoothing_useful && coef->smooth_dc[0] == NULL) {
+    JDIMENSION max_width = 0, width;
+    int *ptr, i;
+
+    for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+         ci++, compptr++) {
+      width = (JDIMENSION)jround_up((long)compptr->width_in_blocks,
+                                    (long)compptr->h_samp_factor);
+      if (width > max_width)
+        max_width = width;
+    }
+    ptr = (int *)
+      (*cinfo->mem->alloc_large) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                  (5 * (max_width + 4) +
+                                   SAVED_COEFS * max_width) * sizeof(int));
+    for (i = 0; i < 5; i++) {
+      coef->smooth_dc[i] = ptr;
+      ptr += max_width + 4;
+    }
+    for (i = 0; i < SAVED_COEFS; i++) {
+      coef->smooth_est[i] = ptr;
+      ptr += max_width;
+    }
+  }
+
   return smoothing_useful;
 }
 
 
+/*
+ * Copy the DC values of a block row into a DC row workspace, padding it with
+ * two columns on either side.  Columns that lie outside of the decompressed
+ * region replicate the edge values, as do columns beyond the right edge of the
+ * component.
+ */
+
+LOCAL(void)
+get_smooth_dc_row(JBLOCKROW block_row, int *dc_row, JDIMENSION num_cols,
+                  JDIMENSION num_valid_cols)
+{
+  JDIMENSION col;
+
+  dc_row += 2;
+  for (col = 0; col < num_valid_cols; col++)
+    dc_row[col] = (int)block_row[col][0];
+  for (; col < num_cols + 2; col++)
+    dc_row[col] = dc_row[col - 1];
+  dc_row[-1] = dc_row[-2] = dc_row[0];
+}
+
+
+/* DC values of the 5x5 neighborhood of the block in column col of the current
+ * block row, in raster order (DC13 is the current block.)  Because of the
+ * padding, column col of a block row is element col + 2 of its DC row.
+ */
+
+#define DC01  dc_pp[col]
+#define DC02  dc_pp[col + 1]
+#define DC03  dc_pp[col + 2]
+#define DC04  dc_pp[col + 3]
+#define DC05  dc_pp[col + 4]
+#define DC06  dc_p[col]
+#define DC07  dc_p[col + 1]
+#define DC08  dc_p[col + 2]
+#define DC09  dc_p[col + 3]
+#define DC10  dc_p[col + 4]
+#define DC11  dc_c[col]
+#define DC12  dc_c[col + 1]
+#define DC13  dc_c[col + 2]
+#define DC14  dc_c[col + 3]
+#define DC15  dc_c[col + 4]
+#define DC16  dc_n[col]
+#define DC17  dc_n[col + 1]
+#define DC18  dc_n[col + 2]
+#define DC19  dc_n[col + 3]
+#define DC20  dc_n[col + 4]
+#define DC21  dc_nn[col]
+#define DC22  dc_nn[col + 1]
+#define DC23  dc_nn[col + 2]
+#define DC24  dc_nn[col + 3]
+#define DC25  dc_nn[col + 4]
+
+
 /*
  * Variant of decompress_data for use when doing block smoothing.
  */
@@ -430,9 +512,9 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
 {
   my_coef_ptr coef = (my_coef_ptr)cinfo->coef;
   JDIMENSION last_iMCU_row = cinfo->total_iMCU_rows - 1;
-  JDIMENSION block_num, last_block_column;
+  JDIMENSION block_num, last_block_column, first_col, num_valid_cols;
   int ci, block_row, block_rows, access_rows, image_block_row,
-    image_block_rows;
+    image_block_rows, col, num_cols;
   JBLOCKARRAY buffer;
   JBLOCKROW buffer_ptr, prev_prev_block_row, prev_block_row;
   JBLOCKROW next_block_row, next_next_block_row;
@@ -445,14 +527,18 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
   int *coef_bits;
   JQUANT_TBL *quanttbl;
   JLONG Q00, Q01, Q02, Q03 = 0, Q10, Q11, Q12 = 0, Q20, Q21 = 0, Q30 = 0, num;
-  int DC01, DC02, DC03, DC04, DC05, DC06, DC07, DC08, DC09, DC10, DC11, DC12,
-      DC13, DC14, DC15, DC16, DC17, DC18, DC19, DC20, DC21, DC22, DC23, DC24,
-      DC25;
+  int *dc_pp, *dc_p, *dc_c, *dc_n, *dc_nn, *est;
   int Al, pred;
 
   /* Keep a local variable to avoid looking it up more than once */
   workspace = coef->workspace;
 
+  dc_pp = coef->smooth_dc[0];
+  dc_p = coef->smooth_dc[1];
+  dc_c = coef->smooth_dc[2];
+  dc_n = coef->smooth_dc[3];
+  dc_nn = coef->smooth_dc[4];
+
   /* Force some input to be done if we are getting ahead of the input. */
   while (cinfo->input_scan_number <= cinfo->output_scan_number &&
          !cinfo->inputctl->eoi_reached) {
@@ -570,54 +656,154 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
       else
         next_next_block_row = next_block_row;
 
-      /* We fetch the surrounding DC values using a sliding-register approach.
-       * Initialize all 25 here so as to do the right thing on narrow pics.
+      /* Fetch the DC values of the surrounding block rows.  Blocks to the
+       * left of the decompressed region and to the right of the component are
+       * treated as copies of the nearest block, which also does the right
+       * thing on narrow pics.
        */
-      DC01 = DC02 = DC03 = DC04 = DC05 = (int)prev_prev_block_row[0][0];
-      DC06 = DC07 = DC08 = DC09 = DC10 = (int)prev_block_row[0][0];
-      DC11 = DC12 = DC13 = DC14 = DC15 = (int)buffer_ptr[0][0];
-      DC16 = DC17 = DC18 = DC19 = DC20 = (int)next_block_row[0][0];
-      DC21 = DC22 = DC23 = DC24 = DC25 = (int)next_next_block_row[0][0];
-      output_col = 0;
+      first_col = cinfo->master->first_MCU_col[ci];
+      num_cols = (int)(cinfo->master->last_MCU_col[ci] - first_col + 1);
       last_block_column = compptr->width_in_blocks - 1;
-      for (block_num = cinfo->master->first_MCU_col[ci];
-           block_num <= cinfo->master->last_MCU_col[ci]; block_num++) {
-        /* Fetch current DCT block into workspace so we can modify it. */
-        jcopy_block_row(buffer_ptr, (JBLOCKROW)workspace, (JDIMENSION)1);
-        /* Update DC values */
-        if (block_num == cinfo->master->first_MCU_col[ci] &&
-            block_num < last_block_column) {
-          DC04 = DC05 = (int)prev_prev_block_row[1][0];
-          DC09 = DC10 = (int)prev_block_row[1][0];
-          DC14 = DC15 = (int)buffer_ptr[1][0];
-          DC19 = DC20 = (int)next_block_row[1][0];
-          DC24 = DC25 = (int)next_next_block_row[1][0];
+      num_valid_cols = 1;
+      if (last_block_column > first_col)
+        num_valid_cols = MIN(last_block_column - first_col + 1,
+                             (JDIMENSION)num_cols + 2);
+      get_smooth_dc_row(prev_prev_block_row, coef->smooth_dc[0],
+                        (JDIMENSION)num_cols, num_valid_cols);
+      get_smooth_dc_row(prev_block_row, coef->smooth_dc[1],
+                        (JDIMENSION)num_cols, num_valid_cols);
+      get_smooth_dc_row(buffer_ptr, coef->smooth_dc[2],
+                        (JDIMENSION)num_cols, num_valid_cols);
+      get_smooth_dc_row(next_block_row, coef->smooth_dc[3],
+                        (JDIMENSION)num_cols, num_valid_cols);
+      get_smooth_dc_row(next_next_block_row, coef->smooth_dc[4],
+                        (JDIMENSION)num_cols, num_valid_cols);
+
+      /* If DC interpolation is enabled, compute coefficient estimates using
+       * a Gaussian-like kernel, keeping the averages of the DC values.
+       *
+       * If DC interpolation is disabled, compute coefficient estimates using
+       * an algorithm similar to the one described in Section K.8 of the JPEG
+       * standard, except applied to a 5x5 window rather than a 3x3 window.
+       *
+       * The estimates for the whole block row are computed up front, in
+       * simple loops that the compiler can vectorize.  They are scaled by the
+       * DC quantizer and applied to each block below.
+       */
+      /* AC01 */
+      if (coef_bits[1] != 0) {
+        est = coef->smooth_est[1];
+        if (change_dc) {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -DC01 - DC02 + DC04 + DC05 - 3 * DC06 + 13 * DC07 -
+                       13 * DC09 + 3 * DC10 - 3 * DC11 + 38 * DC12 -
+                       38 * DC14 + 3 * DC15 - 3 * DC16 + 13 * DC17 -
+                       13 * DC19 + 3 * DC20 - DC21 - DC22 + DC24 + DC25;
+        } else {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -7 * DC11 + 50 * DC12 - 50 * DC14 + 7 * DC15;
         }
-        if (block_num + 1 < last_block_column) {
-          DC05 = (int)prev_prev_block_row[2][0];
-          DC10 = (int)prev_block_row[2][0];
-          DC15 = (int)buffer_ptr[2][0];
-          DC20 = (int)next_block_row[2][0];
-          DC25 = (int)next_next_block_row[2][0];
+      }
+      /* AC10 */
+      if (coef_bits[2] != 0) {
+        est = coef->smooth_est[2];
+        if (change_dc) {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -DC01 - 3 * DC02 - 3 * DC03 - 3 * DC04 - DC05 - DC06 +
+                       13 * DC07 + 38 * DC08 + 13 * DC09 - DC10 + DC16 -
+                       13 * DC17 - 38 * DC18 - 13 * DC19 + DC20 + DC21 +
+                       3 * DC22 + 3 * DC23 + 3 * DC24 + DC25;
+        } else {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -7 * DC03 + 50 * DC08 - 50 * DC18 + 7 * DC23;
+        }
+      }
+      /* AC20 */
+      if (coef_bits[3] != 0) {
+        est = coef->smooth_est[3];
+        if (change_dc) {
+          for (col = 0; col < num_cols; col++)
+            est[col] = DC03 + 2 * DC07 + 7 * DC08 + 2 * DC09 - 5 * DC12 -
+                       14 * DC13 - 5 * DC14 + 2 * DC17 + 7 * DC18 +
+                       2 * DC19 + DC23;
+        } else {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -DC03 + 13 * DC08 - 24 * DC13 + 13 * DC18 - DC23;
+        }
+      }
+      /* AC11 */
+      if (coef_bits[4] != 0) {
+        est = coef->smooth_est[4];
+        if (change_dc) {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -DC01 + DC05 + 9 * DC07 - 9 * DC09 - 9 * DC17 +
+                       9 * DC19 + DC21 - DC25;
+        } else {
+          for (col = 0; col < num_cols; col++)
+            est[col] = DC10 + DC16 - 10 * DC17 + 10 * DC19 - DC02 - DC20 +
+                       DC22 - DC24 + DC04 - DC06 + 10 * DC07 - 10 * DC09;
+        }
+      }
+      /* AC02 */
+      if (coef_bits[5] != 0) {
+        est = coef->smooth_est[5];
+        if (change_dc) {
+          for (col = 0; col < num_cols; col++)
+            est[col] = 2 * DC07 - 5 * DC08 + 2 * DC09 + DC11 + 7 * DC12 -
+                       14 * DC13 + 7 * DC14 + DC15 + 2 * DC17 - 5 * DC18 +
+                       2 * DC19;
+        } else {
+          for (col = 0; col < num_cols; col++)
+            est[col] = -DC11 + 13 * DC12 - 24 * DC13 + 13 * DC14 - DC15;
         }
-        /* If DC interpolation is enabled, compute coefficient estimates using
-         * a Gaussian-like kernel, keeping the averages of the DC values.
-         *
-         * If DC interpolation is disabled, compute coefficient estimates using
-         * an algorithm similar to the one described in Section K.8 of the JPEG
-         * standard, except applied to a 5x5 window rather than a 3x3 window.
-         *
-         * An estimate is applied only if the coefficient is still zero and is
+      }
+      if (change_dc) {
+        /* AC03 */
+        if (coef_bits[6] != 0) {
+          est = coef->smooth_est[6];
+          for (col = 0; col < num_cols; col++)
+            est[col] = DC07 - DC09 + 2 * DC12 - 2 * DC14 + DC17 - DC19;
+        }
+        /* AC12 */
+        if (coef_bits[7] != 0) {
+          est = coef->smooth_est[7];
+          for (col = 0; col < num_cols; col++)
+            est[col] = DC07 - 3 * DC08 + DC09 - DC17 + 3 * DC18 - DC19;
+        }
+        /* AC21 */
+        if (coef_bits[8] != 0) {
+          est = coef->smooth_est[8];
+          for (col = 0; col < num_cols; col++)
+            est[col] = DC07 - DC09 - 3 * DC12 + 3 * DC14 + DC17 - DC19;
+        }
+        /* AC30 */
+        if (coef_bits[9] != 0) {
+          est = coef->smooth_est[9];
+          for (col = 0; col < num_cols; col++)
+            est[col] = DC07 + 2 * DC08 + DC09 - DC17 - 2 * DC18 - DC19;
+        }
+        /* DC */
+        est = coef->smooth_est[0];
+        for (col = 0; col < num_cols; col++)
+          est[col] = -2 * DC01 - 6 * DC02 - 8 * DC03 - 6 * DC04 - 2 * DC05 -
+                     6 * DC06 + 6 * DC07 + 42 * DC08 + 6 * DC09 - 6 * DC10 -
+                     8 * DC11 + 42 * DC12 + 152 * DC13 + 42 * DC14 -
+                     8 * DC15 - 6 * DC16 + 6 * DC17 + 42 * DC18 + 6 * DC19 -
+                     6 * DC20 - 2 * DC21 - 6 * DC22 - 8 * DC23 - 6 * DC24 -
+                     2 * DC25;
+      }
+
+      output_col = 0;
+      for (block_num = first_col, col = 0;
+           block_num <= cinfo->master->last_MCU_col[ci]; block_num++, col++) {
+        /* Fetch current DCT block into workspace so we can modify it. */
+        jcopy_block_row(buffer_ptr, (JBLOCKROW)workspace, (JDIMENSION)1);
+        /* An estimate is applied only if the coefficient is still zero and is
          * not known to be fully accurate.
          */
         /* AC01 */
         if ((Al = coef_bits[1]) != 0 && workspace[1] == 0) {
-          num = Q00 * (change_dc ?
-                (-DC01 - DC02 + DC04 + DC05 - 3 * DC06 + 13 * DC07 -
-                 13 * DC09 + 3 * DC10 - 3 * DC11 + 38 * DC12 - 38 * DC14 +
-                 3 * DC15 - 3 * DC16 + 13 * DC17 - 13 * DC19 + 3 * DC20 -
-                 DC21 - DC22 + DC24 + DC25) :
-                (-7 * DC11 + 50 * DC12 - 50 * DC14 + 7 * DC15));
+          num = Q00 * coef->smooth_est[1][col];
           if (num >= 0) {
             pred = (int)(((Q01 << 7) + num) / (Q01 << 8));
             if (Al > 0 && pred >= (1 << Al))
@@ -632,12 +818,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
         }
         /* AC10 */
         if ((Al = coef_bits[2]) != 0 && workspace[8] == 0) {
-          num = Q00 * (change_dc ?
-                (-DC01 - 3 * DC02 - 3 * DC03 - 3 * DC04 - DC05 - DC06 +
-                 13 * DC07 + 38 * DC08 + 13 * DC09 - DC10 + DC16 -
-                 13 * DC17 - 38 * DC18 - 13 * DC19 + DC20 + DC21 +
-                 3 * DC22 + 3 * DC23 + 3 * DC24 + DC25) :
-                (-7 * DC03 + 50 * DC08 - 50 * DC18 + 7 * DC23));
+          num = Q00 * coef->smooth_est[2][col];
           if (num >= 0) {
             pred = (int)(((Q10 << 7) + num) / (Q10 << 8));
             if (Al > 0 && pred >= (1 << Al))
@@ -652,10 +833,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
         }
         /* AC20 */
         if ((Al = coef_bits[3]) != 0 && workspace[16] == 0) {
-          num = Q00 * (change_dc ?
-                (DC03 + 2 * DC07 + 7 * DC08 + 2 * DC09 - 5 * DC12 - 14 * DC13 -
-                 5 * DC14 + 2 * DC17 + 7 * DC18 + 2 * DC19 + DC23) :
-                (-DC03 + 13 * DC08 - 24 * DC13 + 13 * DC18 - DC23));
+          num = Q00 * coef->smooth_est[3][col];
           if (num >= 0) {
             pred = (int)(((Q20 << 7) + num) / (Q20 << 8));
             if (Al > 0 && pred >= (1 << Al))
@@ -670,11 +848,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
         }
         /* AC11 */
         if ((Al = coef_bits[4]) != 0 && workspace[9] == 0) {
-          num = Q00 * (change_dc ?
-                (-DC01 + DC05 + 9 * DC07 - 9 * DC09 - 9 * DC17 +
-                 9 * DC19 + DC21 - DC25) :
-                (DC10 + DC16 - 10 * DC17 + 10 * DC19 - DC02 - DC20 + DC22 -
-                 DC24 + DC04 - DC06 + 10 * DC07 - 10 * DC09));
+          num = Q00 * coef->smooth_est[4][col];
           if (num >= 0) {
             pred = (int)(((Q11 << 7) + num) / (Q11 << 8));
             if (Al > 0 && pred >= (1 << Al))
@@ -689,10 +863,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
         }
         /* AC02 */
         if ((Al = coef_bits[5]) != 0 && workspace[2] == 0) {
-          num = Q00 * (change_dc ?
-                (2 * DC07 - 5 * DC08 + 2 * DC09 + DC11 + 7 * DC12 - 14 * DC13 +
-                 7 * DC14 + DC15 + 2 * DC17 - 5 * DC18 + 2 * DC19) :
-                (-DC11 + 13 * DC12 - 24 * DC13 + 13 * DC14 - DC15));
+          num = Q00 * coef->smooth_est[5][col];
           if (num >= 0) {
             pred = (int)(((Q02 << 7) + num) / (Q02 << 8));
             if (Al > 0 && pred >= (1 << Al))
@@ -708,7 +879,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
         if (change_dc) {
           /* AC03 */
           if ((Al = coef_bits[6]) != 0 && workspace[3] == 0) {
-            num = Q00 * (DC07 - DC09 + 2 * DC12 - 2 * DC14 + DC17 - DC19);
+            num = Q00 * coef->smooth_est[6][col];
             if (num >= 0) {
               pred = (int)(((Q03 << 7) + num) / (Q03 << 8));
               if (Al > 0 && pred >= (1 << Al))
@@ -723,7 +894,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
           }
           /* AC12 */
           if ((Al = coef_bits[7]) != 0 && workspace[10] == 0) {
-            num = Q00 * (DC07 - 3 * DC08 + DC09 - DC17 + 3 * DC18 - DC19);
+            num = Q00 * coef->smooth_est[7][col];
             if (num >= 0) {
               pred = (int)(((Q12 << 7) + num) / (Q12 << 8));
               if (Al > 0 && pred >= (1 << Al))
@@ -738,7 +909,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
           }
           /* AC21 */
           if ((Al = coef_bits[8]) != 0 && workspace[17] == 0) {
-            num = Q00 * (DC07 - DC09 - 3 * DC12 + 3 * DC14 + DC17 - DC19);
+            num = Q00 * coef->smooth_est[8][col];
             if (num >= 0) {
               pred = (int)(((Q21 << 7) + num) / (Q21 << 8));
               if (Al > 0 && pred >= (1 << Al))
@@ -753,7 +924,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
           }
           /* AC30 */
           if ((Al = coef_bits[9]) != 0 && workspace[24] == 0) {
-            num = Q00 * (DC07 + 2 * DC08 + DC09 - DC17 - 2 * DC18 - DC19);
+            num = Q00 * coef->smooth_est[9][col];
             if (num >= 0) {
               pred = (int)(((Q30 << 7) + num) / (Q30 << 8));
               if (Al > 0 && pred >= (1 << Al))
@@ -769,12 +940,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
           /* coef_bits[0] is non-negative.  Otherwise this function would not
            * be called.
            */
-          num = Q00 *
-                (-2 * DC01 - 6 * DC02 - 8 * DC03 - 6 * DC04 - 2 * DC05 -
-                 6 * DC06 + 6 * DC07 + 42 * DC08 + 6 * DC09 - 6 * DC10 -
-                 8 * DC11 + 42 * DC12 + 152 * DC13 + 42 * DC14 - 8 * DC15 -
-                 6 * DC16 + 6 * DC17 + 42 * DC18 + 6 * DC19 - 6 * DC20 -
-                 2 * DC21 - 6 * DC22 - 8 * DC23 - 6 * DC24 - 2 * DC25);
+          num = Q00 * coef->smooth_est[0][col];
           if (num >= 0) {
             pred = (int)(((Q00 << 7) + num) / (Q00 << 8));
           } else {
@@ -788,13 +954,7 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
         (*inverse_DCT) (cinfo, compptr, (JCOEFPTR)workspace, output_ptr,
                         output_col);
         /* Advance for next column */
-        DC01 = DC02;  DC02 = DC03;  DC03 = DC04;  DC04 = DC05;
-        DC06 = DC07;  DC07 = DC08;  DC08 = DC09;  DC09 = DC10;
-        DC11 = DC12;  DC12 = DC13;  DC13 = DC14;  DC14 = DC15;
-        DC16 = DC17;  DC17 = DC18;  DC18 = DC19;  DC19 = DC20;
-        DC21 = DC22;  DC22 = DC23;  DC23 = DC24;  DC24 = DC25;
-        buffer_ptr++, prev_block_row++, next_block_row++,
-          prev_prev_block_row++, next_next_block_row++;
+        buffer_ptr++;
         output_col += compptr->_DCT_scaled_size;
       }
       output_ptr += compptr->_DCT_scaled_size;
@@ -806,6 +966,32 @@ decompress_smooth_data(j_decompress_ptr cinfo, _JSAMPIMAGE output_buf)
   return JPEG_SCAN_COMPLETED;
 }
 
+#undef DC01
+#undef DC02
+#undef DC03
+#undef DC04
+#undef DC05
+#undef DC06
+#undef DC07
+#undef DC08
+#undef DC09
+#undef DC10
+#undef DC11
+#undef DC12
+#undef DC13
+#undef DC14
+#undef DC15
+#undef DC16
+#undef DC17
+#undef DC18
+#undef DC19
+#undef DC20
+#undef DC21
+#undef DC22
+#undef DC23
+#undef DC24
+#undef DC25
+
 #endif /* BLOCK_SMOOTHING_SUPPORTED */
 
 
@@ -829,6 +1015,7 @@ _jinit_d_coef_controller(j_decompress_ptr cinfo, boolean need_full_buffer)
   coef->pub.start_output_pass = start_output_pass;
 #ifdef BLOCK_SMOOTHING_SUPPORTED
   coef->coef_bits_latch = NULL;
+  coef->smooth_dc[0] = NULL;
 #endif
 
   /* Create the coefficient buffer. */
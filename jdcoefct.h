@@ -56,6 +56,14 @@ typedef struct {
   /* When doing block smoothing, we latch coefficient Al values here */
   int *coef_bits_latch;
 #define SAVED_COEFS  10         /* we save coef_bits[0..9] */
+
+  /* Block smoothing works on one block row at a time.  The DC values of the
+   * current block row and the two block rows above and below it are copied
+   * into smooth_dc[], and the (unscaled) estimates of coefficients 0..9 for
+   * every block in the row are computed into smooth_est[].
+   */
+  int *smooth_dc[5];
+  int *smooth_est[SAVED_COEFS];
 #endif
 } my_coef_controller;
 
@@ -96,6 +96,21 @@ gray_rgb_convert_internal(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
   while (--num_rows >= 0) {
     inptr = input_buf[0][input_row++];
     outptr = *output_buf++;
+#if defined(RGB_ALPHA) && RGB_ALPHA == RGB_PIXELSIZE - 1
+    /* When the alpha byte comes last, we store it along with the gray
+     * components of the next pixel.  Since all three components have the same
+     * value, this is equivalent to the code below, but compilers (GCC, in
+     * particular) are more willing to vectorize the "alpha-first" pattern.
+     */
+    outptr[RGB_RED] = outptr[RGB_GREEN] = outptr[RGB_BLUE] = inptr[0];
+    outptr += RGB_ALPHA;
+    for (col = 1; col < num_cols; col++) {
+      outptr[1] = outptr[2] = outptr[3] = inptr[col];
+      outptr[0] = _MAXJSAMPLE;
+      outptr += RGB_PIXELSIZE;
+    }
+    outptr[0] = _MAXJSAMPLE;
+#else
     for (col = 0; col < num_cols; col++) {
       outptr[RGB_RED] = outptr[RGB_GREEN] = outptr[RGB_BLUE] = inptr[col];
       /* Set unused byte to _MAXJSAMPLE so it can be interpreted as an */
@@ -105,6 +120,7 @@ gray_rgb_convert_internal(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
 #endif
       outptr += RGB_PIXELSIZE;
     }
+#endif
   }
 }
 
@@ -34,9 +34,12 @@ typedef struct {
   int *Cb_b_tab;                /* => table for Cb to B conversion */
   JLONG *Cr_g_tab;              /* => table for Cr to G conversion */
   JLONG *Cb_g_tab;              /* => table for Cb to G conversion */
+  int *y_tab;                   /* => table for limited-range Y expansion */
+#endif
 
-  /* Private state for RGB->Y conversion */
-  JLONG *rgb_y_tab;             /* => table for RGB to Y conversion */
+#ifdef WITH_SIMD
+  /* Intermediate RGB row for SIMD YCbCr->RGB565 conversion */
+  JSAMPROW rgb_row;
 #endif
 } my_color_deconverter;
 
@@ -81,18 +84,6 @@ typedef my_color_deconverter *my_cconvert_ptr;
 #define ONE_HALF        ((JLONG)1 << (SCALEBITS - 1))
 #define FIX(x)          ((JLONG)((x) * (1L << SCALEBITS) + 0.5))
 
-/* We allocate one big table for RGB->Y conversion and divide it up into
- * three parts, instead of doing three alloc_small requests.  This lets us
- * use a single table base address, which can be held in a register in the
- * inner loops on many machines (more than can hold all three addresses,
- * anyway).
- */
-
-#define R_Y_OFF         0                       /* offset to R => Y section */
-#define G_Y_OFF         (1 * (_MAXJSAMPLE + 1)) /* offset to G => Y section */
-#define B_Y_OFF         (2 * (_MAXJSAMPLE + 1)) /* etc. */
-#define TABLE_SIZE      (3 * (_MAXJSAMPLE + 1))
-
 
 /* Include inline routines for colorspace extensions */
 
@@ -207,19 +198,71 @@ typedef my_color_deconverter *my_cconvert_ptr;
 #undef rgb_rgb_convert_internal
 
 
+#if BITS_IN_JSAMPLE != 16
+
 /*
- * Initialize tables for YCC->RGB colorspace conversion.
+ * Initialize the table that expands limited-range Y values to the full sample
+ * range.  Values outside of the nominal range of Y map to values outside of
+ * 0.._MAXJSAMPLE, so they must be range-limited by the caller.
  */
 
 LOCAL(void)
-build_ycc_rgb_table(j_decompress_ptr cinfo)
+build_y_limited_table(j_decompress_ptr cinfo)
 {
-#if BITS_IN_JSAMPLE != 16
   my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
-  int i;
+  JLONG y_scale = FIX((double)_MAXJSAMPLE /
+                      (double)(219 << (BITS_IN_JSAMPLE - 8)));
   JLONG x;
+  int i;
   SHIFT_TEMPS
 
+  cconvert->y_tab = (int *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                (_MAXJSAMPLE + 1) * sizeof(int));
+  for (i = 0, x = -(16 << (BITS_IN_JSAMPLE - 8)); i <= _MAXJSAMPLE; i++, x++)
+    cconvert->y_tab[i] = (int)RIGHT_SHIFT(y_scale * x + ONE_HALF, SCALEBITS);
+}
+
+
+/*
+ * Initialize tables for YCC->RGB colorspace conversion using a color matrix
+ * other than the JFIF matrix.  The constants are derived from the luminance
+ * weights Kr and Kb:
+ *
+ *      R = Y'                                 + 2 * (1 - Kr) * Cr'
+ *      G = Y' - 2 * (1 - Kb) * Kb / Kg * Cb'  - 2 * (1 - Kr) * Kr / Kg * Cr'
+ *      B = Y' + 2 * (1 - Kb) * Cb'
+ *
+ * where Kg = 1 - Kr - Kb, Cb' and Cr' are the incoming values less
+ * _CENTERJSAMPLE, and Y', Cb', and Cr' have been expanded to the full sample
+ * range if the matrix is limited-range.  Y expansion requires a table of its
+ * own (see build_y_limited_table()), which is used by
+ * ycc_rgb_limited_convert().  Expanded Y values can be negative, so the Cr=>R
+ * and Cb=>B values are bounded in order to keep the sums within the range of
+ * the sample range-limit table.
+ */
+
+LOCAL(void)
+build_ycc_rgb_matrix_table(j_decompress_ptr cinfo)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
+  J_COLOR_MATRIX matrix = cinfo->master->color_matrix;
+  double kr = JCM_KR(matrix), kb = JCM_KB(matrix), kg = 1.0 - kr - kb;
+  double cs = 1.0;
+  JLONG cr_r, cb_b, cr_g, cb_g, x;
+  int i, min_rb = -(_MAXJSAMPLE + 1);
+  SHIFT_TEMPS
+
+  if (JCM_IS_LIMITED(matrix)) {
+    cs = (double)(224 << (BITS_IN_JSAMPLE - 8)) / _MAXJSAMPLE;
+    build_y_limited_table(cinfo);
+    min_rb -= cconvert->y_tab[0];
+  }
+  cr_r = FIX(2.0 * (1.0 - kr) / cs);
+  cb_b = FIX(2.0 * (1.0 - kb) / cs);
+  cr_g = FIX(2.0 * (1.0 - kr) * kr / kg / cs);
+  cb_g = FIX(2.0 * (1.0 - kb) * kb / kg / cs);
+
   cconvert->Cr_r_tab = (int *)
     (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
                                 (_MAXJSAMPLE + 1) * sizeof(int));
@@ -233,6 +276,67 @@ build_ycc_rgb_table(j_decompress_ptr cinfo)
     (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
                                 (_MAXJSAMPLE + 1) * sizeof(JLONG));
 
+  for (i = 0, x = -_CENTERJSAMPLE; i <= _MAXJSAMPLE; i++, x++) {
+    cconvert->Cr_r_tab[i] =
+      MAX((int)RIGHT_SHIFT(cr_r * x + ONE_HALF, SCALEBITS), min_rb);
+    cconvert->Cb_b_tab[i] =
+      MAX((int)RIGHT_SHIFT(cb_b * x + ONE_HALF, SCALEBITS), min_rb);
+    cconvert->Cr_g_tab[i] = (-cr_g) * x;
+    cconvert->Cb_g_tab[i] = (-cb_g) * x + ONE_HALF;
+  }
+}
+
+#endif /* BITS_IN_JSAMPLE != 16 */
+
+
+/*
+ * Initialize tables for YCC->RGB colorspace conversion.
+ */
+
+LOCAL(void)
+build_ycc_rgb_table(j_decompress_ptr cinfo)
+{
+#if BITS_IN_JSAMPLE != 16
+  my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
+  int i, pool_id = JPOOL_IMAGE;
+  JLONG x;
+  SHIFT_TEMPS
+
+  /* The color matrix applies only to YCbCr images (not YCCK images.) */
+  if (cinfo->jpeg_color_space == JCS_YCbCr &&
+      cinfo->master->color_matrix != JCM_BT601) {
+    build_ycc_rgb_matrix_table(cinfo);
+    return;
+  }
+
+#if BITS_IN_JSAMPLE == 8
+  /* The 8-bit tables are small and do not depend on the image, so they are
+   * built once per decompression object and retained in the permanent pool.
+   * This matters when decompressing many small images.
+   */
+  if (cinfo->master->Cr_r_tab != NULL) {
+    cconvert->Cr_r_tab = cinfo->master->Cr_r_tab;
+    cconvert->Cb_b_tab = cinfo->master->Cb_b_tab;
+    cconvert->Cr_g_tab = cinfo->master->Cr_g_tab;
+    cconvert->Cb_g_tab = cinfo->master->Cb_g_tab;
+    return;
+  }
+  pool_id = JPOOL_PERMANENT;
+#endif
+
+  cconvert->Cr_r_tab = (int *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
+                                (_MAXJSAMPLE + 1) * sizeof(int));
+  cconvert->Cb_b_tab = (int *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
+                                (_MAXJSAMPLE + 1) * sizeof(int));
+  cconvert->Cr_g_tab = (JLONG *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
+                                (_MAXJSAMPLE + 1) * sizeof(JLONG));
+  cconvert->Cb_g_tab = (JLONG *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
+                                (_MAXJSAMPLE + 1) * sizeof(JLONG));
+
   for (i = 0, x = -_CENTERJSAMPLE; i <= _MAXJSAMPLE; i++, x++) {
     /* i is the actual input pixel value, in the range 0.._MAXJSAMPLE */
     /* The Cb or Cr value we are thinking of is x = i - _CENTERJSAMPLE */
@@ -248,6 +352,13 @@ build_ycc_rgb_table(j_decompress_ptr cinfo)
     /* We also add in ONE_HALF so that need not do it in inner loop */
     cconvert->Cb_g_tab[i] = (-FIX(0.34414)) * x + ONE_HALF;
   }
+
+#if BITS_IN_JSAMPLE == 8
+  cinfo->master->Cr_r_tab = cconvert->Cr_r_tab;
+  cinfo->master->Cb_b_tab = cconvert->Cb_b_tab;
+  cinfo->master->Cr_g_tab = cconvert->Cr_g_tab;
+  cinfo->master->Cb_g_tab = cconvert->Cb_g_tab;
+#endif
 #else
   ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
 #endif
@@ -299,30 +410,61 @@ ycc_rgb_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
 }
 
 
-/**************** Cases other than YCbCr -> RGB **************/
-
-
 /*
- * Initialize for RGB->grayscale colorspace conversion.
+ * Convert some rows of samples to the output colorspace, using a
+ * limited-range color matrix.  This handles all RGB pixel formats, so it is
+ * slower than ycc_rgb_convert(), but it is used only when the application
+ * has requested a limited-range color matrix.
  */
 
-LOCAL(void)
-build_rgb_y_table(j_decompress_ptr cinfo)
+METHODDEF(void)
+ycc_rgb_limited_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
+                        JDIMENSION input_row, _JSAMPARRAY output_buf,
+                        int num_rows)
 {
 #if BITS_IN_JSAMPLE != 16
   my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
-  JLONG *rgb_y_tab;
-  JLONG i;
-
-  /* Allocate and fill in the conversion tables. */
-  cconvert->rgb_y_tab = rgb_y_tab = (JLONG *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
-                                (TABLE_SIZE * sizeof(JLONG)));
+  register int y, cb, cr;
+  register _JSAMPROW outptr;
+  register _JSAMPROW inptr0, inptr1, inptr2;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  int rindex = rgb_red[cinfo->out_color_space];
+  int gindex = rgb_green[cinfo->out_color_space];
+  int bindex = rgb_blue[cinfo->out_color_space];
+  int pixelsize = rgb_pixelsize[cinfo->out_color_space];
+  /* The unused byte of a 4-byte pixel is the one not occupied by R, G, or B */
+  int aindex = 6 - rindex - gindex - bindex;
+  /* copy these pointers into registers if possible */
+  register _JSAMPLE *range_limit = (_JSAMPLE *)cinfo->sample_range_limit;
+  register int *ytab = cconvert->y_tab;
+  register int *Crrtab = cconvert->Cr_r_tab;
+  register int *Cbbtab = cconvert->Cb_b_tab;
+  register JLONG *Crgtab = cconvert->Cr_g_tab;
+  register JLONG *Cbgtab = cconvert->Cb_g_tab;
+  SHIFT_TEMPS
 
-  for (i = 0; i <= _MAXJSAMPLE; i++) {
-    rgb_y_tab[i + R_Y_OFF] = FIX(0.29900) * i;
-    rgb_y_tab[i + G_Y_OFF] = FIX(0.58700) * i;
-    rgb_y_tab[i + B_Y_OFF] = FIX(0.11400) * i + ONE_HALF;
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++) {
+      y  = ytab[inptr0[col]];
+      cb = inptr1[col];
+      cr = inptr2[col];
+      outptr[rindex] = range_limit[y + Crrtab[cr]];
+      outptr[gindex] = range_limit[y +
+                                   ((int)RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr],
+                                                     SCALEBITS))];
+      outptr[bindex] = range_limit[y + Cbbtab[cb]];
+      /* Set unused byte to _MAXJSAMPLE so it can be interpreted as an */
+      /* opaque alpha channel value */
+      if (pixelsize == 4)
+        outptr[aindex] = _MAXJSAMPLE;
+      outptr += pixelsize;
+    }
   }
 #else
   ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
@@ -330,18 +472,28 @@ build_rgb_y_table(j_decompress_ptr cinfo)
 }
 
 
+/**************** Cases other than YCbCr -> RGB **************/
+
+
 /*
  * Convert RGB to grayscale.
+ *
+ * Rather than looking up the products in a table, we compute them using
+ * 32-bit integer arithmetic.  The results are the same, but a loop without
+ * table lookups can be vectorized by the compiler.  (The weights sum to 2^16,
+ * so the largest intermediate value, with 12-bit samples, is less than 2^28.)
  */
 
+#define Y_R   ((int)FIX(0.29900))
+#define Y_G   ((int)FIX(0.58700))
+#define Y_B   ((int)FIX(0.11400))
+
 METHODDEF(void)
 rgb_gray_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
                  JDIMENSION input_row, _JSAMPARRAY output_buf, int num_rows)
 {
 #if BITS_IN_JSAMPLE != 16
-  my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
   register int r, g, b;
-  register JLONG *ctab = cconvert->rgb_y_tab;
   register _JSAMPROW outptr;
   register _JSAMPROW inptr0, inptr1, inptr2;
   register JDIMENSION col;
@@ -358,8 +510,8 @@ rgb_gray_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
       g = inptr1[col];
       b = inptr2[col];
       /* Y */
-      outptr[col] = (_JSAMPLE)((ctab[r + R_Y_OFF] + ctab[g + G_Y_OFF] +
-                                ctab[b + B_Y_OFF]) >> SCALEBITS);
+      outptr[col] = (_JSAMPLE)((Y_R * r + Y_G * g + Y_B * b +
+                                (int)ONE_HALF) >> SCALEBITS);
     }
   }
 #else
@@ -443,6 +595,37 @@ grayscale_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
 }
 
 
+#if BITS_IN_JSAMPLE != 16
+
+/*
+ * Convert YCbCr to grayscale when the application has requested a
+ * limited-range color matrix.  Y is expanded to the full sample range.
+ */
+
+METHODDEF(void)
+ycc_gray_limited_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
+                         JDIMENSION input_row, _JSAMPARRAY output_buf,
+                         int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
+  register _JSAMPROW inptr, outptr;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  /* copy these pointers into registers if possible */
+  register _JSAMPLE *range_limit = (_JSAMPLE *)cinfo->sample_range_limit;
+  register int *ytab = cconvert->y_tab;
+
+  while (--num_rows >= 0) {
+    inptr = input_buf[0][input_row++];
+    outptr = *output_buf++;
+    for (col = 0; col < num_cols; col++)
+      outptr[col] = range_limit[ytab[inptr[col]]];
+  }
+}
+
+#endif
+
+
 /*
  * Convert grayscale to RGB
  */
@@ -738,6 +921,34 @@ gray_rgb565D_convert(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
 }
 
 
+#ifdef WITH_SIMD
+
+/*
+ * YCbCr->RGB565 conversion for SIMD platforms that have a YCbCr->RGB kernel
+ * but no YCbCr->RGB565 kernel.  Each row is converted to RGB using the SIMD
+ * kernel and then packed into RGB565.  This produces the same output as
+ * ycc_rgb565_convert().  The SIMD dispatcher has no kernel for JCS_RGB565, so
+ * it uses the JCS_RGB kernel, which writes pixels in the default RGB layout
+ * (RGB_RED, RGB_GREEN, RGB_BLUE, and RGB_PIXELSIZE in jmorecfg.h.)
+ */
+
+METHODDEF(void)
+ycc_rgb565_simd_convert(j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+                        JDIMENSION input_row, JSAMPARRAY output_buf,
+                        int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr)cinfo->cconvert;
+  JSAMPROW rgb_row = cconvert->rgb_row;
+
+  while (--num_rows >= 0) {
+    jsimd_ycc_rgb_convert(cinfo, input_buf, input_row++, &rgb_row, 1);
+    jpack_rgb565_row(rgb_row, *output_buf++, cinfo->output_width);
+  }
+}
+
+#endif
+
+
 /*
  * Empty method for start_pass.
  */
@@ -808,13 +1019,20 @@ _jinit_color_deconverter(j_decompress_ptr cinfo)
     cinfo->out_color_components = 1;
     if (cinfo->jpeg_color_space == JCS_GRAYSCALE ||
         cinfo->jpeg_color_space == JCS_YCbCr) {
-      cconvert->pub._color_convert = grayscale_convert;
+#if BITS_IN_JSAMPLE != 16
+      /* Limited-range Y must be expanded to the full sample range. */
+      if (cinfo->jpeg_color_space == JCS_YCbCr &&
+          JCM_IS_LIMITED(cinfo->master->color_matrix)) {
+        cconvert->pub._color_convert = ycc_gray_limited_convert;
+        build_y_limited_table(cinfo);
+      } else
+#endif
+        cconvert->pub._color_convert = grayscale_convert;
       /* For color->grayscale conversion, only the Y (0) component is needed */
       for (ci = 1; ci < cinfo->num_components; ci++)
         cinfo->comp_info[ci].component_needed = FALSE;
     } else if (cinfo->jpeg_color_space == JCS_RGB) {
       cconvert->pub._color_convert = rgb_gray_convert;
-      build_rgb_y_table(cinfo);
     } else
       ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
     break;
@@ -835,11 +1053,16 @@ _jinit_color_deconverter(j_decompress_ptr cinfo)
     cinfo->out_color_components = rgb_pixelsize[cinfo->out_color_space];
     if (cinfo->jpeg_color_space == JCS_YCbCr) {
 #ifdef WITH_SIMD
-      if (jsimd_can_ycc_rgb())
+      /* The SIMD routines implement only the JFIF color matrix. */
+      if (cinfo->master->color_matrix == JCM_BT601 && jsimd_can_ycc_rgb()) {
         cconvert->pub._color_convert = jsimd_ycc_rgb_convert;
-      else
+        cinfo->master->simd_stages |= JSTAGE_COLOR;
+      } else
 #endif
-      {
+      if (JCM_IS_LIMITED(cinfo->master->color_matrix)) {
+        cconvert->pub._color_convert = ycc_rgb_limited_convert;
+        build_ycc_rgb_table(cinfo);
+      } else {
         cconvert->pub._color_convert = ycc_rgb_convert;
         build_ycc_rgb_table(cinfo);
       }
@@ -860,13 +1083,28 @@ _jinit_color_deconverter(j_decompress_ptr cinfo)
   case JCS_RGB565:
     if (cinfo->master->lossless)
       ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
+    /* Limited-range YCbCr->RGB565 conversion is not implemented. */
+    if (cinfo->jpeg_color_space == JCS_YCbCr &&
+        JCM_IS_LIMITED(cinfo->master->color_matrix))
+      ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
     cinfo->out_color_components = 3;
     if (cinfo->dither_mode == JDITHER_NONE) {
       if (cinfo->jpeg_color_space == JCS_YCbCr) {
 #ifdef WITH_SIMD
-        if (jsimd_can_ycc_rgb565())
+        if (cinfo->master->color_matrix != JCM_BT601) {
+          cconvert->pub._color_convert = ycc_rgb565_convert;
+          build_ycc_rgb_table(cinfo);
+        } else if (jsimd_can_ycc_rgb565()) {
           cconvert->pub._color_convert = jsimd_ycc_rgb565_convert;
-        else
+          cinfo->master->simd_stages |= JSTAGE_COLOR;
+        } else if (jsimd_can_ycc_rgb()) {
+          cconvert->rgb_row = (JSAMPROW)
+            (*cinfo->mem->alloc_large) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+              (size_t)jround_up((long)cinfo->output_width, 32L) *
+              rgb_pixelsize[JCS_RGB]);
+          cconvert->pub._color_convert = ycc_rgb565_simd_convert;
+          cinfo->master->simd_stages |= JSTAGE_COLOR;
+        } else
 #endif
         {
           cconvert->pub._color_convert = ycc_rgb565_convert;
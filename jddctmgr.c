@@ -114,9 +114,10 @@ start_pass(j_decompress_ptr cinfo)
       break;
     case 2:
 #ifdef WITH_SIMD
-      if (jsimd_can_idct_2x2())
+      if (jsimd_can_idct_2x2()) {
         method_ptr = jsimd_idct_2x2;
-      else
+        cinfo->master->simd_stages |= JSTAGE_IDCT;
+      } else
 #endif
         method_ptr = _jpeg_idct_2x2;
       method = JDCT_ISLOW;      /* jidctred uses islow-style table */
@@ -127,9 +128,10 @@ start_pass(j_decompress_ptr cinfo)
       break;
     case 4:
 #ifdef WITH_SIMD
-      if (jsimd_can_idct_4x4())
+      if (jsimd_can_idct_4x4()) {
         method_ptr = jsimd_idct_4x4;
-      else
+        cinfo->master->simd_stages |= JSTAGE_IDCT;
+      } else
 #endif
         method_ptr = _jpeg_idct_4x4;
       method = JDCT_ISLOW;      /* jidctred uses islow-style table */
@@ -140,9 +142,10 @@ start_pass(j_decompress_ptr cinfo)
       break;
     case 6:
 #if defined(WITH_SIMD) && defined(__mips__)
-      if (jsimd_can_idct_6x6())
+      if (jsimd_can_idct_6x6()) {
         method_ptr = jsimd_idct_6x6;
-      else
+        cinfo->master->simd_stages |= JSTAGE_IDCT;
+      } else
 #endif
       method_ptr = _jpeg_idct_6x6;
       method = JDCT_ISLOW;      /* jidctint uses islow-style table */
@@ -157,9 +160,10 @@ start_pass(j_decompress_ptr cinfo)
 #ifdef DCT_ISLOW_SUPPORTED
       case JDCT_ISLOW:
 #ifdef WITH_SIMD
-        if (jsimd_can_idct_islow())
+        if (jsimd_can_idct_islow()) {
           method_ptr = jsimd_idct_islow;
-        else
+          cinfo->master->simd_stages |= JSTAGE_IDCT;
+        } else
 #endif
           method_ptr = _jpeg_idct_islow;
         method = JDCT_ISLOW;
@@ -168,9 +172,10 @@ start_pass(j_decompress_ptr cinfo)
 #ifdef DCT_IFAST_SUPPORTED
       case JDCT_IFAST:
 #ifdef WITH_SIMD
-        if (jsimd_can_idct_ifast())
+        if (jsimd_can_idct_ifast()) {
           method_ptr = jsimd_idct_ifast;
-        else
+          cinfo->master->simd_stages |= JSTAGE_IDCT;
+        } else
 #endif
           method_ptr = _jpeg_idct_ifast;
         method = JDCT_IFAST;
@@ -179,9 +184,10 @@ start_pass(j_decompress_ptr cinfo)
 #ifdef DCT_FLOAT_SUPPORTED
       case JDCT_FLOAT:
 #ifdef WITH_SIMD
-        if (jsimd_can_idct_float())
+        if (jsimd_can_idct_float()) {
           method_ptr = jsimd_idct_float;
-        else
+          cinfo->master->simd_stages |= JSTAGE_IDCT;
+        } else
 #endif
           method_ptr = _jpeg_idct_float;
         method = JDCT_FLOAT;
@@ -207,9 +213,10 @@ start_pass(j_decompress_ptr cinfo)
       break;
     case 12:
 #if defined(WITH_SIMD) && defined(__mips__)
-      if (jsimd_can_idct_12x12())
+      if (jsimd_can_idct_12x12()) {
         method_ptr = jsimd_idct_12x12;
-      else
+        cinfo->master->simd_stages |= JSTAGE_IDCT;
+      } else
 #endif
       method_ptr = _jpeg_idct_12x12;
       method = JDCT_ISLOW;      /* jidctint uses islow-style table */
@@ -132,6 +132,120 @@ start_pass_huff_decoder(j_decompress_ptr cinfo)
 }
 
 
+/*
+ * Cache of derived Huffman tables.
+ *
+ * Most applications decompress many images that use the same few Huffman
+ * tables (often the standard tables in jstdhuff.c), so we retain the derived
+ * values for the most recently used tables in the permanent pool and reuse
+ * them rather than recomputing them for each image.  Entries are matched by
+ * table contents rather than by table slot, since the table slots are
+ * rewritten by each image.
+ */
+
+#define D_DERIVED_CACHE_SIZE  8
+
+typedef struct {
+  boolean isDC;
+  boolean lossless;             /* DC symbols were validated for lossless */
+  UINT8 bits[17];
+  UINT8 huffval[256];
+  d_derived_tbl dtbl;
+} d_derived_cache_entry;
+
+struct jpeg_d_derived_cache {
+  d_derived_cache_entry entries[D_DERIVED_CACHE_SIZE];
+  int num_entries;
+  int next;                     /* next entry to replace */
+};
+
+
+/*
+ * Look up a Huffman table in the cache.  If a match is found, then the
+ * derived values are copied into dtbl, and TRUE is returned.
+ */
+
+LOCAL(boolean)
+get_cached_d_derived_tbl(j_decompress_ptr cinfo, boolean isDC,
+                         JHUFF_TBL *htbl, d_derived_tbl *dtbl)
+{
+  struct jpeg_d_derived_cache *cache = cinfo->master->huff_cache;
+  d_derived_cache_entry *entry;
+  int i, l, numsymbols = 0;
+
+  if (cache == NULL)
+    return FALSE;
+
+  for (l = 1; l <= 16; l++)
+    numsymbols += htbl->bits[l];
+  if (numsymbols > 256)
+    return FALSE;
+
+  for (i = 0; i < cache->num_entries; i++) {
+    entry = &cache->entries[i];
+    if (entry->isDC == isDC && entry->lossless == cinfo->master->lossless &&
+        !memcmp(entry->bits, htbl->bits, sizeof(entry->bits)) &&
+        !memcmp(entry->huffval, htbl->huffval, numsymbols)) {
+      memcpy(dtbl, &entry->dtbl, sizeof(d_derived_tbl));
+      dtbl->pub = htbl;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+/*
+ * Add a validated Huffman table and its derived values to the cache,
+ * replacing the least recently added entry if the cache is full.
+ */
+
+LOCAL(void)
+cache_d_derived_tbl(j_decompress_ptr cinfo, boolean isDC, JHUFF_TBL *htbl,
+                    d_derived_tbl *dtbl)
+{
+  struct jpeg_d_derived_cache *cache = cinfo->master->huff_cache;
+  d_derived_cache_entry *entry;
+
+  if (cache == NULL)
+    return;
+
+  entry = &cache->entries[cache->next];
+  if (cache->num_entries < D_DERIVED_CACHE_SIZE)
+    cache->num_entries++;
+  cache->next = (cache->next + 1) % D_DERIVED_CACHE_SIZE;
+
+  entry->isDC = isDC;
+  entry->lossless = cinfo->master->lossless;
+  memcpy(entry->bits, htbl->bits, sizeof(entry->bits));
+  memcpy(entry->huffval, htbl->huffval, sizeof(entry->huffval));
+  memcpy(&entry->dtbl, dtbl, sizeof(d_derived_tbl));
+}
+
+
+/*
+ * Allocate the cache of derived Huffman tables, if it has not already been
+ * allocated.  The cache is allocated in its entirety when the first Huffman
+ * decoder is initialized, so that its size does not depend on the tables
+ * that have been used.
+ *
+ * This is called by jinit_huff_decoder, jinit_phuff_decoder, and
+ * jinit_lhuff_decoder.
+ */
+
+GLOBAL(void)
+jpeg_init_d_derived_cache(j_decompress_ptr cinfo)
+{
+  if (cinfo->master->huff_cache == NULL) {
+    cinfo->master->huff_cache = (struct jpeg_d_derived_cache *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                  sizeof(struct jpeg_d_derived_cache));
+    memset(cinfo->master->huff_cache, 0,
+           sizeof(struct jpeg_d_derived_cache));
+  }
+}
+
+
 /*
  * Compute the derived values for a Huffman table.
  * This routine also performs some validation checks on the table.
@@ -169,6 +283,11 @@ jpeg_make_d_derived_tbl(j_decompress_ptr cinfo, boolean isDC, int tblno,
       (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
                                   sizeof(d_derived_tbl));
   dtbl = *pdtbl;
+
+  /* Reuse the derived values from a previous image, if possible. */
+  if (get_cached_d_derived_tbl(cinfo, isDC, htbl, dtbl))
+    return;
+
   dtbl->pub = htbl;             /* fill in back link */
 
   /* Figure C.1: make table of Huffman code length for each symbol */
@@ -258,6 +377,8 @@ jpeg_make_d_derived_tbl(j_decompress_ptr cinfo, boolean isDC, int tblno,
         ERREXIT(cinfo, JERR_BAD_HUFF_TABLE);
     }
   }
+
+  cache_d_derived_tbl(cinfo, isDC, htbl, dtbl);
 }
 
 
@@ -384,49 +505,6 @@ no_more_bytes:
 }
 
 
-/* Macro version of the above, which performs much better but does not
-   handle markers.  We have to hand off any blocks with markers to the
-   slower routines. */
-
-#define GET_BYTE { \
-  register int c0, c1; \
-  c0 = *buffer++; \
-  c1 = *buffer; \
-  /* Pre-execute most common case */ \
-  get_buffer = (get_buffer << 8) | c0; \
-  bits_left += 8; \
-  if (c0 == 0xFF) { \
-    /* Pre-execute case of FF/00, which represents an FF data byte */ \
-    buffer++; \
-    if (c1 != 0) { \
-      /* Oops, it's actually a marker indicating end of compressed data. */ \
-      cinfo->unread_marker = c1; \
-      /* Back out pre-execution and fill the buffer with zero bits */ \
-      buffer -= 2; \
-      get_buffer &= ~0xFF; \
-    } \
-  } \
-}
-
-#if SIZEOF_SIZE_T == 8 || defined(_WIN64) || (defined(__x86_64__) && defined(__ILP32__))
-
-/* Pre-fetch 48 bytes, because the holding register is 64-bit */
-#define FILL_BIT_BUFFER_FAST \
-  if (bits_left <= 16) { \
-    GET_BYTE GET_BYTE GET_BYTE GET_BYTE GET_BYTE GET_BYTE \
-  }
-
-#else
-
-/* Pre-fetch 16 bytes, because the holding register is 32-bit */
-#define FILL_BIT_BUFFER_FAST \
-  if (bits_left <= 16) { \
-    GET_BYTE GET_BYTE \
-  }
-
-#endif
-
-
 /*
  * Out-of-line code for Huffman code decoding.
  * See jdhuff.h for info about usage.
@@ -766,6 +844,24 @@ decode_mcu_fast(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 
 #define BUFSIZE  (DCTSIZE2 * 8)
 
+/*
+ * The fast path does not check for the end of the source buffer, so it can
+ * normally be used only if enough bytes remain for the worst case.  However,
+ * it stops at the first marker it encounters, so it cannot read past the end
+ * of a source buffer that ends with a marker (such as the EOI marker at the end
+ * of an image that is entirely in memory.)  Thus, the fast path can also be
+ * used for the last few MCUs of such an image, or for all of the MCUs of a
+ * small image.
+ */
+
+LOCAL(boolean)
+buffer_ends_with_marker(struct jpeg_source_mgr *src)
+{
+  return src->bytes_in_buffer >= 2 &&
+         src->next_input_byte[src->bytes_in_buffer - 2] == 0xFF &&
+         src->next_input_byte[src->bytes_in_buffer - 1] != 0;
+}
+
 METHODDEF(boolean)
 decode_mcu(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
@@ -780,8 +876,8 @@ decode_mcu(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
     usefast = 0;
   }
 
-  if (cinfo->src->bytes_in_buffer < BUFSIZE * (size_t)cinfo->blocks_in_MCU ||
-      cinfo->unread_marker != 0)
+  if ((cinfo->src->bytes_in_buffer < BUFSIZE * (size_t)cinfo->blocks_in_MCU &&
+       !buffer_ends_with_marker(cinfo->src)) || cinfo->unread_marker != 0)
     usefast = 0;
 
   /* If we've run out of data, just leave the MCU set to zeroes.
@@ -833,4 +929,6 @@ jinit_huff_decoder(j_decompress_ptr cinfo)
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
     entropy->dc_derived_tbls[i] = entropy->ac_derived_tbls[i] = NULL;
   }
+
+  jpeg_init_d_derived_cache(cinfo);
 }
@@ -297,6 +297,8 @@ jinit_lhuff_decoder(j_decompress_ptr cinfo)
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
     entropy->derived_tbls[i] = NULL;
   }
+
+  jpeg_init_d_derived_cache(cinfo);
 }
 
 #endif /* D_LOSSLESS_SUPPORTED */
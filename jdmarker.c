@@ -454,9 +454,18 @@ get_dht(j_decompress_ptr cinfo)
 
     bits[0] = 0;
     count = 0;
-    for (i = 1; i <= 16; i++) {
-      INPUT_BYTE(cinfo, bits[i], return FALSE);
-      count += bits[i];
+    if (bytes_in_buffer >= 16) {
+      /* Fast path: the counts are entirely in the source buffer. */
+      memcpy(&bits[1], next_input_byte, 16);
+      next_input_byte += 16;
+      bytes_in_buffer -= 16;
+      for (i = 1; i <= 16; i++)
+        count += bits[i];
+    } else {
+      for (i = 1; i <= 16; i++) {
+        INPUT_BYTE(cinfo, bits[i], return FALSE);
+        count += bits[i];
+      }
     }
 
     length -= 1 + 16;
@@ -474,8 +483,14 @@ get_dht(j_decompress_ptr cinfo)
     if (count > 256 || ((JLONG)count) > length)
       ERREXIT(cinfo, JERR_BAD_HUFF_TABLE);
 
-    for (i = 0; i < count; i++)
-      INPUT_BYTE(cinfo, huffval[i], return FALSE);
+    if (bytes_in_buffer >= (size_t)count) {
+      memcpy(huffval, next_input_byte, count);
+      next_input_byte += count;
+      bytes_in_buffer -= count;
+    } else {
+      for (i = 0; i < count; i++)
+        INPUT_BYTE(cinfo, huffval[i], return FALSE);
+    }
 
     memset(&huffval[count], 0, (256 - count) * sizeof(UINT8));
 
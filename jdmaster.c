@@ -41,6 +41,9 @@ use_merged_upsample(j_decompress_ptr cinfo)
   /* Merging is the equivalent of plain box-filter upsampling */
   if (cinfo->do_fancy_upsampling || cinfo->CCIR601_sampling)
     return FALSE;
+  /* jdmerge.c only supports the JFIF color matrix */
+  if (cinfo->master->color_matrix != JCM_BT601)
+    return FALSE;
   /* jdmerge.c only supports YCC=>RGB and YCC=>RGB565 color conversion */
   if (cinfo->jpeg_color_space != JCS_YCbCr || cinfo->num_components != 3 ||
       (cinfo->out_color_space != JCS_RGB &&
@@ -260,19 +263,14 @@ jpeg_core_output_dimensions(j_decompress_ptr cinfo)
  * Also note that it may be called before the master module is initialized!
  */
 
-GLOBAL(void)
-jpeg_calc_output_dimensions(j_decompress_ptr cinfo)
-/* Do computations that are needed before master selection phase */
+LOCAL(void)
+calc_output_dimensions(j_decompress_ptr cinfo)
 {
 #ifdef IDCT_SCALING_SUPPORTED
   int ci;
   jpeg_component_info *compptr;
 #endif
 
-  /* Prevent application from calling me at wrong times */
-  if (cinfo->global_state != DSTATE_READY)
-    ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
-
   /* Compute core output image dimensions and DCT scaling choices. */
   jpeg_core_output_dimensions(cinfo);
 
@@ -370,6 +368,17 @@ jpeg_calc_output_dimensions(j_decompress_ptr cinfo)
     cinfo->rec_outbuf_height = 1;
 }
 
+GLOBAL(void)
+jpeg_calc_output_dimensions(j_decompress_ptr cinfo)
+/* Do computations that are needed before master selection phase */
+{
+  /* Prevent application from calling me at wrong times */
+  if (cinfo->global_state != DSTATE_READY)
+    ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+  calc_output_dimensions(cinfo);
+}
+
 
 /*
  * Several decompression processes need to range-limit values to the range
@@ -871,6 +880,87 @@ jpeg_new_colormap(j_decompress_ptr cinfo)
 #endif /* D_MULTISCAN_FILES_SUPPORTED */
 
 
+/*
+ * Select a new output scaling factor between output passes in buffered-image
+ * mode.  The application sets scale_num and scale_denom before calling this
+ * routine.  The input side of the decompressor, the coefficient buffer, and the
+ * IDCT manager are left intact (the IDCT manager selects a new method for each
+ * component at the start of the next output pass), and the post-processing
+ * modules and main buffer controller are reinitialized for the new output
+ * dimensions.  This allows an image to be rendered at several scaling factors
+ * without entropy decoding it more than once.  The superseded modules remain
+ * in the image pool until the image is finished.
+ */
+
+GLOBAL(void)
+jinit_master_rescale(j_decompress_ptr cinfo)
+{
+  my_master_ptr master = (my_master_ptr)cinfo->master;
+  long samplesperrow;
+  JDIMENSION jd_samplesperrow;
+  int ci;
+  jpeg_component_info *compptr;
+
+  /* Prevent application from calling me at wrong times */
+  if (cinfo->global_state != DSTATE_BUFIMAGE)
+    ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+  /* IDCT scaling is not available in lossless mode, and the color quantizers
+   * cannot be resized.
+   */
+  if (cinfo->master->lossless || cinfo->quantize_colors)
+    ERREXIT(cinfo, JERR_NOTIMPL);
+
+  calc_output_dimensions(cinfo);
+
+  /* Width of an output scanline must be representable as JDIMENSION. */
+  samplesperrow = (long)cinfo->output_width *
+                  (long)cinfo->out_color_components;
+  jd_samplesperrow = (JDIMENSION)samplesperrow;
+  if ((long)jd_samplesperrow != samplesperrow)
+    ERREXIT(cinfo, JERR_WIDTH_OVERFLOW);
+
+  master->using_merged_upsample = use_merged_upsample(cinfo);
+
+  /* Any previous cropping region is meaningless at the new scale. */
+  cinfo->master->first_iMCU_col = 0;
+  cinfo->master->last_iMCU_col = cinfo->MCUs_per_row - 1;
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+       ci++, compptr++) {
+    cinfo->master->first_MCU_col[ci] = 0;
+    cinfo->master->last_MCU_col[ci] = compptr->width_in_blocks - 1;
+  }
+
+  if (cinfo->raw_data_out)
+    return;
+
+  if (master->using_merged_upsample) {
+#ifdef UPSAMPLE_MERGING_SUPPORTED
+    if (cinfo->data_precision == 12)
+      j12init_merged_upsampler(cinfo);
+    else
+      jinit_merged_upsampler(cinfo);
+#else
+    ERREXIT(cinfo, JERR_NOT_COMPILED);
+#endif
+  } else {
+    if (cinfo->data_precision == 12) {
+      j12init_color_deconverter(cinfo);
+      j12init_upsampler(cinfo);
+    } else {
+      jinit_color_deconverter(cinfo);
+      jinit_upsampler(cinfo);
+    }
+  }
+  if (cinfo->data_precision == 12) {
+    j12init_d_post_controller(cinfo, FALSE);
+    j12init_d_main_controller(cinfo, FALSE);
+  } else {
+    jinit_d_post_controller(cinfo, FALSE);
+    jinit_d_main_controller(cinfo, FALSE);
+  }
+}
+
+
 /*
  * Initialize master decompression control and select active modules.
  * This is performed at the start of jpeg_start_decompress.
@@ -886,6 +976,7 @@ jinit_master_decompress(j_decompress_ptr cinfo)
 
   master->pub.is_dummy_pass = FALSE;
   master->pub.jinit_upsampler_no_alloc = FALSE;
+  master->pub.simd_stages = 0;
 
   master_selection(cinfo);
 }
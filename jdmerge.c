@@ -161,21 +161,36 @@ LOCAL(void)
 build_ycc_rgb_table(j_decompress_ptr cinfo)
 {
   my_merged_upsample_ptr upsample = (my_merged_upsample_ptr)cinfo->upsample;
-  int i;
+  int i, pool_id = JPOOL_IMAGE;
   JLONG x;
   SHIFT_TEMPS
 
+#if BITS_IN_JSAMPLE == 8
+  /* The 8-bit tables are small and do not depend on the image, so they are
+   * built once per decompression object and retained in the permanent pool.
+   * This matters when decompressing many small images.
+   */
+  if (cinfo->master->Cr_r_tab != NULL) {
+    upsample->Cr_r_tab = cinfo->master->Cr_r_tab;
+    upsample->Cb_b_tab = cinfo->master->Cb_b_tab;
+    upsample->Cr_g_tab = cinfo->master->Cr_g_tab;
+    upsample->Cb_g_tab = cinfo->master->Cb_g_tab;
+    return;
+  }
+  pool_id = JPOOL_PERMANENT;
+#endif
+
   upsample->Cr_r_tab = (int *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
                                 (_MAXJSAMPLE + 1) * sizeof(int));
   upsample->Cb_b_tab = (int *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
                                 (_MAXJSAMPLE + 1) * sizeof(int));
   upsample->Cr_g_tab = (JLONG *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
                                 (_MAXJSAMPLE + 1) * sizeof(JLONG));
   upsample->Cb_g_tab = (JLONG *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
+    (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, pool_id,
                                 (_MAXJSAMPLE + 1) * sizeof(JLONG));
 
   for (i = 0, x = -_CENTERJSAMPLE; i <= _MAXJSAMPLE; i++, x++) {
@@ -193,6 +208,13 @@ build_ycc_rgb_table(j_decompress_ptr cinfo)
     /* We also add in ONE_HALF so that need not do it in inner loop */
     upsample->Cb_g_tab[i] = (-FIX(0.34414)) * x + ONE_HALF;
   }
+
+#if BITS_IN_JSAMPLE == 8
+  cinfo->master->Cr_r_tab = upsample->Cr_r_tab;
+  cinfo->master->Cb_b_tab = upsample->Cb_b_tab;
+  cinfo->master->Cr_g_tab = upsample->Cr_g_tab;
+  cinfo->master->Cb_g_tab = upsample->Cb_g_tab;
+#endif
 }
 
 
@@ -525,6 +547,44 @@ h2v2_merged_upsample_565D(j_decompress_ptr cinfo, _JSAMPIMAGE input_buf,
 }
 
 
+#ifdef WITH_SIMD
+
+/*
+ * Merged upsampling to RGB565 for SIMD platforms that lack a dedicated RGB565
+ * kernel.  The row group is upsampled/converted to RGB using the SIMD kernel
+ * and then packed into RGB565.  As in jdcolor.c, the SIMD kernel writes pixels
+ * in the default RGB layout.
+ */
+
+METHODDEF(void)
+h2v1_merged_upsample_565_simd(j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+                              JDIMENSION in_row_group_ctr,
+                              JSAMPARRAY output_buf)
+{
+  my_merged_upsample_ptr upsample = (my_merged_upsample_ptr)cinfo->upsample;
+
+  jsimd_h2v1_merged_upsample(cinfo, input_buf, in_row_group_ctr,
+                             upsample->rgb_rows);
+  jpack_rgb565_row(upsample->rgb_rows[0], output_buf[0], cinfo->output_width);
+}
+
+
+METHODDEF(void)
+h2v2_merged_upsample_565_simd(j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+                              JDIMENSION in_row_group_ctr,
+                              JSAMPARRAY output_buf)
+{
+  my_merged_upsample_ptr upsample = (my_merged_upsample_ptr)cinfo->upsample;
+
+  jsimd_h2v2_merged_upsample(cinfo, input_buf, in_row_group_ctr,
+                             upsample->rgb_rows);
+  jpack_rgb565_row(upsample->rgb_rows[0], output_buf[0], cinfo->output_width);
+  jpack_rgb565_row(upsample->rgb_rows[1], output_buf[1], cinfo->output_width);
+}
+
+#endif
+
+
 /*
  * Module initialization routine for merged upsampling/color conversion.
  *
@@ -552,18 +612,30 @@ _jinit_merged_upsampler(j_decompress_ptr cinfo)
 
   if (cinfo->max_v_samp_factor == 2) {
     upsample->pub._upsample = merged_2v_upsample;
-#ifdef WITH_SIMD
-    if (jsimd_can_h2v2_merged_upsample())
-      upsample->upmethod = jsimd_h2v2_merged_upsample;
-    else
-#endif
-      upsample->upmethod = h2v2_merged_upsample;
     if (cinfo->out_color_space == JCS_RGB565) {
       if (cinfo->dither_mode != JDITHER_NONE) {
         upsample->upmethod = h2v2_merged_upsample_565D;
       } else {
         upsample->upmethod = h2v2_merged_upsample_565;
+#ifdef WITH_SIMD
+        if (jsimd_can_h2v2_merged_upsample()) {
+          upsample->rgb_rows = (*cinfo->mem->alloc_sarray)
+            ((j_common_ptr)cinfo, JPOOL_IMAGE,
+             (JDIMENSION)jround_up((long)cinfo->output_width, 32L) *
+             rgb_pixelsize[JCS_RGB], 2);
+          upsample->upmethod = h2v2_merged_upsample_565_simd;
+          cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+        }
+#endif
       }
+    } else {
+#ifdef WITH_SIMD
+      if (jsimd_can_h2v2_merged_upsample()) {
+        upsample->upmethod = jsimd_h2v2_merged_upsample;
+        cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+      } else
+#endif
+        upsample->upmethod = h2v2_merged_upsample;
     }
     /* Allocate a spare row buffer */
     upsample->spare_row = (_JSAMPROW)
@@ -571,18 +643,30 @@ _jinit_merged_upsampler(j_decompress_ptr cinfo)
                 (size_t)(upsample->out_row_width * sizeof(_JSAMPLE)));
   } else {
     upsample->pub._upsample = merged_1v_upsample;
-#ifdef WITH_SIMD
-    if (jsimd_can_h2v1_merged_upsample())
-      upsample->upmethod = jsimd_h2v1_merged_upsample;
-    else
-#endif
-      upsample->upmethod = h2v1_merged_upsample;
     if (cinfo->out_color_space == JCS_RGB565) {
       if (cinfo->dither_mode != JDITHER_NONE) {
         upsample->upmethod = h2v1_merged_upsample_565D;
       } else {
         upsample->upmethod = h2v1_merged_upsample_565;
+#ifdef WITH_SIMD
+        if (jsimd_can_h2v1_merged_upsample()) {
+          upsample->rgb_rows = (*cinfo->mem->alloc_sarray)
+            ((j_common_ptr)cinfo, JPOOL_IMAGE,
+             (JDIMENSION)jround_up((long)cinfo->output_width, 32L) *
+             rgb_pixelsize[JCS_RGB], 1);
+          upsample->upmethod = h2v1_merged_upsample_565_simd;
+          cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+        }
+#endif
       }
+    } else {
+#ifdef WITH_SIMD
+      if (jsimd_can_h2v1_merged_upsample()) {
+        upsample->upmethod = jsimd_h2v1_merged_upsample;
+        cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+      } else
+#endif
+        upsample->upmethod = h2v1_merged_upsample;
     }
     /* No spare row needed */
     upsample->spare_row = NULL;
@@ -39,6 +39,11 @@ typedef struct {
   _JSAMPROW spare_row;
   boolean spare_full;           /* T if spare buffer is occupied */
 
+#ifdef WITH_SIMD
+  /* Intermediate RGB rows for SIMD merged upsampling to RGB565 */
+  JSAMPARRAY rgb_rows;
+#endif
+
   JDIMENSION out_row_width;     /* samples per output row */
   JDIMENSION rows_to_go;        /* counts rows remaining in image */
 } my_merged_upsampler;
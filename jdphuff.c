@@ -279,15 +279,23 @@ process_restart(j_decompress_ptr cinfo)
  * coefficients may already have been assigned.  This is harmless for
  * spectral selection, since we'll just re-assign them on the next call.
  * Successive approximation AC refinement has to be more careful, however.)
+ *
+ * As in jdhuff.c, each scan type has a slow routine, which handles markers
+ * and suspension, and a fast routine, which is used when the source buffer
+ * holds enough bytes to decode the whole MCU without refilling.  The fast
+ * routines return FALSE if they encounter a marker, in which case the MCU is
+ * decoded again by the slow routine.
  */
 
+#define BUFSIZE  (DCTSIZE2 * 8)
+
 /*
  * MCU decoding for DC initial scan (either spectral selection,
  * or first pass of successive approximation).
  */
 
-METHODDEF(boolean)
-decode_mcu_DC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+LOCAL(boolean)
+decode_mcu_DC_first_slow(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
   phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
   int Al = cinfo->Al;
@@ -299,54 +307,130 @@ decode_mcu_DC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   d_derived_tbl *tbl;
   jpeg_component_info *compptr;
 
+  /* Load up working state */
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+  state = entropy->saved;
+
+  /* Outer loop handles each block in the MCU */
+
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    block = MCU_data[blkn];
+    ci = cinfo->MCU_membership[blkn];
+    compptr = cinfo->cur_comp_info[ci];
+    tbl = entropy->derived_tbls[compptr->dc_tbl_no];
+
+    /* Decode a single block's worth of coefficients */
+
+    /* Section F.2.2.1: decode the DC coefficient difference */
+    HUFF_DECODE(s, br_state, tbl, return FALSE, label1);
+    if (s) {
+      CHECK_BIT_BUFFER(br_state, s, return FALSE);
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+    }
+
+    /* Convert DC difference to actual value, update last_dc_val */
+    if ((state.last_dc_val[ci] >= 0 &&
+         s > INT_MAX - state.last_dc_val[ci]) ||
+        (state.last_dc_val[ci] < 0 && s < INT_MIN - state.last_dc_val[ci]))
+      ERREXIT(cinfo, JERR_BAD_DCT_COEF);
+    s += state.last_dc_val[ci];
+    state.last_dc_val[ci] = s;
+    /* Scale and output the coefficient (assumes jpeg_natural_order[0]=0) */
+    (*block)[0] = (JCOEF)LEFT_SHIFT(s, Al);
+  }
+
+  /* Completed MCU, so update state */
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  entropy->saved = state;
+  return TRUE;
+}
+
+
+LOCAL(boolean)
+decode_mcu_DC_first_fast(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int Al = cinfo->Al;
+  register int s, r, l;
+  int blkn, ci;
+  JBLOCKROW block;
+  BITREAD_STATE_VARS;
+  JOCTET *buffer;
+  savable_state state;
+  d_derived_tbl *tbl;
+  jpeg_component_info *compptr;
+
+  /* Load up working state */
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+  buffer = (JOCTET *)br_state.next_input_byte;
+  state = entropy->saved;
+
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    block = MCU_data[blkn];
+    ci = cinfo->MCU_membership[blkn];
+    compptr = cinfo->cur_comp_info[ci];
+    tbl = entropy->derived_tbls[compptr->dc_tbl_no];
+
+    HUFF_DECODE_FAST(s, l, tbl);
+    if (s) {
+      FILL_BIT_BUFFER_FAST
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+    }
+
+    if ((state.last_dc_val[ci] >= 0 &&
+         s > INT_MAX - state.last_dc_val[ci]) ||
+        (state.last_dc_val[ci] < 0 && s < INT_MIN - state.last_dc_val[ci]))
+      ERREXIT(cinfo, JERR_BAD_DCT_COEF);
+    s += state.last_dc_val[ci];
+    state.last_dc_val[ci] = s;
+    (*block)[0] = (JCOEF)LEFT_SHIFT(s, Al);
+  }
+
+  if (cinfo->unread_marker != 0) {
+    cinfo->unread_marker = 0;
+    return FALSE;
+  }
+
+  br_state.bytes_in_buffer -= (buffer - br_state.next_input_byte);
+  br_state.next_input_byte = buffer;
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  entropy->saved = state;
+  return TRUE;
+}
+
+
+METHODDEF(boolean)
+decode_mcu_DC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int usefast = 1;
+
   /* Process restart marker if needed; may have to suspend */
   if (cinfo->restart_interval) {
     if (entropy->restarts_to_go == 0)
       if (!process_restart(cinfo))
         return FALSE;
+    usefast = 0;
   }
 
+  if (cinfo->src->bytes_in_buffer < BUFSIZE * (size_t)cinfo->blocks_in_MCU ||
+      cinfo->unread_marker != 0)
+    usefast = 0;
+
   /* If we've run out of data, just leave the MCU set to zeroes.
    * This way, we return uniform gray for the remainder of the segment.
    */
   if (!entropy->pub.insufficient_data) {
 
-    /* Load up working state */
-    BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
-    state = entropy->saved;
-
-    /* Outer loop handles each block in the MCU */
-
-    for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
-      block = MCU_data[blkn];
-      ci = cinfo->MCU_membership[blkn];
-      compptr = cinfo->cur_comp_info[ci];
-      tbl = entropy->derived_tbls[compptr->dc_tbl_no];
-
-      /* Decode a single block's worth of coefficients */
-
-      /* Section F.2.2.1: decode the DC coefficient difference */
-      HUFF_DECODE(s, br_state, tbl, return FALSE, label1);
-      if (s) {
-        CHECK_BIT_BUFFER(br_state, s, return FALSE);
-        r = GET_BITS(s);
-        s = HUFF_EXTEND(r, s);
-      }
-
-      /* Convert DC difference to actual value, update last_dc_val */
-      if ((state.last_dc_val[ci] >= 0 &&
-           s > INT_MAX - state.last_dc_val[ci]) ||
-          (state.last_dc_val[ci] < 0 && s < INT_MIN - state.last_dc_val[ci]))
-        ERREXIT(cinfo, JERR_BAD_DCT_COEF);
-      s += state.last_dc_val[ci];
-      state.last_dc_val[ci] = s;
-      /* Scale and output the coefficient (assumes jpeg_natural_order[0]=0) */
-      (*block)[0] = (JCOEF)LEFT_SHIFT(s, Al);
+    if (usefast) {
+      if (!decode_mcu_DC_first_fast(cinfo, MCU_data)) goto use_slow;
+    } else {
+use_slow:
+      if (!decode_mcu_DC_first_slow(cinfo, MCU_data)) return FALSE;
     }
 
-    /* Completed MCU, so update state */
-    BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
-    entropy->saved = state;
   }
 
   /* Account for restart interval (no-op if not using restarts) */
@@ -362,8 +446,8 @@ decode_mcu_DC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
  * or first pass of successive approximation).
  */
 
-METHODDEF(boolean)
-decode_mcu_AC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+LOCAL(boolean)
+decode_mcu_AC_first_slow(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
   phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
   int Se = cinfo->Se;
@@ -374,64 +458,140 @@ decode_mcu_AC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   BITREAD_STATE_VARS;
   d_derived_tbl *tbl;
 
+  /* Load up working state */
+  EOBRUN = entropy->saved.EOBRUN;     /* only part of saved state we need */
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+
+  /* There is always only one block per MCU */
+  block = MCU_data[0];
+  tbl = entropy->ac_derived_tbl;
+
+  for (k = cinfo->Ss; k <= Se; k++) {
+    HUFF_DECODE(s, br_state, tbl, return FALSE, label2);
+    r = s >> 4;
+    s &= 15;
+    if (s) {
+      k += r;
+      CHECK_BIT_BUFFER(br_state, s, return FALSE);
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+      /* Scale and output coefficient in natural (dezigzagged) order */
+      (*block)[jpeg_natural_order[k]] = (JCOEF)LEFT_SHIFT(s, Al);
+    } else {
+      if (r == 15) {            /* ZRL */
+        k += 15;                /* skip 15 zeroes in band */
+      } else {                  /* EOBr, run length is 2^r + appended bits */
+        EOBRUN = 1 << r;
+        if (r) {                /* EOBr, r > 0 */
+          CHECK_BIT_BUFFER(br_state, r, return FALSE);
+          r = GET_BITS(r);
+          EOBRUN += r;
+        }
+        EOBRUN--;               /* this band is processed at this moment */
+        break;                  /* force end-of-band */
+      }
+    }
+  }
+
+  /* Completed MCU, so update state */
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  entropy->saved.EOBRUN = EOBRUN;     /* only part of saved state we need */
+  return TRUE;
+}
+
+
+LOCAL(boolean)
+decode_mcu_AC_first_fast(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int Se = cinfo->Se;
+  int Al = cinfo->Al;
+  register int s, k, r, l;
+  unsigned int EOBRUN;
+  JBLOCKROW block;
+  BITREAD_STATE_VARS;
+  JOCTET *buffer;
+  d_derived_tbl *tbl;
+
+  /* Load up working state */
+  EOBRUN = entropy->saved.EOBRUN;
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+  buffer = (JOCTET *)br_state.next_input_byte;
+
+  block = MCU_data[0];
+  tbl = entropy->ac_derived_tbl;
+
+  for (k = cinfo->Ss; k <= Se; k++) {
+    HUFF_DECODE_FAST(s, l, tbl);
+    r = s >> 4;
+    s &= 15;
+    if (s) {
+      k += r;
+      FILL_BIT_BUFFER_FAST
+      r = GET_BITS(s);
+      s = HUFF_EXTEND(r, s);
+      (*block)[jpeg_natural_order[k]] = (JCOEF)LEFT_SHIFT(s, Al);
+    } else {
+      if (r == 15) {
+        k += 15;
+      } else {
+        EOBRUN = 1 << r;
+        if (r) {
+          FILL_BIT_BUFFER_FAST
+          r = GET_BITS(r);
+          EOBRUN += r;
+        }
+        EOBRUN--;
+        break;
+      }
+    }
+  }
+
+  if (cinfo->unread_marker != 0) {
+    cinfo->unread_marker = 0;
+    return FALSE;
+  }
+
+  br_state.bytes_in_buffer -= (buffer - br_state.next_input_byte);
+  br_state.next_input_byte = buffer;
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  entropy->saved.EOBRUN = EOBRUN;
+  return TRUE;
+}
+
+
+METHODDEF(boolean)
+decode_mcu_AC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int usefast = 1;
+
   /* Process restart marker if needed; may have to suspend */
   if (cinfo->restart_interval) {
     if (entropy->restarts_to_go == 0)
       if (!process_restart(cinfo))
         return FALSE;
+    usefast = 0;
   }
 
+  if (cinfo->src->bytes_in_buffer < BUFSIZE || cinfo->unread_marker != 0)
+    usefast = 0;
+
   /* If we've run out of data, just leave the MCU set to zeroes.
    * This way, we return uniform gray for the remainder of the segment.
    */
   if (!entropy->pub.insufficient_data) {
 
-    /* Load up working state.
-     * We can avoid loading/saving bitread state if in an EOB run.
-     */
-    EOBRUN = entropy->saved.EOBRUN;     /* only part of saved state we need */
-
-    /* There is always only one block per MCU */
-
-    if (EOBRUN > 0)             /* if it's a band of zeroes... */
-      EOBRUN--;                 /* ...process it now (we do nothing) */
-    else {
-      BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
-      block = MCU_data[0];
-      tbl = entropy->ac_derived_tbl;
-
-      for (k = cinfo->Ss; k <= Se; k++) {
-        HUFF_DECODE(s, br_state, tbl, return FALSE, label2);
-        r = s >> 4;
-        s &= 15;
-        if (s) {
-          k += r;
-          CHECK_BIT_BUFFER(br_state, s, return FALSE);
-          r = GET_BITS(s);
-          s = HUFF_EXTEND(r, s);
-          /* Scale and output coefficient in natural (dezigzagged) order */
-          (*block)[jpeg_natural_order[k]] = (JCOEF)LEFT_SHIFT(s, Al);
-        } else {
-          if (r == 15) {        /* ZRL */
-            k += 15;            /* skip 15 zeroes in band */
-          } else {              /* EOBr, run length is 2^r + appended bits */
-            EOBRUN = 1 << r;
-            if (r) {            /* EOBr, r > 0 */
-              CHECK_BIT_BUFFER(br_state, r, return FALSE);
-              r = GET_BITS(r);
-              EOBRUN += r;
-            }
-            EOBRUN--;           /* this band is processed at this moment */
-            break;              /* force end-of-band */
-          }
-        }
-      }
-
-      BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+    /* We can avoid loading/saving bitread state if in an EOB run. */
+    if (entropy->saved.EOBRUN > 0)      /* if it's a band of zeroes... */
+      entropy->saved.EOBRUN--;          /* ...process it now (we do nothing) */
+    else if (usefast) {
+      if (!decode_mcu_AC_first_fast(cinfo, MCU_data)) goto use_slow;
+    } else {
+use_slow:
+      if (!decode_mcu_AC_first_slow(cinfo, MCU_data)) return FALSE;
     }
 
-    /* Completed MCU, so update state */
-    entropy->saved.EOBRUN = EOBRUN;     /* only part of saved state we need */
   }
 
   /* Account for restart interval (no-op if not using restarts) */
@@ -448,8 +608,8 @@ decode_mcu_AC_first(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
  * is not very clear on the point.
  */
 
-METHODDEF(boolean)
-decode_mcu_DC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+LOCAL(boolean)
+decode_mcu_DC_refine_slow(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
   phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
   int p1 = 1 << cinfo->Al;      /* 1 in the bit position being coded */
@@ -457,17 +617,6 @@ decode_mcu_DC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   JBLOCKROW block;
   BITREAD_STATE_VARS;
 
-  /* Process restart marker if needed; may have to suspend */
-  if (cinfo->restart_interval) {
-    if (entropy->restarts_to_go == 0)
-      if (!process_restart(cinfo))
-        return FALSE;
-  }
-
-  /* Not worth the cycles to check insufficient_data here,
-   * since we will not change the data anyway if we read zeroes.
-   */
-
   /* Load up working state */
   BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
 
@@ -485,6 +634,71 @@ decode_mcu_DC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 
   /* Completed MCU, so update state */
   BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  return TRUE;
+}
+
+
+LOCAL(boolean)
+decode_mcu_DC_refine_fast(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int p1 = 1 << cinfo->Al;
+  int blkn;
+  JBLOCKROW block;
+  BITREAD_STATE_VARS;
+  JOCTET *buffer;
+
+  /* Load up working state */
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+  buffer = (JOCTET *)br_state.next_input_byte;
+
+  /* A single refill covers all blocks, since blocks_in_MCU <= 10 */
+  FILL_BIT_BUFFER_FAST
+  for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+    block = MCU_data[blkn];
+    if (GET_BITS(1))
+      (*block)[0] |= p1;
+  }
+
+  if (cinfo->unread_marker != 0) {
+    cinfo->unread_marker = 0;
+    return FALSE;
+  }
+
+  br_state.bytes_in_buffer -= (buffer - br_state.next_input_byte);
+  br_state.next_input_byte = buffer;
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  return TRUE;
+}
+
+
+METHODDEF(boolean)
+decode_mcu_DC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int usefast = 1;
+
+  /* Process restart marker if needed; may have to suspend */
+  if (cinfo->restart_interval) {
+    if (entropy->restarts_to_go == 0)
+      if (!process_restart(cinfo))
+        return FALSE;
+    usefast = 0;
+  }
+
+  if (cinfo->src->bytes_in_buffer < BUFSIZE || cinfo->unread_marker != 0)
+    usefast = 0;
+
+  /* Not worth the cycles to check insufficient_data here,
+   * since we will not change the data anyway if we read zeroes.
+   */
+
+  if (usefast) {
+    if (!decode_mcu_DC_refine_fast(cinfo, MCU_data)) goto use_slow;
+  } else {
+use_slow:
+    if (!decode_mcu_DC_refine_slow(cinfo, MCU_data)) return FALSE;
+  }
 
   /* Account for restart interval (no-op if not using restarts) */
   if (cinfo->restart_interval)
@@ -498,8 +712,8 @@ decode_mcu_DC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
  * MCU decoding for AC successive approximation refinement scan.
  */
 
-METHODDEF(boolean)
-decode_mcu_AC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+LOCAL(boolean)
+decode_mcu_AC_refine_slow(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 {
   phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
   int Se = cinfo->Se;
@@ -514,126 +728,109 @@ decode_mcu_AC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   int num_newnz;
   int newnz_pos[DCTSIZE2];
 
-  /* Process restart marker if needed; may have to suspend */
-  if (cinfo->restart_interval) {
-    if (entropy->restarts_to_go == 0)
-      if (!process_restart(cinfo))
-        return FALSE;
-  }
+  /* Load up working state */
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+  EOBRUN = entropy->saved.EOBRUN; /* only part of saved state we need */
 
-  /* If we've run out of data, don't modify the MCU.
-   */
-  if (!entropy->pub.insufficient_data) {
+  /* There is always only one block per MCU */
+  block = MCU_data[0];
+  tbl = entropy->ac_derived_tbl;
 
-    /* Load up working state */
-    BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
-    EOBRUN = entropy->saved.EOBRUN; /* only part of saved state we need */
+  /* If we are forced to suspend, we must undo the assignments to any newly
+   * nonzero coefficients in the block, because otherwise we'd get confused
+   * next time about which coefficients were already nonzero.
+   * But we need not undo addition of bits to already-nonzero coefficients;
+   * instead, we can test the current bit to see if we already did it.
+   */
+  num_newnz = 0;
 
-    /* There is always only one block per MCU */
-    block = MCU_data[0];
-    tbl = entropy->ac_derived_tbl;
+  /* initialize coefficient loop counter to start of band */
+  k = cinfo->Ss;
 
-    /* If we are forced to suspend, we must undo the assignments to any newly
-     * nonzero coefficients in the block, because otherwise we'd get confused
-     * next time about which coefficients were already nonzero.
-     * But we need not undo addition of bits to already-nonzero coefficients;
-     * instead, we can test the current bit to see if we already did it.
-     */
-    num_newnz = 0;
-
-    /* initialize coefficient loop counter to start of band */
-    k = cinfo->Ss;
-
-    if (EOBRUN == 0) {
-      for (; k <= Se; k++) {
-        HUFF_DECODE(s, br_state, tbl, goto undoit, label3);
-        r = s >> 4;
-        s &= 15;
-        if (s) {
-          if (s != 1)           /* size of new coef should always be 1 */
-            WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
-          CHECK_BIT_BUFFER(br_state, 1, goto undoit);
-          if (GET_BITS(1))
-            s = p1;             /* newly nonzero coef is positive */
-          else
-            s = m1;             /* newly nonzero coef is negative */
-        } else {
-          if (r != 15) {
-            EOBRUN = 1 << r;    /* EOBr, run length is 2^r + appended bits */
-            if (r) {
-              CHECK_BIT_BUFFER(br_state, r, goto undoit);
-              r = GET_BITS(r);
-              EOBRUN += r;
-            }
-            break;              /* rest of block is handled by EOB logic */
-          }
-          /* note s = 0 for processing ZRL */
-        }
-        /* Advance over already-nonzero coefs and r still-zero coefs,
-         * appending correction bits to the nonzeroes.  A correction bit is 1
-         * if the absolute value of the coefficient must be increased.
-         */
-        do {
-          thiscoef = *block + jpeg_natural_order[k];
-          if (*thiscoef != 0) {
-            CHECK_BIT_BUFFER(br_state, 1, goto undoit);
-            if (GET_BITS(1)) {
-              if ((*thiscoef & p1) == 0) { /* do nothing if already set it */
-                if (*thiscoef >= 0)
-                  *thiscoef += (JCOEF)p1;
-                else
-                  *thiscoef += (JCOEF)m1;
-              }
-            }
-          } else {
-            if (--r < 0)
-              break;            /* reached target zero coefficient */
+  if (EOBRUN == 0) {
+    for (; k <= Se; k++) {
+      HUFF_DECODE(s, br_state, tbl, goto undoit, label3);
+      r = s >> 4;
+      s &= 15;
+      if (s) {
+        if (s != 1)             /* size of new coef should always be 1 */
+          WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
+        CHECK_BIT_BUFFER(br_state, 1, goto undoit);
+        if (GET_BITS(1))
+          s = p1;               /* newly nonzero coef is positive */
+        else
+          s = m1;               /* newly nonzero coef is negative */
+      } else {
+        if (r != 15) {
+          EOBRUN = 1 << r;      /* EOBr, run length is 2^r + appended bits */
+          if (r) {
+            CHECK_BIT_BUFFER(br_state, r, goto undoit);
+            r = GET_BITS(r);
+            EOBRUN += r;
           }
-          k++;
-        } while (k <= Se);
-        if (s) {
-          int pos = jpeg_natural_order[k];
-          /* Output newly nonzero coefficient */
-          (*block)[pos] = (JCOEF)s;
-          /* Remember its position in case we have to suspend */
-          newnz_pos[num_newnz++] = pos;
+          break;                /* rest of block is handled by EOB logic */
         }
+        /* note s = 0 for processing ZRL */
       }
-    }
-
-    if (EOBRUN > 0) {
-      /* Scan any remaining coefficient positions after the end-of-band
-       * (the last newly nonzero coefficient, if any).  Append a correction
-       * bit to each already-nonzero coefficient.  A correction bit is 1
+      /* Advance over already-nonzero coefs and r still-zero coefs,
+       * appending correction bits to the nonzeroes.  A correction bit is 1
        * if the absolute value of the coefficient must be increased.
        */
-      for (; k <= Se; k++) {
+      do {
         thiscoef = *block + jpeg_natural_order[k];
         if (*thiscoef != 0) {
           CHECK_BIT_BUFFER(br_state, 1, goto undoit);
           if (GET_BITS(1)) {
-            if ((*thiscoef & p1) == 0) { /* do nothing if already changed it */
+            if ((*thiscoef & p1) == 0) { /* do nothing if already set it */
               if (*thiscoef >= 0)
                 *thiscoef += (JCOEF)p1;
               else
                 *thiscoef += (JCOEF)m1;
             }
           }
+        } else {
+          if (--r < 0)
+            break;              /* reached target zero coefficient */
         }
+        k++;
+      } while (k <= Se);
+      if (s) {
+        int pos = jpeg_natural_order[k];
+        /* Output newly nonzero coefficient */
+        (*block)[pos] = (JCOEF)s;
+        /* Remember its position in case we have to suspend */
+        newnz_pos[num_newnz++] = pos;
       }
-      /* Count one block completed in EOB run */
-      EOBRUN--;
     }
-
-    /* Completed MCU, so update state */
-    BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
-    entropy->saved.EOBRUN = EOBRUN; /* only part of saved state we need */
   }
 
-  /* Account for restart interval (no-op if not using restarts) */
-  if (cinfo->restart_interval)
-    entropy->restarts_to_go--;
+  if (EOBRUN > 0) {
+    /* Scan any remaining coefficient positions after the end-of-band
+     * (the last newly nonzero coefficient, if any).  Append a correction
+     * bit to each already-nonzero coefficient.  A correction bit is 1
+     * if the absolute value of the coefficient must be increased.
+     */
+    for (; k <= Se; k++) {
+      thiscoef = *block + jpeg_natural_order[k];
+      if (*thiscoef != 0) {
+        CHECK_BIT_BUFFER(br_state, 1, goto undoit);
+        if (GET_BITS(1)) {
+          if ((*thiscoef & p1) == 0) { /* do nothing if already changed it */
+            if (*thiscoef >= 0)
+              *thiscoef += (JCOEF)p1;
+            else
+              *thiscoef += (JCOEF)m1;
+          }
+        }
+      }
+    }
+    /* Count one block completed in EOB run */
+    EOBRUN--;
+  }
 
+  /* Completed MCU, so update state */
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  entropy->saved.EOBRUN = EOBRUN; /* only part of saved state we need */
   return TRUE;
 
 undoit:
@@ -645,6 +842,160 @@ undoit:
 }
 
 
+LOCAL(boolean)
+decode_mcu_AC_refine_fast(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int Se = cinfo->Se;
+  int p1 = 1 << cinfo->Al;
+  int m1 = (NEG_1) << cinfo->Al;
+  register int s, k, r, l;
+  unsigned int EOBRUN;
+  JBLOCKROW block;
+  JCOEFPTR thiscoef;
+  BITREAD_STATE_VARS;
+  JOCTET *buffer;
+  d_derived_tbl *tbl;
+  int num_newnz, num_bad_codes = 0;
+  int newnz_pos[DCTSIZE2];
+
+  /* Load up working state */
+  BITREAD_LOAD_STATE(cinfo, entropy->bitstate);
+  buffer = (JOCTET *)br_state.next_input_byte;
+  EOBRUN = entropy->saved.EOBRUN;
+
+  block = MCU_data[0];
+  tbl = entropy->ac_derived_tbl;
+  num_newnz = 0;
+  k = cinfo->Ss;
+
+  if (EOBRUN == 0) {
+    for (; k <= Se; k++) {
+      HUFF_DECODE_FAST(s, l, tbl);
+      r = s >> 4;
+      s &= 15;
+      if (s) {
+        if (s != 1)             /* size of new coef should always be 1 */
+          num_bad_codes++;      /* warn after the MCU has been committed */
+        FILL_BIT_BUFFER_FAST
+        s = GET_BITS(1) ? p1 : m1;
+      } else {
+        if (r != 15) {
+          EOBRUN = 1 << r;
+          if (r) {
+            FILL_BIT_BUFFER_FAST
+            r = GET_BITS(r);
+            EOBRUN += r;
+          }
+          break;
+        }
+      }
+      do {
+        thiscoef = *block + jpeg_natural_order[k];
+        if (*thiscoef != 0) {
+          FILL_BIT_BUFFER_FAST
+          if (GET_BITS(1)) {
+            if ((*thiscoef & p1) == 0) {
+              if (*thiscoef >= 0)
+                *thiscoef += (JCOEF)p1;
+              else
+                *thiscoef += (JCOEF)m1;
+            }
+          }
+        } else {
+          if (--r < 0)
+            break;
+        }
+        k++;
+      } while (k <= Se);
+      if (s) {
+        int pos = jpeg_natural_order[k];
+        (*block)[pos] = (JCOEF)s;
+        newnz_pos[num_newnz++] = pos;
+      }
+    }
+  }
+
+  if (EOBRUN > 0) {
+    for (; k <= Se; k++) {
+      thiscoef = *block + jpeg_natural_order[k];
+      if (*thiscoef != 0) {
+        FILL_BIT_BUFFER_FAST
+        if (GET_BITS(1)) {
+          if ((*thiscoef & p1) == 0) {
+            if (*thiscoef >= 0)
+              *thiscoef += (JCOEF)p1;
+            else
+              *thiscoef += (JCOEF)m1;
+          }
+        }
+      }
+    }
+    EOBRUN--;
+  }
+
+  if (cinfo->unread_marker != 0) {
+    /* The slow routine will decode this MCU again, so it must see the newly
+     * nonzero coefficients as zero.  (Correction bits need not be undone.)
+     */
+    while (num_newnz > 0)
+      (*block)[newnz_pos[--num_newnz]] = 0;
+    cinfo->unread_marker = 0;
+    return FALSE;
+  }
+
+  /* The slow routine would have warned about the same codes, so the warnings
+   * are not emitted until it is certain that the slow routine won't run.
+   */
+  while (num_bad_codes-- > 0)
+    WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
+
+  br_state.bytes_in_buffer -= (buffer - br_state.next_input_byte);
+  br_state.next_input_byte = buffer;
+  BITREAD_SAVE_STATE(cinfo, entropy->bitstate);
+  entropy->saved.EOBRUN = EOBRUN;
+  return TRUE;
+}
+
+
+METHODDEF(boolean)
+decode_mcu_AC_refine(j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr)cinfo->entropy;
+  int usefast = 1;
+
+  /* Process restart marker if needed; may have to suspend */
+  if (cinfo->restart_interval) {
+    if (entropy->restarts_to_go == 0)
+      if (!process_restart(cinfo))
+        return FALSE;
+    usefast = 0;
+  }
+
+  if (cinfo->src->bytes_in_buffer < BUFSIZE || cinfo->unread_marker != 0)
+    usefast = 0;
+
+  /* If we've run out of data, don't modify the MCU.
+   */
+  if (!entropy->pub.insufficient_data) {
+
+    if (usefast) {
+      if (!decode_mcu_AC_refine_fast(cinfo, MCU_data)) goto use_slow;
+    } else {
+use_slow:
+      if (!decode_mcu_AC_refine_slow(cinfo, MCU_data)) return FALSE;
+    }
+
+  }
+
+  /* Account for restart interval (no-op if not using restarts) */
+  if (cinfo->restart_interval)
+    entropy->restarts_to_go--;
+
+  return TRUE;
+}
+
+
 /*
  * Module initialization routine for progressive Huffman entropy decoding.
  */
@@ -667,6 +1018,8 @@ jinit_phuff_decoder(j_decompress_ptr cinfo)
     entropy->derived_tbls[i] = NULL;
   }
 
+  jpeg_init_d_derived_cache(cinfo);
+
   /* Create progression status table */
   cinfo->coef_bits = (int (*)[DCTSIZE2])
     (*cinfo->mem->alloc_small) ((j_common_ptr)cinfo, JPOOL_IMAGE,
@@ -178,11 +178,30 @@ int_upsample(j_decompress_ptr cinfo, jpeg_component_info *compptr,
     /* Generate one output row with proper horizontal expansion */
     inptr = input_data[inrow];
     outptr = output_data[outrow];
-    outend = outptr + cinfo->output_width;
-    while (outptr < outend) {
-      invalue = *inptr++;
-      for (h = h_expand; h > 0; h--) {
-        *outptr++ = invalue;
+    if (h_expand == 1) {
+      /* 1:N vertical (4:4:0 without fancy upsampling, 4:4:1) */
+      memcpy(outptr, inptr, cinfo->output_width * sizeof(_JSAMPLE));
+    } else if (h_expand == 4) {
+      /* 4:1 horizontal (4:1:1).  Using a known trip count and expansion
+       * factor allows the compiler to vectorize the loop.
+       */
+      JDIMENSION incol, in_cols = (cinfo->output_width + 3) >> 2;
+
+      for (incol = 0; incol < in_cols; incol++) {
+        invalue = inptr[incol];
+        outptr[0] = invalue;
+        outptr[1] = invalue;
+        outptr[2] = invalue;
+        outptr[3] = invalue;
+        outptr += 4;
+      }
+    } else {
+      outend = outptr + cinfo->output_width;
+      while (outptr < outend) {
+        invalue = *inptr++;
+        for (h = h_expand; h > 0; h--) {
+          *outptr++ = invalue;
+        }
       }
     }
     /* Generate any additional output rows by duplicating the first one */
@@ -323,7 +342,10 @@ h1v2_fancy_upsample(j_decompress_ptr cinfo, jpeg_component_info *compptr,
 #else
   JLONG thiscolsum, bias;
 #endif
-  JDIMENSION colctr;
+  /* Read the width once, so the compiler need not assume that the output
+   * stores modify it.  This allows the loop below to be vectorized.
+   */
+  JDIMENSION colctr, width = compptr->downsampled_width;
   int inrow, outrow, v;
 
   inrow = outrow = 0;
@@ -340,9 +362,9 @@ h1v2_fancy_upsample(j_decompress_ptr cinfo, jpeg_component_info *compptr,
       }
       outptr = output_data[outrow++];
 
-      for (colctr = 0; colctr < compptr->downsampled_width; colctr++) {
-        thiscolsum = (*inptr0++) * 3 + (*inptr1++);
-        *outptr++ = (_JSAMPLE)((thiscolsum + bias) >> 2);
+      for (colctr = 0; colctr < width; colctr++) {
+        thiscolsum = inptr0[colctr] * 3 + inptr1[colctr];
+        outptr[colctr] = (_JSAMPLE)((thiscolsum + bias) >> 2);
       }
     }
     inrow++;
@@ -471,16 +493,18 @@ _jinit_upsampler(j_decompress_ptr cinfo)
       /* Special cases for 2h1v upsampling */
       if (do_fancy && compptr->downsampled_width > 2) {
 #ifdef WITH_SIMD
-        if (jsimd_can_h2v1_fancy_upsample())
+        if (jsimd_can_h2v1_fancy_upsample()) {
           upsample->methods[ci] = jsimd_h2v1_fancy_upsample;
-        else
+          cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+        } else
 #endif
           upsample->methods[ci] = h2v1_fancy_upsample;
       } else {
 #ifdef WITH_SIMD
-        if (jsimd_can_h2v1_upsample())
+        if (jsimd_can_h2v1_upsample()) {
           upsample->methods[ci] = jsimd_h2v1_upsample;
-        else
+          cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+        } else
 #endif
           upsample->methods[ci] = h2v1_upsample;
       }
@@ -489,9 +513,10 @@ _jinit_upsampler(j_decompress_ptr cinfo)
       /* Non-fancy upsampling is handled by the generic method */
 #if defined(WITH_SIMD) && (defined(__arm__) || defined(__aarch64__) || \
                            defined(_M_ARM) || defined(_M_ARM64))
-      if (jsimd_can_h1v2_fancy_upsample())
+      if (jsimd_can_h1v2_fancy_upsample()) {
         upsample->methods[ci] = jsimd_h1v2_fancy_upsample;
-      else
+        cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+      } else
 #endif
         upsample->methods[ci] = h1v2_fancy_upsample;
       upsample->pub.need_context_rows = TRUE;
@@ -500,17 +525,19 @@ _jinit_upsampler(j_decompress_ptr cinfo)
       /* Special cases for 2h2v upsampling */
       if (do_fancy && compptr->downsampled_width > 2) {
 #ifdef WITH_SIMD
-        if (jsimd_can_h2v2_fancy_upsample())
+        if (jsimd_can_h2v2_fancy_upsample()) {
           upsample->methods[ci] = jsimd_h2v2_fancy_upsample;
-        else
+          cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+        } else
 #endif
           upsample->methods[ci] = h2v2_fancy_upsample;
         upsample->pub.need_context_rows = TRUE;
       } else {
 #ifdef WITH_SIMD
-        if (jsimd_can_h2v2_upsample())
+        if (jsimd_can_h2v2_upsample()) {
           upsample->methods[ci] = jsimd_h2v2_upsample;
-        else
+          cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+        } else
 #endif
           upsample->methods[ci] = h2v2_upsample;
       }
@@ -518,9 +545,10 @@ _jinit_upsampler(j_decompress_ptr cinfo)
                (v_out_group % v_in_group) == 0) {
       /* Generic integral-factors upsampling method */
 #if defined(WITH_SIMD) && defined(__mips__)
-      if (jsimd_can_int_upsample())
+      if (jsimd_can_int_upsample()) {
         upsample->methods[ci] = jsimd_int_upsample;
-      else
+        cinfo->master->simd_stages |= JSTAGE_UPSAMPLE;
+      } else
 #endif
         upsample->methods[ci] = int_upsample;
       upsample->h_expand[ci] = (UINT8)(h_out_group / h_in_group);
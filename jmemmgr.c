@@ -137,6 +137,20 @@ typedef struct {
 
   /* This counts total space obtained from jpeg_get_small/large */
   size_t total_space_allocated;
+  size_t peak_space_allocated;  /* high-water mark of the above */
+
+  /* If estimating is TRUE, then realize_virt_arrays only accounts for the
+   * in-memory buffers (see jpeg_mem_estimate).  estimated_space is the amount
+   * of space that was accounted for but not obtained, which is included in
+   * total_space_allocated until the image pool is freed.
+   */
+  boolean estimating;
+  size_t estimated_space;
+
+  /* Allocator for the image pool (see jpeg_set_allocator).  If get_mem is
+   * NULL, then jpeg_get_small/large and jpeg_free_small/large are used.
+   */
+  struct jpeg_allocator allocator;
 
   /* alloc_sarray and alloc_barray set this value for use by virtual
    * array routines.
@@ -262,6 +276,42 @@ static const size_t extra_pool_slop[JPOOL_NUMPOOLS] = {
 #define MIN_SLOP  50            /* greater than 0 to avoid futile looping */
 
 
+/*
+ * Obtain and release pool memory.  Objects in the image pool are obtained
+ * from the application-supplied allocator, if any.  The permanent pool always
+ * uses the system-dependent routines, since it is created along with the JPEG
+ * object.
+ */
+
+LOCAL(void *)
+get_pool_mem(j_common_ptr cinfo, int pool_id, size_t sizeofobject,
+             boolean large)
+{
+  my_mem_ptr mem = (my_mem_ptr)cinfo->mem;
+
+  if (pool_id == JPOOL_IMAGE && mem->allocator.get_mem != NULL)
+    return (*mem->allocator.get_mem) (mem->allocator.opaque, sizeofobject,
+                                      large);
+  return large ? jpeg_get_large(cinfo, sizeofobject) :
+                 jpeg_get_small(cinfo, sizeofobject);
+}
+
+LOCAL(void)
+free_pool_mem(j_common_ptr cinfo, int pool_id, void *object,
+              size_t sizeofobject, boolean large)
+{
+  my_mem_ptr mem = (my_mem_ptr)cinfo->mem;
+
+  if (pool_id == JPOOL_IMAGE && mem->allocator.get_mem != NULL)
+    (*mem->allocator.free_mem) (mem->allocator.opaque, object, sizeofobject,
+                                large);
+  else if (large)
+    jpeg_free_large(cinfo, object, sizeofobject);
+  else
+    jpeg_free_small(cinfo, object, sizeofobject);
+}
+
+
 METHODDEF(void *)
 alloc_small(j_common_ptr cinfo, int pool_id, size_t sizeofobject)
 /* Allocate a "small" object */
@@ -314,7 +364,8 @@ alloc_small(j_common_ptr cinfo, int pool_id, size_t sizeofobject)
       slop = (size_t)(MAX_ALLOC_CHUNK - min_request);
     /* Try to get space, if fail reduce slop and try again */
     for (;;) {
-      hdr_ptr = (small_pool_ptr)jpeg_get_small(cinfo, min_request + slop);
+      hdr_ptr = (small_pool_ptr)get_pool_mem(cinfo, pool_id,
+                                             min_request + slop, FALSE);
       if (hdr_ptr != NULL)
         break;
       slop /= 2;
@@ -322,6 +373,8 @@ alloc_small(j_common_ptr cinfo, int pool_id, size_t sizeofobject)
         out_of_memory(cinfo, 2); /* jpeg_get_small failed */
     }
     mem->total_space_allocated += min_request + slop;
+    if (mem->total_space_allocated > mem->peak_space_allocated)
+      mem->peak_space_allocated = mem->total_space_allocated;
     /* Success, initialize the new pool header and add to end of list */
     hdr_ptr->next = NULL;
     hdr_ptr->bytes_used = 0;
@@ -388,13 +441,15 @@ alloc_large(j_common_ptr cinfo, int pool_id, size_t sizeofobject)
   if (pool_id < 0 || pool_id >= JPOOL_NUMPOOLS)
     ERREXIT1(cinfo, JERR_BAD_POOL_ID, pool_id); /* safety check */
 
-  hdr_ptr = (large_pool_ptr)jpeg_get_large(cinfo, sizeofobject +
-                                           sizeof(large_pool_hdr) +
-                                           ALIGN_SIZE - 1);
+  hdr_ptr = (large_pool_ptr)get_pool_mem(cinfo, pool_id, sizeofobject +
+                                         sizeof(large_pool_hdr) +
+                                         ALIGN_SIZE - 1, TRUE);
   if (hdr_ptr == NULL)
     out_of_memory(cinfo, 4);    /* jpeg_get_large failed */
   mem->total_space_allocated += sizeofobject + sizeof(large_pool_hdr) +
                                 ALIGN_SIZE - 1;
+  if (mem->total_space_allocated > mem->peak_space_allocated)
+    mem->peak_space_allocated = mem->total_space_allocated;
 
   /* Success, initialize the new pool header and add to list */
   hdr_ptr->next = mem->large_list[pool_id];
@@ -691,6 +746,41 @@ request_virt_barray(j_common_ptr cinfo, int pool_id, boolean pre_zero,
 }
 
 
+LOCAL(void)
+estimate_array(j_common_ptr cinfo, size_t rowsize, JDIMENSION numrows)
+/* Account for the space that alloc_sarray or alloc_barray would obtain for an
+ * array with the given row size (in bytes, after alignment) and height,
+ * without obtaining it.  The row pointers are small objects, so they are
+ * actually allocated in order to keep the small pool accounting exact.
+ */
+{
+  my_mem_ptr mem = (my_mem_ptr)cinfo->mem;
+  JDIMENSION rowsperchunk, currow;
+  size_t chunk_space;
+  long ltemp;
+
+  ltemp = (MAX_ALLOC_CHUNK - sizeof(large_pool_hdr)) / (long)rowsize;
+  if (ltemp <= 0)
+    ERREXIT(cinfo, JERR_WIDTH_OVERFLOW);
+  if (ltemp < (long)numrows)
+    rowsperchunk = (JDIMENSION)ltemp;
+  else
+    rowsperchunk = numrows;
+
+  (void)alloc_small(cinfo, JPOOL_IMAGE, (size_t)numrows * sizeof(void *));
+
+  for (currow = 0; currow < numrows; currow += rowsperchunk) {
+    rowsperchunk = MIN(rowsperchunk, numrows - currow);
+    chunk_space = round_up_pow2((size_t)rowsperchunk * rowsize, ALIGN_SIZE) +
+                  sizeof(large_pool_hdr) + ALIGN_SIZE - 1;
+    mem->total_space_allocated += chunk_space;
+    mem->estimated_space += chunk_space;
+  }
+  if (mem->total_space_allocated > mem->peak_space_allocated)
+    mem->peak_space_allocated = mem->total_space_allocated;
+}
+
+
 METHODDEF(void)
 realize_virt_arrays(j_common_ptr cinfo)
 /* Allocate the in-memory buffers for any unrealized virtual arrays */
@@ -769,6 +859,8 @@ realize_virt_arrays(j_common_ptr cinfo)
       if (minheights <= max_minheights) {
         /* This buffer fits in memory */
         sptr->rows_in_mem = sptr->rows_in_array;
+      } else if (mem->estimating) {
+        sptr->rows_in_mem = (JDIMENSION)(max_minheights * sptr->maxaccess);
       } else {
         /* It doesn't fit in memory, create backing store. */
         sptr->rows_in_mem = (JDIMENSION)(max_minheights * sptr->maxaccess);
@@ -778,6 +870,13 @@ realize_virt_arrays(j_common_ptr cinfo)
                                 (long)sample_size);
         sptr->b_s_open = TRUE;
       }
+      if (mem->estimating) {
+        estimate_array(cinfo, (size_t)round_up_pow2(sptr->samplesperrow,
+                                                    (2 * ALIGN_SIZE) /
+                                                    sample_size) * sample_size,
+                       sptr->rows_in_mem);
+        continue;
+      }
       sptr->mem_buffer = alloc_sarray(cinfo, JPOOL_IMAGE,
                                       sptr->samplesperrow, sptr->rows_in_mem);
       sptr->rowsperchunk = mem->last_rowsperchunk;
@@ -793,6 +892,8 @@ realize_virt_arrays(j_common_ptr cinfo)
       if (minheights <= max_minheights) {
         /* This buffer fits in memory */
         bptr->rows_in_mem = bptr->rows_in_array;
+      } else if (mem->estimating) {
+        bptr->rows_in_mem = (JDIMENSION)(max_minheights * bptr->maxaccess);
       } else {
         /* It doesn't fit in memory, create backing store. */
         bptr->rows_in_mem = (JDIMENSION)(max_minheights * bptr->maxaccess);
@@ -802,6 +903,11 @@ realize_virt_arrays(j_common_ptr cinfo)
                                 (long)sizeof(JBLOCK));
         bptr->b_s_open = TRUE;
       }
+      if (mem->estimating) {
+        estimate_array(cinfo, bptr->blocksperrow * sizeof(JBLOCK),
+                       bptr->rows_in_mem);
+        continue;
+      }
       bptr->mem_buffer = alloc_barray(cinfo, JPOOL_IMAGE,
                                       bptr->blocksperrow, bptr->rows_in_mem);
       bptr->rowsperchunk = mem->last_rowsperchunk;
@@ -1128,6 +1234,10 @@ free_pool(j_common_ptr cinfo, int pool_id)
       }
     }
     mem->virt_barray_list = NULL;
+
+    mem->total_space_allocated -= mem->estimated_space;
+    mem->estimated_space = 0;
+    mem->estimating = FALSE;
   }
 
   /* Release large objects */
@@ -1139,7 +1249,7 @@ free_pool(j_common_ptr cinfo, int pool_id)
     space_freed = lhdr_ptr->bytes_used +
                   lhdr_ptr->bytes_left +
                   sizeof(large_pool_hdr) + ALIGN_SIZE - 1;
-    jpeg_free_large(cinfo, (void *)lhdr_ptr, space_freed);
+    free_pool_mem(cinfo, pool_id, (void *)lhdr_ptr, space_freed, TRUE);
     mem->total_space_allocated -= space_freed;
     lhdr_ptr = next_lhdr_ptr;
   }
@@ -1152,7 +1262,7 @@ free_pool(j_common_ptr cinfo, int pool_id)
     small_pool_ptr next_shdr_ptr = shdr_ptr->next;
     space_freed = shdr_ptr->bytes_used + shdr_ptr->bytes_left +
                   sizeof(small_pool_hdr) + ALIGN_SIZE - 1;
-    jpeg_free_small(cinfo, (void *)shdr_ptr, space_freed);
+    free_pool_mem(cinfo, pool_id, (void *)shdr_ptr, space_freed, FALSE);
     mem->total_space_allocated -= space_freed;
     shdr_ptr = next_shdr_ptr;
   }
@@ -1255,7 +1365,13 @@ jinit_memory_mgr(j_common_ptr cinfo)
   mem->virt_sarray_list = NULL;
   mem->virt_barray_list = NULL;
 
-  mem->total_space_allocated = sizeof(my_memory_mgr);
+  mem->total_space_allocated = mem->peak_space_allocated =
+    sizeof(my_memory_mgr);
+  mem->estimating = FALSE;
+  mem->estimated_space = 0;
+  mem->allocator.get_mem = NULL;
+  mem->allocator.free_mem = NULL;
+  mem->allocator.opaque = NULL;
 
   /* Declare ourselves open for business */
   cinfo->mem = &mem->pub;
@@ -1287,3 +1403,70 @@ jinit_memory_mgr(j_common_ptr cinfo)
 #endif
 
 }
+
+
+/*
+ * Return the peak amount of memory (in bytes) obtained from
+ * jpeg_get_small/large since the memory manager was initialized or since the
+ * last call to this function with reset = TRUE.  Resetting the peak sets it to
+ * the amount of memory currently allocated.
+ */
+
+GLOBAL(size_t)
+jpeg_mem_peak(j_common_ptr cinfo, boolean reset)
+{
+  my_mem_ptr mem = (my_mem_ptr)cinfo->mem;
+  size_t peak = mem->peak_space_allocated;
+
+  if (reset)
+    mem->peak_space_allocated = mem->total_space_allocated;
+  return peak;
+}
+
+
+/*
+ * Put the memory manager into estimation mode for the current image.  In this
+ * mode, realize_virt_arrays accounts for the in-memory buffers of the virtual
+ * arrays, as reported by jpeg_mem_peak, without obtaining them or creating
+ * backing store.  This allows the peak memory usage of an operation to be
+ * determined by initializing the active modules without performing the
+ * operation.  The virtual arrays cannot be accessed in this mode, so the
+ * operation must be aborted after the modules are initialized.  The mode ends
+ * when the image pool is freed.
+ */
+
+GLOBAL(void)
+jpeg_mem_estimate(j_common_ptr cinfo)
+{
+  my_mem_ptr mem = (my_mem_ptr)cinfo->mem;
+
+  mem->estimating = TRUE;
+}
+
+
+/*
+ * Install an application-supplied allocator for the image pool, or restore
+ * the default allocator if allocator is NULL.  This can only be called when
+ * the image pool is empty, i.e. before an image has been started or after it
+ * has been finished or aborted, since objects must be released using the
+ * allocator that obtained them.
+ */
+
+GLOBAL(void)
+jpeg_set_allocator(j_common_ptr cinfo, const struct jpeg_allocator *allocator)
+{
+  my_mem_ptr mem = (my_mem_ptr)cinfo->mem;
+
+  if (mem->small_list[JPOOL_IMAGE] != NULL ||
+      mem->large_list[JPOOL_IMAGE] != NULL)
+    ERREXIT1(cinfo, JERR_BAD_STATE, cinfo->global_state);
+
+  if (allocator != NULL && allocator->get_mem != NULL &&
+      allocator->free_mem != NULL)
+    mem->allocator = *allocator;
+  else {
+    mem->allocator.get_mem = NULL;
+    mem->allocator.free_mem = NULL;
+    mem->allocator.opaque = NULL;
+  }
+}
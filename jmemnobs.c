@@ -9,12 +9,13 @@
  * file.
  *
  * This file provides a really simple implementation of the system-
- * dependent portion of the JPEG memory manager.  This implementation
- * assumes that no backing-store files are needed: all required space
- * can be obtained from malloc().
- * This is very portable in the sense that it'll compile on almost anything,
- * but you'd better have lots of main memory (or virtual memory) if you want
- * to process big images.
+ * dependent portion of the JPEG memory manager.  All required space is
+ * obtained from malloc().  Unless max_memory_to_use is set, no backing store
+ * is needed, so you'd better have lots of main memory (or virtual memory) if
+ * you want to process big images.  If max_memory_to_use is set, then virtual
+ * arrays that do not fit within the limit are spilled to an anonymous
+ * temporary file on POSIX systems.  On other systems, exceeding the limit is
+ * an error.
  */
 
 #define JPEG_INTERNALS
@@ -22,6 +23,13 @@
 #include "jpeglib.h"
 #include "jmemsys.h"            /* import the system-dependent declarations */
 
+#ifndef _WIN32
+#define USE_TEMP_FILE_BACKING_STORE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 /*
  * Memory allocation and freeing are controlled by the regular library
@@ -80,10 +88,105 @@ jpeg_mem_available(j_common_ptr cinfo, size_t min_bytes_needed,
 
 /*
  * Backing store (temporary file) management.
- * Since jpeg_mem_available always promised the moon,
- * this should never be called and we can just error out.
+ * This is only called if max_memory_to_use is set and the virtual arrays do
+ * not fit within it.
  */
 
+#ifdef USE_TEMP_FILE_BACKING_STORE
+
+/*
+ * The temporary file is created with mkstemp() in the directory specified by
+ * the TMPDIR environment variable (or /tmp, if TMPDIR is unset or too long)
+ * and is unlinked immediately, so it is never visible to other processes and
+ * is reclaimed by the O/S even if the application crashes.  The file is
+ * accessed with pread()/pwrite(), which avoids a separate seek for each
+ * transfer.  Within each pass, the codec accesses virtual arrays in order of
+ * increasing row number, so we advise the O/S that access will be sequential,
+ * which allows it to prefetch aggressively.
+ */
+
+METHODDEF(void)
+read_backing_store(j_common_ptr cinfo, backing_store_ptr info,
+                   void *buffer_address, long file_offset, long byte_count)
+{
+  char *ptr = (char *)buffer_address;
+  off_t offset = (off_t)file_offset;
+  ssize_t nbytes;
+
+  while (byte_count > 0) {
+    nbytes = pread(info->temp_fd, ptr, (size_t)byte_count, offset);
+    if (nbytes < 0 && errno == EINTR)
+      continue;
+    if (nbytes <= 0)
+      ERREXIT(cinfo, JERR_TFILE_READ);
+    ptr += nbytes;  offset += nbytes;  byte_count -= (long)nbytes;
+  }
+}
+
+
+METHODDEF(void)
+write_backing_store(j_common_ptr cinfo, backing_store_ptr info,
+                    void *buffer_address, long file_offset, long byte_count)
+{
+  char *ptr = (char *)buffer_address;
+  off_t offset = (off_t)file_offset;
+  ssize_t nbytes;
+
+  while (byte_count > 0) {
+    nbytes = pwrite(info->temp_fd, ptr, (size_t)byte_count, offset);
+    if (nbytes < 0 && errno == EINTR)
+      continue;
+    if (nbytes <= 0)
+      ERREXIT(cinfo, JERR_TFILE_WRITE);
+    ptr += nbytes;  offset += nbytes;  byte_count -= (long)nbytes;
+  }
+}
+
+
+METHODDEF(void)
+close_backing_store(j_common_ptr cinfo, backing_store_ptr info)
+{
+  close(info->temp_fd);
+  info->temp_fd = -1;
+  TRACEMSS(cinfo, 1, JTRC_TFILE_CLOSE, info->temp_name);
+}
+
+
+GLOBAL(void)
+jpeg_open_backing_store(j_common_ptr cinfo, backing_store_ptr info,
+                        long total_bytes_needed)
+{
+  static const char template_name[] = "/JPGXXXXXX";
+  size_t dir_length = 0;
+
+#ifndef NO_GETENV
+  if (GETENV_S(info->temp_name,
+               TEMP_NAME_LENGTH - sizeof(template_name) + 1, "TMPDIR"))
+    info->temp_name[0] = 0;
+  dir_length = strlen(info->temp_name);
+#endif
+  if (dir_length == 0) {
+    strcpy(info->temp_name, "/tmp");
+    dir_length = strlen(info->temp_name);
+  }
+  strcpy(info->temp_name + dir_length, template_name);
+
+  if ((info->temp_fd = mkstemp(info->temp_name)) < 0)
+    ERREXITS(cinfo, JERR_TFILE_CREATE, info->temp_name);
+  unlink(info->temp_name);
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(info->temp_fd, 0, (off_t)total_bytes_needed,
+                POSIX_FADV_SEQUENTIAL);
+#endif
+
+  info->read_backing_store = read_backing_store;
+  info->write_backing_store = write_backing_store;
+  info->close_backing_store = close_backing_store;
+  TRACEMSS(cinfo, 1, JTRC_TFILE_OPEN, info->temp_name);
+}
+
+#else /* USE_TEMP_FILE_BACKING_STORE */
+
 GLOBAL(void)
 jpeg_open_backing_store(j_common_ptr cinfo, backing_store_ptr info,
                         long total_bytes_needed)
@@ -91,6 +194,8 @@ jpeg_open_backing_store(j_common_ptr cinfo, backing_store_ptr info,
   ERREXIT(cinfo, JERR_NO_BACKING_STORE);
 }
 
+#endif /* USE_TEMP_FILE_BACKING_STORE */
+
 
 /*
  * These routines take care of any system-dependent initialization and
@@ -114,6 +114,7 @@ typedef struct backing_store_struct {
   /* Private fields for system-dependent backing-store management */
   /* For a typical implementation with temp files, we need: */
   FILE *temp_file;              /* stdio reference to temp file */
+  int temp_fd;                  /* file descriptor of temp file (POSIX) */
   char temp_name[TEMP_NAME_LENGTH]; /* name of temp file */
 } backing_store_info;
 
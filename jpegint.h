@@ -77,6 +77,24 @@ typedef size_t JUINTPTR;
 #define IsExtRGB(cs) \
   (cs == JCS_RGB || (cs >= JCS_EXT_RGB && cs <= JCS_EXT_ARGB))
 
+/* Color matrices for conversion between RGB and YCbCr.  The default is the
+ * JFIF matrix (ITU-R BT.601, full range.)  Limited-range ("video range")
+ * matrices place Y in [16, 235] and Cb/Cr in [16, 240], scaled to the sample
+ * precision.
+ */
+
+typedef enum {
+  JCM_BT601,              /* ITU-R BT.601, full range (JFIF) */
+  JCM_BT601_LIMITED,      /* ITU-R BT.601, limited range */
+  JCM_BT709,              /* ITU-R BT.709, full range */
+  JCM_BT709_LIMITED       /* ITU-R BT.709, limited range */
+} J_COLOR_MATRIX;
+
+#define JCM_KR(m)  ((m) >= JCM_BT709 ? 0.2126 : 0.299)  /* red weight of Y */
+#define JCM_KB(m)  ((m) >= JCM_BT709 ? 0.0722 : 0.114)  /* blue weight of Y */
+#define JCM_IS_LIMITED(m) \
+  ((m) == JCM_BT601_LIMITED || (m) == JCM_BT709_LIMITED)
+
 /*
  * Left shift macro that handles a negative operand without causing any
  * sanitizer warnings
@@ -97,6 +115,13 @@ struct jpeg_comp_master {
   boolean call_pass_startup;    /* True if pass_startup must be called */
   boolean is_last_pass;         /* True during last pass */
   boolean lossless;             /* True if lossless mode is enabled */
+
+  /* Color matrix for RGB->YCbCr conversion (see jccolor.c) */
+  J_COLOR_MATRIX color_matrix;
+
+  /* Derived tables retained across images (see jchuff.c and jcdctmgr.c) */
+  struct jpeg_c_derived_cache *huff_cache;
+  struct jpeg_divisor_cache *divisor_cache;
 };
 
 /* Main buffer control (downsampled-data buffer) */
@@ -198,6 +223,17 @@ struct jpeg_forward_dct {
                           J12SAMPARRAY sample_data, JBLOCKROW coef_blocks,
                           JDIMENSION start_row, JDIMENSION start_col,
                           JDIMENSION num_blocks);
+
+  /* Forward DCT cache (8-bit lossy mode only.)  If dct_cache is non-NULL,
+   * then it must have room for the unquantized DCT output of every block in
+   * the image.  If dct_cache_valid is FALSE, then forward_DCT() stores the
+   * unquantized output in the cache as it goes.  If dct_cache_valid is TRUE,
+   * then forward_DCT() ignores the sample data and quantizes the cached
+   * output instead, which allows the same image to be compressed with
+   * different quantization tables without repeating the DCT.
+   */
+  JBLOCKROW dct_cache;
+  boolean dct_cache_valid;
 };
 
 /* Entropy encoding */
@@ -212,6 +248,14 @@ struct jpeg_entropy_encoder {
                              JDIMENSION nMCU);
 
   void (*finish_pass) (j_compress_ptr cinfo);
+
+  /* Sequential Huffman encoder only:  If huff_counts is not NULL, then the
+   * symbol counts from each statistics-gathering pass are added to it
+   * (indexed by [0 = DC, 1 = AC][table number][symbol]) before the optimal
+   * tables are generated.  This allows the caller to accumulate statistics
+   * across multiple images or image fragments.
+   */
+  long (*huff_counts)[NUM_HUFF_TBLS][257];
 };
 
 /* Marker writing */
@@ -249,8 +293,29 @@ struct jpeg_decomp_master {
 
   /* Last iMCU row that was successfully decoded */
   JDIMENSION last_good_iMCU_row;
+
+  /* Color matrix for YCbCr->RGB conversion (see jdcolor.c) */
+  J_COLOR_MATRIX color_matrix;
+
+  /* Decompression stages that selected a SIMD implementation (JSTAGE_*) */
+  unsigned int simd_stages;
+
+  /* Derived Huffman tables retained across images (see jdhuff.c) */
+  struct jpeg_d_derived_cache *huff_cache;
+
+  /* YCbCr-to-RGB conversion tables for 8-bit samples, retained across images
+     (see jdcolor.c and jdmerge.c) */
+  int *Cr_r_tab;
+  int *Cb_b_tab;
+  JLONG *Cr_g_tab;
+  JLONG *Cb_g_tab;
 };
 
+/* Bits in simd_stages */
+#define JSTAGE_IDCT      0x01   /* inverse DCT */
+#define JSTAGE_UPSAMPLE  0x02   /* upsampling (incl. merged upsampling) */
+#define JSTAGE_COLOR     0x04   /* color conversion */
+
 /* Input control module */
 struct jpeg_input_controller {
   int (*consume_input) (j_decompress_ptr cinfo);
@@ -513,6 +578,7 @@ EXTERN(void) j16init_lossless_compressor(j_compress_ptr cinfo);
 
 /* Decompression module initialization routines */
 EXTERN(void) jinit_master_decompress(j_decompress_ptr cinfo);
+EXTERN(void) jinit_master_rescale(j_decompress_ptr cinfo);
 EXTERN(void) jinit_d_main_controller(j_decompress_ptr cinfo,
                                      boolean need_full_buffer);
 EXTERN(void) j12init_d_main_controller(j_decompress_ptr cinfo,
@@ -561,8 +627,24 @@ EXTERN(void) j12init_lossless_decompressor(j_decompress_ptr cinfo);
 EXTERN(void) j16init_lossless_decompressor(j_decompress_ptr cinfo);
 #endif
 
-/* Memory manager initialization */
+/* Memory manager initialization and statistics */
 EXTERN(void) jinit_memory_mgr(j_common_ptr cinfo);
+EXTERN(size_t) jpeg_mem_peak(j_common_ptr cinfo, boolean reset);
+EXTERN(void) jpeg_mem_estimate(j_common_ptr cinfo);
+
+/* Application-supplied allocator for the image-lifetime pool (see
+ * jpeg_set_allocator() in jmemmgr.c).  large is TRUE for requests made on
+ * behalf of alloc_large, i.e. sample and coefficient buffers.
+ */
+struct jpeg_allocator {
+  void *(*get_mem) (void *opaque, size_t sizeofobject, boolean large);
+  void (*free_mem) (void *opaque, void *object, size_t sizeofobject,
+                    boolean large);
+  void *opaque;
+};
+
+EXTERN(void) jpeg_set_allocator(j_common_ptr cinfo,
+                                const struct jpeg_allocator *allocator);
 
 /* Utility routines in jutils.c */
 EXTERN(long) jdiv_round_up(long a, long b);
@@ -580,6 +662,8 @@ EXTERN(void) j16copy_sample_rows(J16SAMPARRAY input_array, int source_row,
 #endif
 EXTERN(void) jcopy_block_row(JBLOCKROW input_row, JBLOCKROW output_row,
                              JDIMENSION num_blocks);
+EXTERN(void) jpack_rgb565_row(JSAMPROW input_row, JSAMPROW output_row,
+                              JDIMENSION num_cols);
 EXTERN(void) jzero_far(void *target, size_t bytestozero);
 /* Constant tables in jutils.c */
 #if 0                           /* This table is not actually needed in v6a */
@@ -23,9 +23,14 @@ add_huff_table(j_common_ptr cinfo, JHUFF_TBL **htblptr, const UINT8 *bits,
 {
   int nsymbols, len;
 
+  /* The decompressor uses the standard tables only if the JPEG image does not
+   * define its own tables, but jpeg_set_defaults() must restore the standard
+   * tables even if the compressor has overwritten them (for instance, with
+   * optimal tables generated for a previous image.)
+   */
   if (*htblptr == NULL)
     *htblptr = jpeg_alloc_huff_table(cinfo);
-  else
+  else if (cinfo->is_decompressor)
     return;
 
   /* Copy the number-of-symbols-of-each-code-length counts */
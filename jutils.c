@@ -137,6 +137,30 @@ jcopy_block_row(JBLOCKROW input_row, JBLOCKROW output_row,
 }
 
 
+GLOBAL(void)
+jpack_rgb565_row(JSAMPROW input_row, JSAMPROW output_row, JDIMENSION num_cols)
+/* Pack a row of RGB pixels into 2-byte RGB565 pixels.  The input pixels use
+ * the default RGB layout (RGB_RED, RGB_GREEN, RGB_BLUE, and RGB_PIXELSIZE.)
+ * The RGB565 color converters always produce little-endian pixels in memory
+ * (PACK_SHORT_565_BE pre-swaps the bytes on big-endian hosts), so the output
+ * is assembled byte by byte, which also allows the compiler to vectorize the
+ * loop.  This lets SIMD YCbCr->RGB kernels be reused for RGB565 output on
+ * platforms that lack a dedicated RGB565 kernel.
+ */
+{
+  register JSAMPROW inptr = input_row, outptr = output_row;
+  register JDIMENSION col;
+  unsigned int r, g, b;
+
+  for (col = 0; col < num_cols; col++) {
+    r = inptr[RGB_RED];  g = inptr[RGB_GREEN];  b = inptr[RGB_BLUE];
+    outptr[0] = (JSAMPLE)(((g << 3) & 0xE0) | (b >> 3));
+    outptr[1] = (JSAMPLE)((r & 0xF8) | (g >> 5));
+    inptr += RGB_PIXELSIZE;  outptr += 2;
+  }
+}
+
+
 GLOBAL(void)
 jzero_far(void *target, size_t bytestozero)
 /* Zero out a chunk of memory. */
@@ -394,6 +394,231 @@ bailout:
 }
 
 
+static void multiQualTest(tjhandle handle, unsigned char *srcBuf, int w,
+                          int h, int pf, unsigned char *jpegBuf,
+                          size_t jpegSize)
+{
+  unsigned char *jpegBufs[3] = { NULL, NULL, NULL }, *refBuf = NULL;
+  size_t jpegSizes[3], refSize;
+  int i, qualities[3] = { 0, 75, 50 };
+  int jpegQual = tj3Get(handle, TJPARAM_QUALITY);
+  int subsamp = tj3Get(handle, TJPARAM_SUBSAMP);
+
+  qualities[0] = jpegQual;
+  for (i = 0; i < 3; i++) {
+    jpegSizes[i] = tj3JPEGBufSize(w, h, subsamp);
+    if ((jpegBufs[i] = (unsigned char *)tj3Alloc(jpegSizes[i])) == NULL)
+      THROW("Memory allocation failure");
+  }
+  refSize = tj3JPEGBufSize(w, h, subsamp);
+  if ((refBuf = (unsigned char *)tj3Alloc(refSize)) == NULL)
+    THROW("Memory allocation failure");
+
+  printf("%s %s -> %s Q%d/%d/%d (multi-quality) ... ", pixFormatStr[pf],
+         tj3Get(handle, TJPARAM_BOTTOMUP) ? "Bottom-Up" : "Top-Down ",
+         subNameLong[subsamp], qualities[0], qualities[1], qualities[2]);
+  TRY_TJ(handle, tj3CompressMulti8(handle, srcBuf, w, 0, h, pf, 3, qualities,
+                                   jpegBufs, jpegSizes));
+
+  /* The JPEG images must be identical to those produced by tj3Compress8(). */
+  if (jpegSizes[0] != jpegSize || memcmp(jpegBufs[0], jpegBuf, jpegSize)) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  for (i = 1; i < 3; i++) {
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, qualities[i]));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &refBuf,
+                                &refSize));
+    if (jpegSizes[i] != refSize || memcmp(jpegBufs[i], refBuf, refSize)) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Set(handle, TJPARAM_QUALITY, jpegQual);
+  for (i = 0; i < 3; i++) tj3Free(jpegBufs[i]);
+  tj3Free(refBuf);
+}
+
+
+static void targetSizeTest(tjhandle handle, unsigned char *srcBuf, int w,
+                           int h, int pf)
+{
+  unsigned char *jpegBuf = NULL, *refBuf = NULL;
+  size_t jpegSize, refSize, targetSize;
+  int q, jpegQual = tj3Get(handle, TJPARAM_QUALITY);
+  int subsamp = tj3Get(handle, TJPARAM_SUBSAMP);
+
+  jpegSize = refSize = tj3JPEGBufSize(w, h, subsamp);
+  if ((jpegBuf = (unsigned char *)tj3Alloc(jpegSize)) == NULL ||
+      (refBuf = (unsigned char *)tj3Alloc(refSize)) == NULL)
+    THROW("Memory allocation failure");
+
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 75));
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &refBuf,
+                              &refSize));
+  targetSize = refSize;
+
+  printf("%s %s -> %s %d bytes (target size) ... ", pixFormatStr[pf],
+         tj3Get(handle, TJPARAM_BOTTOMUP) ? "Bottom-Up" : "Top-Down ",
+         subNameLong[subsamp], (int)targetSize);
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 100));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_TARGETSIZE, (int)targetSize));
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                              &jpegSize));
+  if (jpegSize > targetSize) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+
+  /* The JPEG image must be identical to one produced by tj3Compress8() using
+     some quality level. */
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_TARGETSIZE, 0));
+  for (q = 100; q >= 1; q--) {
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, q));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &refBuf,
+                                &refSize));
+    if (refSize == jpegSize && !memcmp(refBuf, jpegBuf, jpegSize)) break;
+  }
+  if (q < 1) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+
+  /* An unattainable target size must produce a warning. */
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_TARGETSIZE, 1));
+  if (tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf, &jpegSize) == 0 ||
+      tj3GetErrorCode(handle) != TJERR_WARNING) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Set(handle, TJPARAM_TARGETSIZE, 0);
+  tj3Set(handle, TJPARAM_QUALITY, jpegQual);
+  tj3Free(jpegBuf);
+  tj3Free(refBuf);
+}
+
+
+static void chunkTest(tjhandle handle, void *srcBuf, int w, int h, int pf,
+                      unsigned char *jpegBuf, size_t jpegSize)
+{
+  const tjchunk *chunks = NULL;
+  size_t size = 0, offset = 0;
+  int i, numChunks = 0, chunkSize = 256;
+
+  printf("%s %s -> %d-byte chunks ... ", pixFormatStr[pf],
+         tj3Get(handle, TJPARAM_BOTTOMUP) ? "Bottom-Up" : "Top-Down ",
+         chunkSize);
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_CHUNKSIZE, chunkSize));
+  if (precision == 8) {
+    TRY_TJ(handle, tj3Compress8(handle, (unsigned char *)srcBuf, w, 0, h, pf,
+                                NULL, &size));
+  } else if (precision == 12) {
+    TRY_TJ(handle, tj3Compress12(handle, (short *)srcBuf, w, 0, h, pf, NULL,
+                                 &size));
+  } else {
+    TRY_TJ(handle, tj3Compress16(handle, (unsigned short *)srcBuf, w, 0, h,
+                                 pf, NULL, &size));
+  }
+  TRY_TJ(handle, tj3GetChunks(handle, &chunks, &numChunks));
+
+  /* The concatenated chunks must be identical to the JPEG image produced
+     without chunked output. */
+  if (size != jpegSize || numChunks != (int)((jpegSize + 255) / 256)) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  for (i = 0; i < numChunks; i++) {
+    if ((i < numChunks - 1 && chunks[i].size != (size_t)chunkSize) ||
+        offset + chunks[i].size > jpegSize ||
+        memcmp(chunks[i].buf, &jpegBuf[offset], chunks[i].size)) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+    offset += chunks[i].size;
+  }
+  if (offset != jpegSize) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Set(handle, TJPARAM_CHUNKSIZE, 0);
+}
+
+
+static void requantTest(tjhandle handle, unsigned char *srcBuf, int w, int h,
+                        int pf, unsigned char *jpegBuf, size_t jpegSize)
+{
+  tjhandle handle2 = NULL;
+  unsigned char *dstBufs[2] = { NULL, NULL }, *refBuf = NULL;
+  unsigned char *dstImg = NULL, *refImg = NULL;
+  size_t dstSizes[2] = { 0, 0 }, refSize, i, imgSize;
+  tjtransform xform[2];
+  int jpegQual = tj3Get(handle, TJPARAM_QUALITY);
+  int subsamp = tj3Get(handle, TJPARAM_SUBSAMP);
+  double diff = 0.;
+
+  memset(xform, 0, sizeof(tjtransform) * 2);
+  xform[0].op = xform[1].op = TJXOP_NONE;
+  xform[0].options = xform[1].options = TJXOPT_REQUANT;
+  imgSize = (size_t)w * h * tjPixelSize[pf];
+  refSize = tj3JPEGBufSize(w, h, subsamp);
+  if ((refBuf = (unsigned char *)tj3Alloc(refSize)) == NULL ||
+      (dstImg = (unsigned char *)malloc(imgSize)) == NULL ||
+      (refImg = (unsigned char *)malloc(imgSize)) == NULL)
+    THROW("Memory allocation failure");
+
+  printf("%s %s -> %s Q%d -> Q75 (requantization) ... ", pixFormatStr[pf],
+         tj3Get(handle, TJPARAM_BOTTOMUP) ? "Bottom-Up" : "Top-Down ",
+         subNameLong[subsamp], jpegQual);
+  if ((handle2 = tj3Init(TJINIT_TRANSFORM)) == NULL)
+    THROW_TJ(NULL);
+  TRY_TJ(handle2, tj3Set(handle2, TJPARAM_QUALITY, 75));
+  /* Requantizing twice from the same source coefficients must produce
+     identical JPEG images, which ensures that the source coefficients are
+     left intact. */
+  TRY_TJ(handle2, tj3Transform(handle2, jpegBuf, jpegSize, 2, dstBufs,
+                               dstSizes, xform));
+  if (dstSizes[0] >= jpegSize || dstSizes[0] != dstSizes[1] ||
+      memcmp(dstBufs[0], dstBufs[1], dstSizes[0])) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+
+  /* The requantized JPEG image must be close to the JPEG image produced by
+     recompressing the source image with the same quality level. */
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 75));
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &refBuf,
+                              &refSize));
+  TRY_TJ(handle2, tj3Decompress8(handle2, dstBufs[0], dstSizes[0], dstImg, 0,
+                                 pf));
+  TRY_TJ(handle2, tj3Decompress8(handle2, refBuf, refSize, refImg, 0, pf));
+  for (i = 0; i < imgSize; i++)
+    diff += abs((int)dstImg[i] - (int)refImg[i]);
+  if (diff / (double)imgSize > 2.) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Set(handle, TJPARAM_QUALITY, jpegQual);
+  tj3Destroy(handle2);
+  tj3Free(dstBufs[0]);
+  tj3Free(dstBufs[1]);
+  tj3Free(refBuf);
+  free(dstImg);
+  free(refImg);
+}
+
+
 static void compTest(tjhandle handle, unsigned char **dstBuf, size_t *dstSize,
                      int w, int h, int pf, char *basename)
 {
@@ -466,6 +691,28 @@ static void compTest(tjhandle handle, unsigned char **dstBuf, size_t *dstSize,
   writeJPEG(*dstBuf, *dstSize, tempStr);
   printf("Done.\n  Result in %s\n", tempStr);
 
+  if (!doYUV)
+    chunkTest(handle, srcBuf, w, h, pf, *dstBuf, *dstSize);
+  if (!doYUV && precision == 8) {
+    size_t estSize = 0;
+
+    /* The test images are small enough that the estimate must be exact. */
+    printf("%s %s -> size estimate ... ", pfStr, buStrLong);
+    TRY_TJ(handle, tj3EstimateJPEGSize8(handle, (unsigned char *)srcBuf, w, 0,
+                                        h, pf, &estSize));
+    if (estSize != *dstSize) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+    printf("Passed.\n");
+  }
+  if (!doYUV && !lossless && precision == 8) {
+    multiQualTest(handle, (unsigned char *)srcBuf, w, h, pf, *dstBuf,
+                  *dstSize);
+    targetSizeTest(handle, (unsigned char *)srcBuf, w, h, pf);
+    requantTest(handle, (unsigned char *)srcBuf, w, h, pf, *dstBuf, *dstSize);
+  }
+
 bailout:
   free(yuvBuf);
   free(srcBuf);
@@ -559,12 +806,52 @@ bailout:
 }
 
 
+static void pyramidTest(tjhandle handle, unsigned char *jpegBuf,
+                        size_t jpegSize, int w, int h, int pf, int subsamp,
+                        tjscalingfactor *sf, int n)
+{
+  void *dstBufs[16];
+  int i, bottomUp = tj3Get(handle, TJPARAM_BOTTOMUP);
+
+  memset(dstBufs, 0, sizeof(dstBufs));
+  for (i = 0; i < n; i++) {
+    size_t dstSize = TJSCALED(w, sf[i]) * TJSCALED(h, sf[i]) * tjPixelSize[pf];
+
+    if ((dstBufs[i] = malloc(dstSize * sampleSize)) == NULL)
+      THROW("Memory allocation failure");
+    memset(dstBufs[i], 0, dstSize * sampleSize);
+  }
+
+  printf("JPEG -> %s %s %d scaling factors ... ", pixFormatStr[pf],
+         bottomUp ? "Bottom-Up" : "Top-Down ", n);
+  if (precision == 8) {
+    TRY_TJ(handle, tj3DecompressPyramid8(handle, jpegBuf, jpegSize, n, sf,
+                                         (unsigned char **)dstBufs, NULL, pf));
+  } else {
+    TRY_TJ(handle, tj3DecompressPyramid12(handle, jpegBuf, jpegSize, n, sf,
+                                          (short **)dstBufs, NULL, pf));
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!checkBuf(dstBufs[i], TJSCALED(w, sf[i]), TJSCALED(h, sf[i]), pf,
+                  subsamp, sf[i], bottomUp)) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+  }
+  printf("Passed.\n");
+
+bailout:
+  for (i = 0; i < n; i++) free(dstBufs[i]);
+}
+
+
 static void decompTest(tjhandle handle, unsigned char *jpegBuf,
                        size_t jpegSize, int w, int h, int pf, char *basename,
                        int subsamp)
 {
-  int i, n = 0;
-  tjscalingfactor *sf = NULL;
+  int i, n = 0, npyr = 0;
+  tjscalingfactor *sf = NULL, pyrsf[16];
 
   if (lossless) {
     _decompTest(handle, jpegBuf, jpegSize, w, h, pf, basename, subsamp,
@@ -580,11 +867,16 @@ static void decompTest(tjhandle handle, unsigned char *jpegBuf,
         ((subsamp == TJSAMP_411 || subsamp == TJSAMP_441) && sf[i].num == 1 &&
          (sf[i].denom == 2 || sf[i].denom == 1)) ||
         (subsamp != TJSAMP_411 && subsamp != TJSAMP_441 && sf[i].num == 1 &&
-         (sf[i].denom == 4 || sf[i].denom == 2 || sf[i].denom == 1)))
+         (sf[i].denom == 4 || sf[i].denom == 2 || sf[i].denom == 1))) {
       _decompTest(handle, jpegBuf, jpegSize, w, h, pf, basename, subsamp,
                   sf[i]);
+      if (npyr < 16 && sf[i].num <= sf[i].denom) pyrsf[npyr++] = sf[i];
+    }
   }
 
+  if (!doYUV && npyr > 1)
+    pyramidTest(handle, jpegBuf, jpegSize, w, h, pf, subsamp, pyrsf, npyr);
+
 bailout:
   return;
 }
@@ -717,6 +1009,969 @@ bailout:
 }
 
 
+static void sampledHuffTest(tjhandle handle, tjhandle handle2,
+                            unsigned char *srcBuf, int w, int h, int pf)
+{
+  unsigned char *dstBuf = NULL, *refDstBuf = NULL, *jpegBuf = NULL;
+  size_t jpegSize = 0, defaultSize = 0;
+  int i;
+  const int subsamps[3] = { TJSAMP_444, TJSAMP_420, TJSAMP_GRAY };
+
+  if ((dstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL ||
+      (refDstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL)
+    THROW("Memory allocation failure");
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 100));
+
+  for (i = 0; i < 3; i++) {
+    printf("%s Top-Down  -> %s Q100 (sampled Huffman tables) ... ",
+           pixFormatStr[pf], subNameLong[subsamps[i]]);
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, subsamps[i]));
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_OPTIMIZE, 0));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                                &defaultSize));
+    TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, defaultSize, refDstBuf,
+                                   0, pf));
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_OPTIMIZE, 2));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                                &jpegSize));
+    TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf, 0,
+                                   pf));
+
+    /* The top of the test image contains symbols that do not occur in the
+       sampled rows, so this also verifies that the sampled Huffman tables can
+       encode any symbol.  Huffman coding is lossless, so the decompressed
+       image must be identical to the one compressed using the default Huffman
+       tables, and the JPEG image must be no more than slightly larger. */
+    if (memcmp(dstBuf, refDstBuf, w * h * tjPixelSize[pf]) ||
+        jpegSize * 20 > defaultSize * 21) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+    printf("Passed.\n");
+  }
+
+bailout:
+  tj3Set(handle, TJPARAM_OPTIMIZE, 0);
+  tj3Free(jpegBuf);
+  free(dstBuf);
+  free(refDstBuf);
+}
+
+
+static void trainedHuffTest(tjhandle handle, tjhandle handle3,
+                            unsigned char *srcBuf, int w, int h, int pf)
+{
+  tjhandle handle2 = NULL;
+  unsigned char *dstBuf = NULL, *refDstBuf = NULL, *jpegBuf = NULL,
+    *refBuf = NULL, *tables = NULL, *tables2 = NULL;
+  size_t jpegSize = 0, refSize = 0, optSize = 0, tablesSize = 0,
+    tablesSize2 = 0;
+
+  if ((handle2 = tj3Init(TJINIT_COMPRESS)) == NULL)
+    THROW_TJ(NULL);
+  if ((dstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL ||
+      (refDstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL)
+    THROW("Memory allocation failure");
+
+  printf("%s Top-Down  -> %s Q95 (trained Huffman tables) ... ",
+         pixFormatStr[pf], subNameLong[TJSAMP_420]);
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 95));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, TJSAMP_420));
+  TRY_TJ(handle2, tj3Set(handle2, TJPARAM_QUALITY, 95));
+  TRY_TJ(handle2, tj3Set(handle2, TJPARAM_SUBSAMP, TJSAMP_420));
+
+  /* Train the tables on the bottom half of the image, which lacks some of
+     the symbols in the top half. */
+  TRY_TJ(handle, tj3TrainHuffmanTables8(handle, &srcBuf[w * tjPixelSize[pf] *
+                                                        h / 2],
+                                        w, 0, h / 2, pf));
+  TRY_TJ(handle, tj3GetHuffmanTables(handle, &tables, &tablesSize));
+  /* The statistics must have been reset, and truncated tables must be
+     rejected. */
+  if (tj3GetHuffmanTables(handle, &tables2, &tablesSize2) != -1) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  if (tj3SetHuffmanTables(handle2, tables, tablesSize - 1) != -1) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  TRY_TJ(handle2, tj3SetHuffmanTables(handle2, tables, tablesSize));
+
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &refBuf, &refSize));
+  TRY_TJ(handle3, tj3Decompress8(handle3, refBuf, refSize, refDstBuf, 0, pf));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_OPTIMIZE, 1));
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &refBuf, &optSize));
+  TRY_TJ(handle2, tj3Compress8(handle2, srcBuf, w, 0, h, pf, &jpegBuf,
+                               &jpegSize));
+  TRY_TJ(handle3, tj3Decompress8(handle3, jpegBuf, jpegSize, dstBuf, 0, pf));
+
+  /* Huffman coding is lossless, so the decompressed image must be identical
+     to the one compressed using the default Huffman tables.  The JPEG image
+     must be smaller than that one and within 20% of the size of one
+     compressed using optimal Huffman tables.  (The trained tables include
+     every symbol, so their size has a proportionally large effect on an image
+     this small.) */
+  if (memcmp(dstBuf, refDstBuf, w * h * tjPixelSize[pf]) ||
+      jpegSize >= refSize || jpegSize * 5 > optSize * 6) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+
+  /* Unloading the tables must restore the default Huffman tables. */
+  TRY_TJ(handle2, tj3SetHuffmanTables(handle2, NULL, 0));
+  TRY_TJ(handle2, tj3Compress8(handle2, srcBuf, w, 0, h, pf, &jpegBuf,
+                               &jpegSize));
+  if (jpegSize != refSize) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Set(handle, TJPARAM_OPTIMIZE, 0);
+  tj3Free(jpegBuf);
+  tj3Free(refBuf);
+  tj3Free(tables);
+  tj3Free(tables2);
+  free(dstBuf);
+  free(refDstBuf);
+  tj3Destroy(handle2);
+}
+
+
+static void statsTest(tjhandle handle, tjhandle handle2,
+                      unsigned char *srcBuf, int w, int h, int pf)
+{
+  tjhandle handle3 = NULL;
+  unsigned char *dstBuf = NULL, *jpegBuf = NULL, *dstJPEGBuf = NULL;
+  size_t jpegSize = 0, dstJPEGSize = 0, memSize = 0, xformMemSize = 0;
+  int progressive, i;
+  tjstats stats;
+  tjtransform xform;
+
+  if ((handle3 = tj3Init(TJINIT_TRANSFORM)) == NULL)
+    THROW_TJ(NULL);
+  if ((dstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL)
+    THROW("Memory allocation failure");
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 95));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, TJSAMP_420));
+
+  /* Statistics cannot be retrieved unless they are being collected. */
+  if (tj3GetStats(handle2, &stats) != -1) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  TRY_TJ(handle2, tj3Set(handle2, TJPARAM_STATS, 1));
+  TRY_TJ(handle3, tj3Set(handle3, TJPARAM_STATS, 1));
+  memset(&xform, 0, sizeof(tjtransform));
+  xform.op = TJXOP_ROT90;
+
+  for (progressive = 0; progressive <= 1; progressive++) {
+    unsigned long long stagesNs = 0;
+
+    printf("%s %s -> %s (statistics and memory estimate) ... ",
+           progressive ? "Progressive" : "Baseline   ", subNameLong[TJSAMP_420],
+           pixFormatStr[pf]);
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_PROGRESSIVE, progressive));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                                &jpegSize));
+    TRY_TJ(handle2, tj3EstimateMemory(handle2, jpegBuf, jpegSize, pf, NULL,
+                                      &memSize));
+    TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf, 0,
+                                   pf));
+    TRY_TJ(handle2, tj3GetStats(handle2, &stats));
+
+    /* A baseline 4:2:0 image has one scan and six blocks per 16x16 MCU.  The
+       entire image must have been read, and the stages must account for the
+       total time. */
+    for (i = 0; i < TJ_NUMSTAGES; i++) stagesNs += stats.stageNs[i];
+    if (stats.bytesConsumed != jpegSize || stats.peakMemory == 0 ||
+        stagesNs != stats.totalNs || stats.stageNs[TJSTAGE_ENTROPY] == 0 ||
+        (progressive ? stats.scans <= 1 || stats.mcus <= w * h / 256 :
+         stats.scans != 1 || stats.mcus != w * h / 256 ||
+         stats.blocks != stats.mcus * 6)) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+
+    /* The memory estimate must match the peak memory usage of the libjpeg
+       memory manager plus the row pointers. */
+    if (memSize != stats.peakMemory + h * sizeof(unsigned char *)) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+    TRY_TJ(handle3, tj3EstimateMemory(handle3, jpegBuf, jpegSize, pf, &xform,
+                                      &xformMemSize));
+    TRY_TJ(handle3, tj3Transform(handle3, jpegBuf, jpegSize, 1, &dstJPEGBuf,
+                                 &dstJPEGSize, &xform));
+    TRY_TJ(handle3, tj3GetStats(handle3, &stats));
+    if (xformMemSize != stats.peakMemory) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+    printf("Passed.\n");
+  }
+
+bailout:
+  tj3Set(handle, TJPARAM_PROGRESSIVE, 0);
+  tj3Set(handle2, TJPARAM_STATS, 0);
+  tj3Free(jpegBuf);
+  tj3Free(dstJPEGBuf);
+  free(dstBuf);
+  tj3Destroy(handle3);
+}
+
+
+static void tableCacheTest(tjhandle handle, tjhandle handle2,
+                           unsigned char *srcBuf, int w, int h, int pf)
+{
+  tjhandle handle3 = NULL;
+  unsigned char *dstBuf = NULL, *dstBuf2 = NULL, *jpegBuf = NULL,
+    *jpegBuf2 = NULL;
+  size_t jpegSize = 0, jpegSize2 = 0;
+  int i;
+  /* More quality levels than the divisor cache can hold, so that entries are
+     replaced and reused */
+  static const int qualities[] = { 50, 90, 50, 75, 90, 20, 95, 60, 50, 100 };
+  static const int subsamps[] = { TJSAMP_420, TJSAMP_444, TJSAMP_GRAY };
+
+  if ((dstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL ||
+      (dstBuf2 = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL)
+    THROW("Memory allocation failure");
+
+  printf("Derived table cache ... ");
+  /* Compressing and decompressing a series of images with a reused instance,
+     which reuses the cached derived tables, must produce the same results as
+     using a new instance for each image. */
+  for (i = 0; i < (int)(sizeof(qualities) / sizeof(int)); i++) {
+    int subsamp = subsamps[i % 3], fastDCT = (i / 3) % 2;
+
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, qualities[i]));
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, subsamp));
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_FASTDCT, fastDCT));
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_OPTIMIZE, i % 2));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                                &jpegSize));
+    TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf, 0,
+                                   pf));
+
+    if ((handle3 = tj3Init(TJINIT_COMPRESS)) == NULL)
+      THROW_TJ(NULL);
+    TRY_TJ(handle3, tj3Set(handle3, TJPARAM_QUALITY, qualities[i]));
+    TRY_TJ(handle3, tj3Set(handle3, TJPARAM_SUBSAMP, subsamp));
+    TRY_TJ(handle3, tj3Set(handle3, TJPARAM_FASTDCT, fastDCT));
+    TRY_TJ(handle3, tj3Set(handle3, TJPARAM_OPTIMIZE, i % 2));
+    TRY_TJ(handle3, tj3Compress8(handle3, srcBuf, w, 0, h, pf, &jpegBuf2,
+                                 &jpegSize2));
+    tj3Destroy(handle3);
+    if ((handle3 = tj3Init(TJINIT_DECOMPRESS)) == NULL)
+      THROW_TJ(NULL);
+    TRY_TJ(handle3, tj3Decompress8(handle3, jpegBuf2, jpegSize2, dstBuf2, 0,
+                                   pf));
+    tj3Destroy(handle3);  handle3 = NULL;
+
+    if (jpegSize != jpegSize2 || memcmp(jpegBuf, jpegBuf2, jpegSize) ||
+        memcmp(dstBuf, dstBuf2, w * h * tjPixelSize[pf])) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Set(handle, TJPARAM_FASTDCT, 0);
+  tj3Set(handle, TJPARAM_OPTIMIZE, 0);
+  tj3Free(jpegBuf);
+  tj3Free(jpegBuf2);
+  free(dstBuf);
+  free(dstBuf2);
+  tj3Destroy(handle3);
+}
+
+
+static float halfToFloat(unsigned short h)
+{
+  int exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF;
+  float val;
+
+  if (exponent == 0) {
+    val = (float)mantissa;  exponent = 1;
+  } else
+    val = (float)(mantissa + 1024);
+  for (; exponent < 25; exponent++) val /= 2.0f;
+  for (; exponent > 25; exponent--) val *= 2.0f;
+  return (h & 0x8000) ? -val : val;
+}
+
+static void tensorTest(tjhandle handle, tjhandle handle2)
+{
+  unsigned char *srcBuf = NULL, *dstBuf = NULL, *jpegBuf = NULL;
+  void *tensorBuf = NULL;
+  size_t jpegSize = 0;
+  int w = 48, h = 48, cw = 16, ch = 17, i, j, c;
+  tjscalingfactor sf = { 1, 2 };
+  tjregion cr = { 8, 3, 16, 17 };
+  static const int pfs[] = { TJPF_RGB, TJPF_BGR, TJPF_GRAY, TJPF_CMYK };
+  static const char *typeStr[TJ_NUMTT] = { "FLOAT32", "FLOAT16", "INT8" };
+
+  if ((srcBuf = (unsigned char *)malloc(w * h * 4)) == NULL ||
+      (dstBuf = (unsigned char *)malloc(cw * ch * 4)) == NULL ||
+      (tensorBuf = malloc(cw * ch * 4 * sizeof(float))) == NULL)
+    THROW("Memory allocation failure");
+
+  for (i = 0; i < (int)(sizeof(pfs) / sizeof(int)); i++) {
+    int pf = pfs[i], nc = tjPixelSize[pf], type, planar;
+
+    initBuf(srcBuf, w, h, pf, 0);
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 95));
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP,
+                          pf == TJPF_GRAY ? TJSAMP_GRAY : TJSAMP_420));
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                                &jpegSize));
+
+    for (type = 0; type < TJ_NUMTT; type++) {
+      for (planar = 0; planar <= 1; planar++) {
+        tjtensor tensor;
+        int bottomUp = (type + planar) % 2;
+
+        printf("JPEG -> %s %s tensor %s %s ... ", pixFormatStr[pf],
+               typeStr[type], planar ? "CHW" : "HWC",
+               bottomUp ? "Bottom-Up" : "Top-Down ");
+        memset(&tensor, 0, sizeof(tjtensor));
+        tensor.type = type;
+        tensor.planar = planar;
+        for (c = 0; c < nc; c++) {
+          if (type == TJTT_INT8) {
+            tensor.scale[c] = 1.0f;  tensor.bias[c] = -128.0f + c;
+          } else {
+            tensor.scale[c] = 1.0f / (255.0f * (0.2f + 0.01f * c));
+            tensor.bias[c] = -(0.4f + 0.02f * c) / (0.2f + 0.01f * c);
+          }
+        }
+
+        /* The tensor must contain the same samples as the scaled and cropped
+           packed-pixel image. */
+        TRY_TJ(handle2, tj3Set(handle2, TJPARAM_BOTTOMUP, bottomUp));
+        TRY_TJ(handle2, tj3DecompressHeader(handle2, jpegBuf, jpegSize));
+        TRY_TJ(handle2, tj3SetScalingFactor(handle2, sf));
+        TRY_TJ(handle2, tj3SetCroppingRegion(handle2, cr));
+        TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf, 0,
+                                       pf));
+        TRY_TJ(handle2, tj3DecompressToTensor8(handle2, jpegBuf, jpegSize,
+                                               tensorBuf, pf, &tensor));
+
+        for (j = 0; j < cw * ch; j++) {
+          for (c = 0; c < nc; c++) {
+            int index = planar ? c * cw * ch + j : j * nc + c;
+            float ref = (float)dstBuf[j * nc + c] * tensor.scale[c] +
+                        tensor.bias[c], val, err;
+
+            if (type == TJTT_FLOAT32)
+              val = ((float *)tensorBuf)[index];
+            else if (type == TJTT_FLOAT16)
+              val = halfToFloat(((unsigned short *)tensorBuf)[index]);
+            else {
+              val = ((signed char *)tensorBuf)[index];
+              if (ref > 127.0f) ref = 127.0f;
+            }
+            err = val > ref ? val - ref : ref - val;
+            if (err > (type == TJTT_FLOAT16 ? 0.01f : 0.0001f)) {
+              printf("FAILED!\n  Element %d = %f, should be %f\n", index,
+                     val, ref);
+              BAILOUT()
+            }
+          }
+        }
+        printf("Passed.\n");
+      }
+    }
+  }
+
+bailout:
+  tj3Set(handle2, TJPARAM_BOTTOMUP, 0);
+  tj3SetScalingFactor(handle2, TJUNSCALED);
+  tj3SetCroppingRegion(handle2, TJUNCROPPED);
+  tj3Free(jpegBuf);
+  free(srcBuf);
+  free(dstBuf);
+  free(tensorBuf);
+}
+
+
+static void semiPlanarTest(tjhandle handle, tjhandle handle2)
+{
+  unsigned char *planes[3] = { NULL, NULL, NULL },
+    *spPlanes[2] = { NULL, NULL }, *jpegBuf = NULL, *jpegBuf2 = NULL;
+  unsigned short *p010Planes[2] = { NULL, NULL },
+    *p010Planes2[2] = { NULL, NULL };
+  size_t jpegSize = 0, jpegSize2 = 0, planeSize;
+  int w = 35, h = 39, i, j, k, s, uvOrder, strides[2];
+  static const int subsamps[] = {
+    TJSAMP_444, TJSAMP_422, TJSAMP_420, TJSAMP_440
+  };
+  tjscalingfactor sf[2] = { { 1, 1 }, { 1, 2 } };
+
+  /* Large enough for any plane, with row padding */
+  planeSize = (w + 16) * 2 * (h + 16);
+  for (i = 0; i < 3; i++) {
+    if ((planes[i] = (unsigned char *)malloc(planeSize)) == NULL)
+      THROW("Memory allocation failure");
+  }
+  for (i = 0; i < 2; i++) {
+    if ((spPlanes[i] = (unsigned char *)malloc(planeSize)) == NULL ||
+        (p010Planes[i] =
+         (unsigned short *)malloc(planeSize * sizeof(short))) == NULL ||
+        (p010Planes2[i] =
+         (unsigned short *)malloc(planeSize * sizeof(short))) == NULL)
+      THROW("Memory allocation failure");
+  }
+
+  for (s = 0; s < (int)(sizeof(subsamps) / sizeof(int)); s++) {
+    int subsamp = subsamps[s];
+
+    for (uvOrder = 0; uvOrder < TJ_NUMUV; uvOrder++) {
+      int yw = tj3YUVPlaneWidth(0, w, subsamp),
+        yh = tj3YUVPlaneHeight(0, h, subsamp),
+        cw = tj3YUVPlaneWidth(1, w, subsamp),
+        ch = tj3YUVPlaneHeight(1, h, subsamp);
+      int cb = uvOrder == TJUV_CBCR ? 0 : 1, cr = 1 - cb;
+
+      printf("%s semi-planar %s <-> JPEG ... ", subNameLong[subsamp],
+             uvOrder == TJUV_CBCR ? "CbCr" : "CrCb");
+
+      /* Compressing a semi-planar image must produce the same JPEG image as
+         compressing the equivalent planar image. */
+      strides[0] = yw + 3;
+      strides[1] = cw * 2 + 5;
+      for (j = 0; j < yh; j++) {
+        for (k = 0; k < yw; k++)
+          planes[0][j * yw + k] = spPlanes[0][j * strides[0] + k] =
+            (unsigned char)(j * 7 + k * 3);
+      }
+      for (j = 0; j < ch; j++) {
+        for (k = 0; k < cw; k++) {
+          planes[1][j * cw + k] = spPlanes[1][j * strides[1] + k * 2 + cb] =
+            (unsigned char)(128 + j * 2 - k);
+          planes[2][j * cw + k] = spPlanes[1][j * strides[1] + k * 2 + cr] =
+            (unsigned char)(128 - j + k * 2);
+        }
+      }
+      TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 90));
+      TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, subsamp));
+      TRY_TJ(handle, tj3CompressFromYUVPlanes8(handle,
+               (const unsigned char **)planes, w, NULL, h, &jpegBuf,
+               &jpegSize));
+      TRY_TJ(handle, tj3CompressFromSemiPlanar8(handle,
+               (const unsigned char **)spPlanes, w, strides, h, uvOrder,
+               &jpegBuf2, &jpegSize2));
+      if (jpegSize != jpegSize2 || memcmp(jpegBuf, jpegBuf2, jpegSize)) {
+        printf("FAILED!\n  Compressed images do not match\n");
+        BAILOUT()
+      }
+
+      /* Decompressing into a semi-planar image must produce the same samples
+         as decompressing into a planar image. */
+      for (i = 0; i < 2; i++) {
+        int sw = TJSCALED(w, sf[i]), sh = TJSCALED(h, sf[i]);
+        int syw = tj3YUVPlaneWidth(0, sw, subsamp),
+          syh = tj3YUVPlaneHeight(0, sh, subsamp),
+          scw = tj3YUVPlaneWidth(1, sw, subsamp),
+          sch = tj3YUVPlaneHeight(1, sh, subsamp);
+
+        TRY_TJ(handle2, tj3SetScalingFactor(handle2, sf[i]));
+        TRY_TJ(handle2, tj3DecompressToYUVPlanes8(handle2, jpegBuf, jpegSize,
+                                                  planes, NULL));
+        TRY_TJ(handle2, tj3DecompressToSemiPlanar8(handle2, jpegBuf, jpegSize,
+                                                   spPlanes, strides,
+                                                   uvOrder));
+        for (j = 0; j < syh; j++) {
+          if (memcmp(&planes[0][j * syw], &spPlanes[0][j * strides[0]],
+                     syw)) {
+            printf("FAILED!\n  Y plane does not match (%d/%d)\n", sf[i].num,
+                   sf[i].denom);
+            BAILOUT()
+          }
+        }
+        for (j = 0; j < sch; j++) {
+          for (k = 0; k < scw; k++) {
+            if (planes[1][j * scw + k] !=
+                spPlanes[1][j * strides[1] + k * 2 + cb] ||
+                planes[2][j * scw + k] !=
+                spPlanes[1][j * strides[1] + k * 2 + cr]) {
+              printf("FAILED!\n  Chrominance plane does not match (%d/%d)\n",
+                     sf[i].num, sf[i].denom);
+              BAILOUT()
+            }
+          }
+        }
+      }
+      TRY_TJ(handle2, tj3SetScalingFactor(handle2, sf[0]));
+
+      /* A 10-bit-per-sample (P010) image must survive a round trip through
+         12-bit-per-sample JPEG compression at quality 100 with only rounding
+         error. */
+      for (i = 0; i < 2; i++) {
+        for (j = 0; j < (i ? ch : yh); j++) {
+          for (k = 0; k < (i ? cw * 2 : yw); k++)
+            p010Planes[i][j * strides[i] + k] =
+              (unsigned short)((i ? 512 + j * 4 - k * 3 :
+                                (j * 13 + k * 5) & 1023) << 6);
+        }
+      }
+      TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 100));
+      TRY_TJ(handle, tj3CompressFromSemiPlanar12(handle,
+               (const unsigned short **)p010Planes, w, strides, h, uvOrder,
+               &jpegBuf2, &jpegSize2));
+      TRY_TJ(handle2, tj3DecompressToSemiPlanar12(handle2, jpegBuf2,
+                                                  jpegSize2, p010Planes2,
+                                                  strides, uvOrder));
+      for (i = 0; i < 2; i++) {
+        for (j = 0; j < (i ? ch : yh); j++) {
+          for (k = 0; k < (i ? cw * 2 : yw); k++) {
+            int diff = (int)p010Planes2[i][j * strides[i] + k] -
+                       (int)p010Planes[i][j * strides[i] + k];
+
+            if (diff < -64 || diff > 64) {
+              printf("FAILED!\n  P010 plane %d does not match\n", i);
+              BAILOUT()
+            }
+          }
+        }
+      }
+      printf("Passed.\n");
+    }
+  }
+
+bailout:
+  tj3Free(jpegBuf);
+  tj3Free(jpegBuf2);
+  for (i = 0; i < 3; i++) free(planes[i]);
+  for (i = 0; i < 2; i++) {
+    free(spPlanes[i]);
+    free(p010Planes[i]);
+    free(p010Planes2[i]);
+  }
+  tj3SetScalingFactor(handle2, TJUNSCALED);
+}
+
+
+/* Compute the YCbCr value of an RGB pixel (or vice versa) using the given
+   color matrix and floating-point arithmetic */
+static void matrixYCC(int cm, double r, double g, double b, double *y,
+                      double *cb, double *cr)
+{
+  double kr = cm >= TJCM_BT709 ? 0.2126 : 0.299,
+    kb = cm >= TJCM_BT709 ? 0.0722 : 0.114, yf;
+  int limited = (cm == TJCM_BT601_LIMITED || cm == TJCM_BT709_LIMITED);
+
+  yf = kr * r + (1.0 - kr - kb) * g + kb * b;
+  *y = limited ? 16. + yf * 219. / 255. : yf;
+  *cb = 128. + (b - yf) / (2. * (1. - kb)) * (limited ? 224. / 255. : 1.);
+  *cr = 128. + (r - yf) / (2. * (1. - kr)) * (limited ? 224. / 255. : 1.);
+}
+
+static void matrixRGB(int cm, double y, double cb, double cr, double *r,
+                      double *g, double *b)
+{
+  double kr = cm >= TJCM_BT709 ? 0.2126 : 0.299,
+    kb = cm >= TJCM_BT709 ? 0.0722 : 0.114, kg = 1.0 - kr - kb;
+  int limited = (cm == TJCM_BT601_LIMITED || cm == TJCM_BT709_LIMITED);
+
+  if (limited) {
+    y = (y - 16.) * 255. / 219.;
+    cb = (cb - 128.) * 255. / 224.;
+    cr = (cr - 128.) * 255. / 224.;
+  } else {
+    cb -= 128.;  cr -= 128.;
+  }
+  *r = y + 2. * (1. - kr) * cr;
+  *g = y - 2. * (1. - kb) * kb / kg * cb - 2. * (1. - kr) * kr / kg * cr;
+  *b = y + 2. * (1. - kb) * cb;
+}
+
+static int sampleMatches(int sample, double ref, double tolerance)
+{
+  if (ref < 0.) ref = 0.;
+  if (ref > 255.) ref = 255.;
+  return sample >= ref - tolerance && sample <= ref + tolerance;
+}
+
+static void colorMatrixTest(tjhandle handle, tjhandle handle2)
+{
+  static const char *cmName[TJ_NUMCM] = {
+    "BT.601", "BT.601 limited", "BT.709", "BT.709 limited"
+  };
+  static const int pixelFormats[3] = { TJPF_RGB, TJPF_BGRA, TJPF_ARGB };
+  unsigned char *srcBuf = NULL, *whiteBuf = NULL, *yuvBuf = NULL,
+    *dstBuf = NULL, *jpegBuf = NULL;
+  size_t jpegSize = 0;
+  int w = 48, h = 16, n = w * h, cm, i, p;
+  double y, cb, cr, r, g, b;
+
+  if ((srcBuf = (unsigned char *)malloc(n * 3)) == NULL ||
+      (whiteBuf = (unsigned char *)malloc(n * 3)) == NULL ||
+      (yuvBuf = (unsigned char *)malloc(n * 3)) == NULL ||
+      (dstBuf = (unsigned char *)malloc(n * 4)) == NULL)
+    THROW("Memory allocation failure");
+  for (i = 0; i < n; i++) {
+    srcBuf[i * 3] = (unsigned char)(i * 37);
+    srcBuf[i * 3 + 1] = (unsigned char)(i * 11 + 50);
+    srcBuf[i * 3 + 2] = (unsigned char)(255 - i * 5);
+  }
+  /* Include pure black, white, and primaries */
+  memcpy(srcBuf, "\0\0\0\377\377\377\377\0\0\0\377\0\0\0\377", 15);
+  memset(whiteBuf, 255, n * 3);
+
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, TJSAMP_444));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 100));
+  TRY_TJ(handle2, tj3Set(handle2, TJPARAM_SUBSAMP, TJSAMP_444));
+  for (cm = 0; cm < TJ_NUMCM; cm++) {
+    printf("Color matrix %-14s ... ", cmName[cm]);
+    TRY_TJ(handle, tj3Set(handle, TJPARAM_COLORMATRIX, cm));
+    TRY_TJ(handle2, tj3Set(handle2, TJPARAM_COLORMATRIX, cm));
+    if (tj3Get(handle, TJPARAM_COLORMATRIX) != cm) {
+      printf("FAILED!\n  tj3Get() returned the wrong value\n");
+      BAILOUT()
+    }
+
+    /* RGB->YCbCr conversion must match the floating-point reference. */
+    TRY_TJ(handle, tj3EncodeYUV8(handle, srcBuf, w, 0, h, TJPF_RGB, yuvBuf,
+                                 1));
+    for (i = 0; i < n; i++) {
+      matrixYCC(cm, srcBuf[i * 3], srcBuf[i * 3 + 1], srcBuf[i * 3 + 2], &y,
+                &cb, &cr);
+      if (!sampleMatches(yuvBuf[i], y, 0.51) ||
+          !sampleMatches(yuvBuf[n + i], cb, 0.51) ||
+          !sampleMatches(yuvBuf[n * 2 + i], cr, 0.51)) {
+        printf("FAILED!\n  RGB->YCbCr mismatch at pixel %d: %d,%d,%d != %f,%f,%f\n",
+               i, yuvBuf[i], yuvBuf[n + i], yuvBuf[n * 2 + i], y, cb, cr);
+        BAILOUT()
+      }
+    }
+
+    /* YCbCr->RGB conversion must match the floating-point reference, and the
+       unused byte of 4-byte pixels must be opaque. */
+    for (p = 0; p < 3; p++) {
+      int pf = pixelFormats[p], ps = tjPixelSize[pf];
+
+      TRY_TJ(handle2, tj3DecodeYUV8(handle2, yuvBuf, 1, dstBuf, w, 0, h, pf));
+      for (i = 0; i < n; i++) {
+        unsigned char *pixel = &dstBuf[i * ps];
+
+        matrixRGB(cm, yuvBuf[i], yuvBuf[n + i], yuvBuf[n * 2 + i], &r, &g,
+                  &b);
+        if (!sampleMatches(pixel[tjRedOffset[pf]], r, 1.01) ||
+            !sampleMatches(pixel[tjGreenOffset[pf]], g, 1.01) ||
+            !sampleMatches(pixel[tjBlueOffset[pf]], b, 1.01) ||
+            (ps == 4 && pixel[tjAlphaOffset[pf]] != 255)) {
+          printf("FAILED!\n  YCbCr->%s mismatch at pixel %d\n",
+                 pixFormatStr[pf], i);
+          BAILOUT()
+        }
+      }
+    }
+
+    /* YCbCr->grayscale conversion must expand limited-range luminance to the
+       full range, as YCbCr->RGB conversion does. */
+    TRY_TJ(handle2, tj3DecodeYUV8(handle2, yuvBuf, 1, dstBuf, w, 0, h,
+                                  TJPF_GRAY));
+    for (i = 0; i < n; i++) {
+      matrixRGB(cm, yuvBuf[i], 128., 128., &r, &g, &b);
+      if (!sampleMatches(dstBuf[i], r, 1.01)) {
+        printf("FAILED!\n  YCbCr->Grayscale mismatch at pixel %d: %d != %f\n",
+               i, dstBuf[i], r);
+        BAILOUT()
+      }
+    }
+
+    /* Only JPEG images that use the JFIF color matrix may have a JFIF
+       marker, and other color matrices must survive a round trip. */
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, TJPF_RGB, &jpegBuf,
+                                &jpegSize));
+    if ((jpegSize > 10 && !memcmp(&jpegBuf[6], "JFIF", 5)) !=
+        (cm == TJCM_BT601)) {
+      printf("FAILED!\n  Incorrect JFIF marker\n");
+      BAILOUT()
+    }
+    TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf, 0,
+                                   TJPF_RGB));
+    for (i = 0; i < n * 3; i++) {
+      if (!sampleMatches(dstBuf[i], srcBuf[i], 8.)) {
+        printf("FAILED!\n  JPEG round trip mismatch at sample %d: %d != %d\n",
+               i, dstBuf[i], srcBuf[i]);
+        BAILOUT()
+      }
+    }
+
+    /* A white JPEG image must decompress to white in grayscale as well as in
+       RGB. */
+    TRY_TJ(handle, tj3Compress8(handle, whiteBuf, w, 0, h, TJPF_RGB, &jpegBuf,
+                                &jpegSize));
+    TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf, 0,
+                                   TJPF_GRAY));
+    for (i = 0; i < n; i++) {
+      if (dstBuf[i] != 255) {
+        printf("FAILED!\n  White JPEG image decompressed to gray level %d\n",
+               dstBuf[i]);
+        BAILOUT()
+      }
+    }
+    printf("Passed.\n");
+  }
+
+bailout:
+  tj3Set(handle, TJPARAM_COLORMATRIX, TJCM_BT601);
+  tj3Set(handle2, TJPARAM_COLORMATRIX, TJCM_BT601);
+  tj3Free(jpegBuf);
+  free(srcBuf);
+  free(whiteBuf);
+  free(yuvBuf);
+  free(dstBuf);
+}
+
+
+typedef struct {
+  unsigned long allocs, frees, largeAllocs;
+  size_t inUse;
+} allocStats;
+
+static void *countingAlloc(void *opaque, size_t size, int large)
+{
+  allocStats *as = (allocStats *)opaque;
+  void *ptr = malloc(size);
+
+  if (ptr) {
+    as->allocs++;
+    if (large) as->largeAllocs++;
+    as->inUse += size;
+  }
+  return ptr;
+}
+
+static void countingFree(void *opaque, void *ptr, size_t size, int large)
+{
+  allocStats *as = (allocStats *)opaque;
+
+  as->frees++;
+  as->inUse -= size;
+  free(ptr);
+}
+
+static void allocatorTest(tjhandle handle, tjhandle handle2,
+                          unsigned char *srcBuf, int w, int h, int pf)
+{
+  unsigned char *dstBuf = NULL, *dstBuf2 = NULL, *jpegBuf = NULL,
+    *jpegBuf2 = NULL, *yuvBuf = NULL;
+  size_t jpegSize = 0, jpegSize2 = 0, yuvSize;
+  int pass;
+  tjallocator allocator = { countingAlloc, countingFree, NULL }, badAllocator;
+  allocStats as;
+
+  yuvSize = tj3YUVBufSize(w, 1, h, TJSAMP_420);
+  if ((dstBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL ||
+      (dstBuf2 = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL ||
+      (yuvBuf = (unsigned char *)malloc(yuvSize)) == NULL)
+    THROW("Memory allocation failure");
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 95));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, TJSAMP_420));
+  TRY_TJ(handle2, tj3Set(handle2, TJPARAM_FASTUPSAMPLE, 1));
+
+  printf("Custom allocator ... ");
+  memset(&as, 0, sizeof(allocStats));
+  allocator.opaque = &as;
+  badAllocator = allocator;
+  badAllocator.free = NULL;
+  if (tj3SetAllocator(handle, &badAllocator) != -1) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+
+  /* Compress and decompress the image, first with the default allocator and
+     then with the counting allocator.  The results must be identical, and all
+     memory obtained from the counting allocator must have been returned to
+     it by the end of each operation. */
+  for (pass = 0; pass < 2; pass++) {
+    unsigned char **jpegBufp = pass ? &jpegBuf2 : &jpegBuf;
+    size_t *jpegSizep = pass ? &jpegSize2 : &jpegSize;
+
+    if (pass) {
+      TRY_TJ(handle, tj3SetAllocator(handle, &allocator));
+      TRY_TJ(handle2, tj3SetAllocator(handle2, &allocator));
+    }
+    TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, jpegBufp,
+                                jpegSizep));
+    TRY_TJ(handle, tj3EncodeYUV8(handle, srcBuf, w, 0, h, pf, yuvBuf, 1));
+    if (as.inUse != 0) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+    TRY_TJ(handle2, tj3Decompress8(handle2, *jpegBufp, *jpegSizep,
+                                   pass ? dstBuf2 : dstBuf, 0, pf));
+    if (as.inUse != 0) {
+      printf("FAILED!\n");
+      BAILOUT()
+    }
+  }
+  if (as.allocs == 0 || as.largeAllocs == 0 || as.allocs != as.frees ||
+      jpegSize != jpegSize2 || memcmp(jpegBuf, jpegBuf2, jpegSize) ||
+      memcmp(dstBuf, dstBuf2, w * h * tjPixelSize[pf])) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+
+  /* Restoring the default allocator must detach the counting allocator. */
+  as.allocs = 0;
+  TRY_TJ(handle, tj3SetAllocator(handle, NULL));
+  TRY_TJ(handle2, tj3SetAllocator(handle2, NULL));
+  TRY_TJ(handle2, tj3Decompress8(handle2, jpegBuf, jpegSize, dstBuf2, 0, pf));
+  if (as.allocs != 0) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3SetAllocator(handle, NULL);
+  tj3SetAllocator(handle2, NULL);
+  tj3Set(handle2, TJPARAM_FASTUPSAMPLE, 0);
+  tj3Free(jpegBuf);
+  tj3Free(jpegBuf2);
+  free(dstBuf);
+  free(dstBuf2);
+  free(yuvBuf);
+}
+
+
+static void destBufTest(tjhandle handle, unsigned char *srcBuf, int w, int h,
+                        int pf)
+{
+  unsigned char *jpegBuf = NULL, *jpegBuf2 = NULL, *jpegCopy = NULL;
+  size_t jpegSize = 0, jpegSize2 = 16;
+
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, 95));
+  TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, TJSAMP_444));
+
+  printf("Destination buffer ownership ... ");
+  /* Let TurboJPEG allocate the first JPEG buffer, then compress into a
+     different, undersized buffer so that TurboJPEG has to grow it.  Growing
+     the second buffer must not free the first, which now belongs to us. */
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                              &jpegSize));
+  if ((jpegCopy = (unsigned char *)malloc(jpegSize)) == NULL ||
+      (jpegBuf2 = (unsigned char *)tj3Alloc(jpegSize2)) == NULL)
+    THROW("Memory allocation failure");
+  memcpy(jpegCopy, jpegBuf, jpegSize);
+  TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf2,
+                              &jpegSize2));
+  if (jpegSize2 != jpegSize || memcmp(jpegBuf, jpegCopy, jpegSize) ||
+      memcmp(jpegBuf2, jpegCopy, jpegSize)) {
+    printf("FAILED!\n");
+    BAILOUT()
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Free(jpegBuf);
+  tj3Free(jpegBuf2);
+  free(jpegCopy);
+}
+
+
+static void sizeEstimateTest(tjhandle handle)
+{
+  unsigned char *srcBuf = NULL, *jpegBuf = NULL;
+  size_t jpegSize = 0, estSize = 0;
+  int w = 640, h = 1600, pf = TJPF_RGB, x, y, c, subsamp, qual;
+  unsigned int seed = 1;
+
+  if ((srcBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL)
+    THROW("Memory allocation failure");
+
+  /* Overlapping diagonal gradients with noise whose amplitude increases from
+     the top of the image to the bottom, so that the bands are not all alike.
+     The image is tall enough that tj3EstimateJPEGSize8() compresses only a
+     subset of the MCU rows and extrapolates the size from them.  (With 4:4:1
+     subsampling, it compresses the minimum number of MCU rows.) */
+  for (y = 0; y < h; y++) {
+    for (x = 0; x < w; x++) {
+      for (c = 0; c < 3; c++) {
+        int tx = (x * (c + 2) + y) % 512, ty = (y * (3 - c) + 2 * x) % 384, v;
+
+        tx = tx < 256 ? tx : 511 - tx;
+        ty = ty < 192 ? ty : 383 - ty;
+        seed = seed * 1103515245 + 12345;
+        v = (tx + ty) / 2 + 32 + (int)((seed >> 16) % (4 + 60 * y / h)) -
+            (2 + 30 * y / h);
+        srcBuf[(y * w + x) * 3 + c] =
+          (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+      }
+    }
+  }
+
+  printf("Size estimate (sampled) ... ");
+  /* The estimate must be within 3% of the actual size.  (It is typically
+     within about 1% for this image.) */
+  for (subsamp = 0; subsamp < TJ_NUMSAMP; subsamp++) {
+    for (qual = 75; qual <= 95; qual += 20) {
+      TRY_TJ(handle, tj3Set(handle, TJPARAM_SUBSAMP, subsamp));
+      TRY_TJ(handle, tj3Set(handle, TJPARAM_QUALITY, qual));
+      TRY_TJ(handle, tj3Compress8(handle, srcBuf, w, 0, h, pf, &jpegBuf,
+                                  &jpegSize));
+      TRY_TJ(handle, tj3EstimateJPEGSize8(handle, srcBuf, w, 0, h, pf,
+                                          &estSize));
+      if (estSize * 100 < jpegSize * 97 || estSize * 100 > jpegSize * 103) {
+        printf("FAILED!\n");
+        printf("  %s Q%d: estimate = %lu, actual = %lu\n", subName[subsamp],
+               qual, (unsigned long)estSize, (unsigned long)jpegSize);
+        BAILOUT()
+      }
+    }
+  }
+  printf("Passed.\n");
+
+bailout:
+  tj3Free(jpegBuf);
+  free(srcBuf);
+}
+
+
+/* Test the features that do not depend on the pixel format, subsampling
+   level, or row order.  These tests share one compressor, one decompressor,
+   and one test image.  Each test specifies the quality and subsampling level
+   that it needs and restores any other parameters that it changes.  (Tests
+   that need a different image provide their own.) */
+static void apiTest(void)
+{
+  tjhandle chandle = NULL, dhandle = NULL;
+  unsigned char *srcBuf = NULL;
+  int w = 48, h = 512, pf = TJPF_RGB;
+
+  if ((chandle = tj3Init(TJINIT_COMPRESS)) == NULL ||
+      (dhandle = tj3Init(TJINIT_DECOMPRESS)) == NULL)
+    THROW_TJ(NULL);
+  if ((srcBuf = (unsigned char *)malloc(w * h * tjPixelSize[pf])) == NULL)
+    THROW("Memory allocation failure");
+  initBuf(srcBuf, w, h, pf, 0);
+
+  sampledHuffTest(chandle, dhandle, srcBuf, w, h, pf);
+  trainedHuffTest(chandle, dhandle, srcBuf, w, h, pf);
+  statsTest(chandle, dhandle, srcBuf, w, h, pf);
+  allocatorTest(chandle, dhandle, srcBuf, w, h, pf);
+  destBufTest(chandle, srcBuf, w, h, pf);
+  sizeEstimateTest(chandle);
+  tableCacheTest(chandle, dhandle, srcBuf, w, h, pf);
+  tensorTest(chandle, dhandle);
+  semiPlanarTest(chandle, dhandle);
+  colorMatrixTest(chandle, dhandle);
+
+bailout:
+  free(srcBuf);
+  tj3Destroy(chandle);
+  tj3Destroy(dhandle);
+}
+
+
 static void bufSizeTest(void)
 {
   int w, h, i, subsamp;
@@ -765,8 +2020,17 @@ static void bufSizeTest(void)
                                        h, TJPF_BGRX, dstBuf, yuvAlign));
         } else {
           if (precision == 8) {
+            size_t estSize = 0;
+
             TRY_TJ(handle, tj3Compress8(handle, (unsigned char *)srcBuf, w, 0,
                                         h, TJPF_BGRX, &dstBuf, &dstSize));
+            /* The size estimate must be within 20% of the actual size.  (These
+               images are too small and too noisy for it to be any tighter.) */
+            TRY_TJ(handle, tj3EstimateJPEGSize8(handle,
+                                                (unsigned char *)srcBuf, w, 0,
+                                                h, TJPF_BGRX, &estSize));
+            if (estSize * 10 < dstSize * 8 || estSize * 10 > dstSize * 12)
+              THROW("tj3EstimateJPEGSize8() is inaccurate");
           } else if (precision == 12) {
             TRY_TJ(handle, tj3Compress12(handle, (short *)srcBuf, w, 0, h,
                                          TJPF_BGRX, &dstBuf, &dstSize));
@@ -1202,6 +2466,8 @@ int main(int argc, char *argv[])
     doTest(35, 39, _4sampleFormats, 4, TJSAMP_GRAY, "test");
   }
   bufSizeTest();
+  if (!lossless && !doYUV && precision == 8)
+    apiTest();
   if (doYUV) {
     printf("\n--------------------\n\n");
     doTest(48, 48, _onlyRGB, 1, TJSAMP_444, "test_yuv0");
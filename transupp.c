@@ -169,6 +169,82 @@ requant_comp(j_decompress_ptr cinfo, jpeg_component_info *compptr,
 }
 
 
+/*
+ * Requantize the destination coefficients of all components, in place, using
+ * the destination quantization tables.  If transpose_it is TRUE, then the
+ * destination coefficients are transposed relative to the source, so the
+ * source quantization tables must be transposed as well.
+ */
+LOCAL(void)
+requant_coefs(j_decompress_ptr srcinfo, j_compress_ptr dstinfo,
+              jvirt_barray_ptr *dst_coef_arrays, boolean transpose_it)
+{
+  JDIMENSION blk_x, blk_y;
+  int ci, offset_y, i, j, k;
+  UINT16 srcqval[MAX_COMPONENTS][DCTSIZE2];
+  JQUANT_TBL *qtblptr;
+  jpeg_component_info *compptr;
+  JBLOCKARRAY buffer;
+  JCOEFPTR ptr;
+  JLONG temp, qval;
+
+  /* Gather the source quantization tables, and raise any destination
+   * quantization table entries that are smaller than the corresponding
+   * source entries.  All destination tables must be adjusted before any
+   * coefficients are requantized, since components can share tables.
+   */
+  for (ci = 0; ci < dstinfo->num_components; ci++) {
+    compptr = dstinfo->comp_info + ci;
+    qtblptr = srcinfo->comp_info[ci].quant_table;
+    if (qtblptr == NULL || compptr->quant_tbl_no < 0 ||
+        compptr->quant_tbl_no >= NUM_QUANT_TBLS ||
+        dstinfo->quant_tbl_ptrs[compptr->quant_tbl_no] == NULL)
+      ERREXIT1(dstinfo, JERR_NO_QUANT_TABLE, compptr->quant_tbl_no);
+    for (i = 0; i < DCTSIZE; i++)
+      for (j = 0; j < DCTSIZE; j++)
+        srcqval[ci][i * DCTSIZE + j] = transpose_it ?
+          qtblptr->quantval[j * DCTSIZE + i] :
+          qtblptr->quantval[i * DCTSIZE + j];
+    qtblptr = dstinfo->quant_tbl_ptrs[compptr->quant_tbl_no];
+    for (k = 0; k < DCTSIZE2; k++)
+      if (qtblptr->quantval[k] < srcqval[ci][k])
+        qtblptr->quantval[k] = srcqval[ci][k];
+  }
+
+  for (ci = 0; ci < dstinfo->num_components; ci++) {
+    compptr = dstinfo->comp_info + ci;
+    qtblptr = dstinfo->quant_tbl_ptrs[compptr->quant_tbl_no];
+    for (blk_y = 0; blk_y < compptr->height_in_blocks;
+         blk_y += compptr->v_samp_factor) {
+      buffer = (*srcinfo->mem->access_virt_barray)
+        ((j_common_ptr)srcinfo, dst_coef_arrays[ci], blk_y,
+         (JDIMENSION)compptr->v_samp_factor, TRUE);
+      for (offset_y = 0; offset_y < compptr->v_samp_factor; offset_y++) {
+        for (blk_x = 0; blk_x < compptr->width_in_blocks; blk_x++) {
+          ptr = buffer[offset_y][blk_x];
+          for (k = 0; k < DCTSIZE2; k++) {
+            qval = qtblptr->quantval[k];
+            if (qval == srcqval[ci][k] || ptr[k] == 0)
+              continue;
+            /* Round to nearest, as in jcdctmgr.c */
+            temp = (JLONG)ptr[k] * srcqval[ci][k];
+            if (temp < 0) {
+              temp = -temp;
+              temp += qval >> 1;
+              temp = -(temp / qval);
+            } else {
+              temp += qval >> 1;
+              temp /= qval;
+            }
+            ptr[k] = (JCOEF)temp;
+          }
+        }
+      }
+    }
+  }
+}
+
+
 /*
  * Calculate largest common denominator using Euclid's algorithm.
  */
@@ -1724,9 +1800,12 @@ jtransform_request_workspace(j_decompress_ptr srcinfo,
   case JXFORM_NONE:
     if (info->x_crop_offset != 0 || info->y_crop_offset != 0 ||
         info->output_width > srcinfo->output_width ||
-        info->output_height > srcinfo->output_height)
+        info->output_height > srcinfo->output_height ||
+        (info->requant && info->slow_hflip))
       need_workspace = TRUE;
-    /* No workspace needed if neither cropping nor transforming */
+    /* No workspace needed if neither cropping nor transforming, unless
+     * requantization must leave the source coefficients intact
+     */
     break;
   case JXFORM_FLIP_H:
     if (info->trim)
@@ -2182,7 +2261,7 @@ jtransform_execute_transform(j_decompress_ptr srcinfo, j_compress_ptr dstinfo,
         do_crop_ext_zero(srcinfo, dstinfo,
                          info->x_crop_offset, info->y_crop_offset,
                          src_coef_arrays, dst_coef_arrays);
-    } else if (info->x_crop_offset != 0 || info->y_crop_offset != 0)
+    } else if (dst_coef_arrays != NULL)
       do_crop(srcinfo, dstinfo, info->x_crop_offset, info->y_crop_offset,
               src_coef_arrays, dst_coef_arrays);
     break;
@@ -2243,6 +2322,14 @@ jtransform_execute_transform(j_decompress_ptr srcinfo, j_compress_ptr dstinfo,
               info->drop_width, info->drop_height);
     break;
   }
+
+  if (info->requant)
+    requant_coefs(srcinfo, dstinfo,
+                  dst_coef_arrays != NULL ? dst_coef_arrays : src_coef_arrays,
+                  info->transform == JXFORM_TRANSPOSE ||
+                  info->transform == JXFORM_TRANSVERSE ||
+                  info->transform == JXFORM_ROT_90 ||
+                  info->transform == JXFORM_ROT_270);
 }
 
 /* jtransform_perfect_transform
@@ -141,7 +141,17 @@ typedef struct {
                           double-buffered algorithm, which leaves the source
                           coefficients in tact (necessary if other transformed
                           images must be generated from the same set of
-                          coefficients. */
+                          coefficients.  This also applies to requantization
+                          with JXFORM_NONE.) */
+  boolean requant;     /* if TRUE, requantize the DCT coefficients using the
+                          destination quantization tables, which the
+                          application must set after calling
+                          jtransform_adjust_parameters() and before calling
+                          jpeg_write_coefficients().  Quantization table
+                          entries that are smaller than the corresponding
+                          source entries are raised to match them, since
+                          requantization cannot restore discarded
+                          information. */
 
   /* Crop parameters: application need not set these unless crop is TRUE.
    * These can be filled in by jtransform_parse_crop_spec().
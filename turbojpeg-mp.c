@@ -32,22 +32,34 @@
 #if BITS_IN_JSAMPLE == 8
 #define _JSAMPLE  JSAMPLE
 #define _JSAMPROW  JSAMPROW
+#define _JSAMPARRAY  JSAMPARRAY
+#define _SPSAMPLE  unsigned char
+#define SP_SHIFT  0
 #define _buffer  buffer
 #define _jinit_read_ppm  jinit_read_ppm
 #define _jinit_write_ppm  jinit_write_ppm
 #define _jpeg_crop_scanline  jpeg_crop_scanline
+#define _jpeg_read_raw_data  jpeg_read_raw_data
 #define _jpeg_read_scanlines  jpeg_read_scanlines
 #define _jpeg_skip_scanlines  jpeg_skip_scanlines
+#define _jpeg_write_raw_data  jpeg_write_raw_data
 #define _jpeg_write_scanlines  jpeg_write_scanlines
 #elif BITS_IN_JSAMPLE == 12
 #define _JSAMPLE  J12SAMPLE
 #define _JSAMPROW  J12SAMPROW
+#define _JSAMPARRAY  J12SAMPARRAY
+/* 12-bit semi-planar samples (P010, P012, or P016) occupy the most
+   significant bits of 16-bit words. */
+#define _SPSAMPLE  unsigned short
+#define SP_SHIFT  4
 #define _buffer  buffer12
 #define _jinit_read_ppm  j12init_read_ppm
 #define _jinit_write_ppm  j12init_write_ppm
 #define _jpeg_crop_scanline  jpeg12_crop_scanline
+#define _jpeg_read_raw_data  jpeg12_read_raw_data
 #define _jpeg_read_scanlines  jpeg12_read_scanlines
 #define _jpeg_skip_scanlines  jpeg12_skip_scanlines
+#define _jpeg_write_raw_data  jpeg12_write_raw_data
 #define _jpeg_write_scanlines  jpeg12_write_scanlines
 #elif BITS_IN_JSAMPLE == 16
 #define _JSAMPLE  J16SAMPLE
@@ -76,24 +88,31 @@ DLLEXPORT int GET_NAME(tj3Compress, BITS_IN_JSAMPLE)
   int i, retval = 0;
   boolean alloc = TRUE;
   _JSAMPROW *row_pointer = NULL;
+#if BITS_IN_JSAMPLE == 8
+  long huffCounts[2][NUM_HUFF_TBLS][257];
+  JHUFF_TBL huffTbls[2][NUM_HUFF_TBLS];
+  boolean huffTblDefined[2][NUM_HUFF_TBLS], sampledHuff = FALSE;
+#endif
 
   GET_CINSTANCE(handle)
   if ((this->init & COMPRESS) == 0)
     THROW("Instance has not been initialized for compression");
 
   if (srcBuf == NULL || width <= 0 || pitch < 0 || height <= 0 ||
-      pixelFormat < 0 || pixelFormat >= TJ_NUMPF || jpegBuf == NULL ||
-      jpegSize == NULL)
+      pixelFormat < 0 || pixelFormat >= TJ_NUMPF ||
+      (jpegBuf == NULL && !this->chunkSize) || jpegSize == NULL)
     THROW("Invalid argument");
 
-  if (!this->lossless && this->quality == -1)
+  if (this->targetSize > 0 && (BITS_IN_JSAMPLE != 8 || this->lossless))
+    THROW("TJPARAM_TARGETSIZE requires 8-bit-per-sample lossy compression");
+  if (!this->lossless && this->quality == -1 && this->targetSize == 0)
     THROW("TJPARAM_QUALITY must be specified");
   if (!this->lossless && this->subsamp == TJSAMP_UNKNOWN)
     THROW("TJPARAM_SUBSAMP must be specified");
 
   if (pitch == 0) pitch = width * tjPixelSize[pixelFormat];
 
-  if ((row_pointer = (_JSAMPROW *)malloc(sizeof(_JSAMPROW) * height)) == NULL)
+  if ((row_pointer = (_JSAMPROW *)MALLOC(sizeof(_JSAMPROW) * height)) == NULL)
     THROW("Memory allocation failure");
 
   if (setjmp(this->jerr.setjmp_buffer)) {
@@ -101,24 +120,41 @@ DLLEXPORT int GET_NAME(tj3Compress, BITS_IN_JSAMPLE)
     retval = -1;  goto bailout;
   }
 
+  for (i = 0; i < height; i++) {
+    if (this->bottomUp)
+      row_pointer[i] = (_JSAMPROW)&srcBuf[(height - i - 1) * (size_t)pitch];
+    else
+      row_pointer[i] = (_JSAMPROW)&srcBuf[i * (size_t)pitch];
+  }
+
+#if BITS_IN_JSAMPLE == 8
+  if (this->targetSize > 0) {
+    alloc = !this->noRealloc && !this->chunkSize;
+    retval = compressTargetSize(this, FUNCTION_NAME, row_pointer, width,
+                                height, pixelFormat, jpegBuf, jpegSize);
+    goto bailout;
+  }
+
+  if (this->optimize == 2 && !this->lossless && !this->progressive &&
+      !this->arithmetic)
+    sampledHuff = sampleHuffCounts(this, row_pointer, width, height,
+                                   pixelFormat, huffCounts);
+#endif
+
   cinfo->image_width = width;
   cinfo->image_height = height;
   cinfo->data_precision = BITS_IN_JSAMPLE;
 
   setCompDefaults(this, pixelFormat);
-  if (this->noRealloc) {
-    alloc = FALSE;
-    *jpegSize = tj3JPEGBufSize(width, height, this->subsamp);
+#if BITS_IN_JSAMPLE == 8
+  if (sampledHuff) {
+    genHuffTables(this, huffCounts, huffTbls, huffTblDefined);
+    setHuffTables(this, huffTbls, huffTblDefined);
   }
-  jpeg_mem_dest_tj(cinfo, jpegBuf, jpegSize, alloc);
+#endif
+  alloc = setJPEGDestination(this, jpegBuf, jpegSize, width, height);
 
   jpeg_start_compress(cinfo, TRUE);
-  for (i = 0; i < height; i++) {
-    if (this->bottomUp)
-      row_pointer[i] = (_JSAMPROW)&srcBuf[(height - i - 1) * (size_t)pitch];
-    else
-      row_pointer[i] = (_JSAMPROW)&srcBuf[i * (size_t)pitch];
-  }
   while (cinfo->next_scanline < cinfo->image_height)
     _jpeg_write_scanlines(cinfo, &row_pointer[cinfo->next_scanline],
                           cinfo->image_height - cinfo->next_scanline);
@@ -129,12 +165,149 @@ bailout:
     (*cinfo->dest->term_destination) (cinfo);
   if (cinfo->global_state > CSTATE_START || retval == -1)
     jpeg_abort_compress(cinfo);
-  free(row_pointer);
+  FREE(row_pointer);
   if (this->jerr.warning) retval = -1;
   return retval;
 }
 
 
+#if BITS_IN_JSAMPLE != 16
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int GET_NAME(tj3CompressFromSemiPlanar, BITS_IN_JSAMPLE)
+  (tjhandle handle, const _SPSAMPLE * const *srcPlanes, int width,
+   const int *strides, int height, int uvOrder, unsigned char **jpegBuf,
+   size_t *jpegSize)
+{
+  static const char FUNCTION_NAME[] =
+    GET_STRING(tj3CompressFromSemiPlanar, BITS_IN_JSAMPLE);
+  int i, j, k, row, retval = 0;
+  boolean alloc = TRUE;
+  int pw[3], ph[3], iw[3], th[3], stride[2], tmpbufsize = 0;
+  _JSAMPLE *_tmpbuf = NULL, *ptr;
+  _JSAMPROW *tmpbuf[3] = { NULL, NULL, NULL };
+
+  GET_CINSTANCE(handle)
+
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
+
+  if (!srcPlanes || !srcPlanes[0] || !srcPlanes[1] || width <= 0 ||
+      height <= 0 || uvOrder < 0 || uvOrder >= TJ_NUMUV ||
+      (jpegBuf == NULL && !this->chunkSize) || jpegSize == NULL)
+    THROW("Invalid argument");
+
+  if (this->lossless)
+    THROW("Semi-planar images cannot be compressed losslessly");
+  if (this->quality == -1)
+    THROW("TJPARAM_QUALITY must be specified");
+  if (this->subsamp == TJSAMP_UNKNOWN)
+    THROW("TJPARAM_SUBSAMP must be specified");
+  if (this->subsamp == TJSAMP_GRAY)
+    THROW("Semi-planar images cannot be grayscale");
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  cinfo->image_width = width;
+  cinfo->image_height = height;
+  cinfo->data_precision = BITS_IN_JSAMPLE;
+
+  alloc = setJPEGDestination(this, jpegBuf, jpegSize, width, height);
+  setCompDefaults(this, TJPF_RGB);
+  cinfo->raw_data_in = TRUE;
+
+  jpeg_start_compress(cinfo, TRUE);
+  for (i = 0; i < 3; i++) {
+    jpeg_component_info *compptr = &cinfo->comp_info[i];
+
+    iw[i] = compptr->width_in_blocks * DCTSIZE;
+    pw[i] = PAD(cinfo->image_width, cinfo->max_h_samp_factor) *
+            compptr->h_samp_factor / cinfo->max_h_samp_factor;
+    ph[i] = PAD(cinfo->image_height, cinfo->max_v_samp_factor) *
+            compptr->v_samp_factor / cinfo->max_v_samp_factor;
+    th[i] = compptr->v_samp_factor * DCTSIZE;
+    tmpbufsize += iw[i] * th[i];
+  }
+  stride[0] = (strides && strides[0] != 0) ? strides[0] : pw[0];
+  stride[1] = (strides && strides[1] != 0) ? strides[1] : pw[1] * 2;
+
+  /* Only one iMCU row is de-interleaved at a time, so the temporary buffer
+     stays in the CPU cache. */
+  if ((_tmpbuf =
+       (_JSAMPLE *)MALLOC_LARGE(sizeof(_JSAMPLE) * tmpbufsize)) == NULL)
+    THROW("Memory allocation failure");
+  ptr = _tmpbuf;
+  for (i = 0; i < 3; i++) {
+    if ((tmpbuf[i] = (_JSAMPROW *)MALLOC(sizeof(_JSAMPROW) * th[i])) == NULL)
+      THROW("Memory allocation failure");
+    for (row = 0; row < th[i]; row++) {
+      tmpbuf[i][row] = ptr;
+      ptr += iw[i];
+    }
+  }
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  for (row = 0; row < (int)cinfo->image_height;
+       row += cinfo->max_v_samp_factor * DCTSIZE) {
+    _JSAMPARRAY yuvptr[3];
+
+    for (i = 0; i < 3; i++) {
+      jpeg_component_info *compptr = &cinfo->comp_info[i];
+      int crow = row * compptr->v_samp_factor / cinfo->max_v_samp_factor;
+      int nrows = MIN(th[i], ph[i] - crow);
+
+      for (j = 0; j < nrows; j++) {
+        _JSAMPROW outptr = tmpbuf[i][j];
+
+        if (i == 0) {
+          const _SPSAMPLE *inptr =
+            &srcPlanes[0][(size_t)(crow + j) * stride[0]];
+
+          for (k = 0; k < pw[0]; k++)
+            outptr[k] = (_JSAMPLE)(inptr[k] >> SP_SHIFT);
+        } else {
+          const _SPSAMPLE *inptr =
+            &srcPlanes[1][(size_t)(crow + j) * stride[1] +
+                          ((i == 1) == (uvOrder == TJUV_CBCR) ? 0 : 1)];
+
+          for (k = 0; k < pw[i]; k++)
+            outptr[k] = (_JSAMPLE)(inptr[k * 2] >> SP_SHIFT);
+        }
+        /* Duplicate last sample in row to fill out MCU */
+        for (k = pw[i]; k < iw[i]; k++)
+          outptr[k] = outptr[pw[i] - 1];
+      }
+      /* Duplicate last row to fill out MCU */
+      for (j = nrows; j < th[i]; j++)
+        memcpy(tmpbuf[i][j], tmpbuf[i][nrows - 1], sizeof(_JSAMPLE) * iw[i]);
+      yuvptr[i] = tmpbuf[i];
+    }
+    _jpeg_write_raw_data(cinfo, yuvptr, cinfo->max_v_samp_factor * DCTSIZE);
+  }
+  jpeg_finish_compress(cinfo);
+
+bailout:
+  if (cinfo->global_state > CSTATE_START && alloc)
+    (*cinfo->dest->term_destination) (cinfo);
+  if (cinfo->global_state > CSTATE_START || retval == -1)
+    jpeg_abort_compress(cinfo);
+  for (i = 0; i < 3; i++)
+    FREE(tmpbuf[i]);
+  FREE(_tmpbuf);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+#endif /* BITS_IN_JSAMPLE != 16 */
+
+
 /******************************* Decompressor ********************************/
 
 /* TurboJPEG 3+ */
@@ -159,13 +332,14 @@ DLLEXPORT int GET_NAME(tj3Decompress, BITS_IN_JSAMPLE)
       pixelFormat < 0 || pixelFormat >= TJ_NUMPF)
     THROW("Invalid argument");
 
-  if (this->scanLimit) {
+  if (this->scanLimit || this->collectStats) {
     memset(&progress, 0, sizeof(struct my_progress_mgr));
     progress.pub.progress_monitor = my_progress_monitor;
     progress.this = this;
     dinfo->progress = &progress.pub;
   } else
     dinfo->progress = NULL;
+  if (this->collectStats) startDecompStats(this);
 
   dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
 
@@ -188,6 +362,7 @@ DLLEXPORT int GET_NAME(tj3Decompress, BITS_IN_JSAMPLE)
   scaledWidth = TJSCALED(dinfo->image_width, this->scalingFactor);
 #endif
   dinfo->do_fancy_upsampling = !this->fastUpsample;
+  dinfo->master->color_matrix = (J_COLOR_MATRIX)this->colorMatrix;
   this->dinfo.dct_method = this->fastDCT ? JDCT_FASTEST : JDCT_ISLOW;
 
   dinfo->scale_num = this->scalingFactor.num;
@@ -221,7 +396,7 @@ DLLEXPORT int GET_NAME(tj3Decompress, BITS_IN_JSAMPLE)
     croppedHeight = this->croppingRegion.h;
 #endif
   if ((row_pointer =
-       (_JSAMPROW *)malloc(sizeof(_JSAMPROW) * croppedHeight)) == NULL)
+       (_JSAMPROW *)MALLOC(sizeof(_JSAMPROW) * croppedHeight)) == NULL)
     THROW("Memory allocation failure");
   if (setjmp(this->jerr.setjmp_buffer)) {
     /* If we get here, the JPEG code has signaled an error. */
@@ -273,13 +448,296 @@ DLLEXPORT int GET_NAME(tj3Decompress, BITS_IN_JSAMPLE)
   jpeg_finish_decompress(dinfo);
 
 bailout:
+  if (this->collectStats) finishDecompStats(this, jpegSize);
   if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
-  free(row_pointer);
+  FREE(row_pointer);
   if (this->jerr.warning) retval = -1;
   return retval;
 }
 
 
+#if BITS_IN_JSAMPLE != 16
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int GET_NAME(tj3DecompressPyramid, BITS_IN_JSAMPLE)
+  (tjhandle handle, const unsigned char *jpegBuf, size_t jpegSize,
+   int numScalingFactors, const tjscalingfactor *scalingFactors,
+   _JSAMPLE **dstBufs, const int *pitches, int pixelFormat)
+{
+  static const char FUNCTION_NAME[] =
+    GET_STRING(tj3DecompressPyramid, BITS_IN_JSAMPLE);
+  _JSAMPROW *row_pointer = NULL;
+  int i, j, k, retval = 0;
+  struct my_progress_mgr progress;
+
+  GET_DINSTANCE(handle);
+  if ((this->init & DECOMPRESS) == 0)
+    THROW("Instance has not been initialized for decompression");
+
+  if (jpegBuf == NULL || jpegSize <= 0 || numScalingFactors < 1 ||
+      scalingFactors == NULL || dstBufs == NULL || pixelFormat < 0 ||
+      pixelFormat >= TJ_NUMPF)
+    THROW("Invalid argument");
+  for (i = 0; i < numScalingFactors; i++) {
+    if (dstBufs[i] == NULL || (pitches && pitches[i] < 0))
+      THROW("Invalid argument");
+    for (j = 0; j < NUMSF; j++) {
+      if (scalingFactors[i].num == sf[j].num &&
+          scalingFactors[i].denom == sf[j].denom)
+        break;
+    }
+    if (j >= NUMSF)
+      THROW("Unsupported scaling factor");
+    if (i > 0 &&
+        scalingFactors[i].num * scalingFactors[i - 1].denom >
+        scalingFactors[i - 1].num * scalingFactors[i].denom)
+      THROW("Scaling factors must be specified in descending order");
+  }
+  if (this->croppingRegion.x != 0 || this->croppingRegion.y != 0 ||
+      this->croppingRegion.w != 0 || this->croppingRegion.h != 0)
+    THROW("Cropping is not supported with multi-resolution decompression");
+
+  if (this->scanLimit || this->collectStats) {
+    memset(&progress, 0, sizeof(struct my_progress_mgr));
+    progress.pub.progress_monitor = my_progress_monitor;
+    progress.this = this;
+    dinfo->progress = &progress.pub;
+  } else
+    dinfo->progress = NULL;
+  if (this->collectStats) startDecompStats(this);
+
+  dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  if (dinfo->global_state <= DSTATE_INHEADER) {
+    jpeg_mem_src_tj(dinfo, jpegBuf, jpegSize);
+    jpeg_read_header(dinfo, TRUE);
+  }
+  setDecompParameters(this);
+  if (this->lossless)
+    THROW("Multi-resolution decompression requires a lossy JPEG image");
+  if (this->maxPixels &&
+      (unsigned long long)this->jpegWidth * this->jpegHeight >
+      (unsigned long long)this->maxPixels)
+    THROW("Image is too large");
+  this->dinfo.out_color_space = pf2cs[pixelFormat];
+  dinfo->do_fancy_upsampling = !this->fastUpsample;
+  dinfo->master->color_matrix = (J_COLOR_MATRIX)this->colorMatrix;
+  this->dinfo.dct_method = this->fastDCT ? JDCT_FASTEST : JDCT_ISLOW;
+
+  /* Use buffered-image mode so that the whole image is entropy-decoded into
+     the coefficient buffer once.  Each output pass then renders the
+     coefficients at a different scaling factor. */
+  dinfo->buffered_image = TRUE;
+  dinfo->scale_num = scalingFactors[0].num;
+  dinfo->scale_denom = scalingFactors[0].denom;
+
+  jpeg_start_decompress(dinfo);
+  while (!jpeg_input_complete(dinfo)) {
+    if (jpeg_consume_input(dinfo) == JPEG_SUSPENDED)
+      THROW("Premature end of JPEG data");
+  }
+
+  if ((row_pointer = (_JSAMPROW *)MALLOC(sizeof(_JSAMPROW) *
+                                         dinfo->output_height)) == NULL)
+    THROW("Memory allocation failure");
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  for (i = 0; i < numScalingFactors; i++) {
+    int pitch = pitches ? pitches[i] : 0;
+
+    if (i > 0) {
+      dinfo->scale_num = scalingFactors[i].num;
+      dinfo->scale_denom = scalingFactors[i].denom;
+      jinit_master_rescale(dinfo);
+    }
+
+    if (pitch == 0) pitch = dinfo->output_width * tjPixelSize[pixelFormat];
+    for (k = 0; k < (int)dinfo->output_height; k++) {
+      if (this->bottomUp)
+        row_pointer[k] =
+          &dstBufs[i][(dinfo->output_height - k - 1) * (size_t)pitch];
+      else
+        row_pointer[k] = &dstBufs[i][k * (size_t)pitch];
+    }
+
+    jpeg_start_output(dinfo, dinfo->input_scan_number);
+    while (dinfo->output_scanline < dinfo->output_height)
+      _jpeg_read_scanlines(dinfo, &row_pointer[dinfo->output_scanline],
+                           dinfo->output_height - dinfo->output_scanline);
+    jpeg_finish_output(dinfo);
+  }
+  jpeg_finish_decompress(dinfo);
+
+bailout:
+  if (this->collectStats) finishDecompStats(this, jpegSize);
+  if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
+  dinfo->buffered_image = FALSE;
+  FREE(row_pointer);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int GET_NAME(tj3DecompressToSemiPlanar, BITS_IN_JSAMPLE)
+  (tjhandle handle, const unsigned char *jpegBuf, size_t jpegSize,
+   _SPSAMPLE **dstPlanes, const int *strides, int uvOrder)
+{
+  static const char FUNCTION_NAME[] =
+    GET_STRING(tj3DecompressToSemiPlanar, BITS_IN_JSAMPLE);
+  int i, j, k, row, retval = 0;
+  int pw[3], ph[3], iw[3], th[3], stride[2], tmpbufsize = 0, dctsize;
+  _JSAMPLE *_tmpbuf = NULL, *ptr;
+  _JSAMPROW *tmpbuf[3] = { NULL, NULL, NULL };
+  struct my_progress_mgr progress;
+
+  GET_DINSTANCE(handle);
+  if ((this->init & DECOMPRESS) == 0)
+    THROW("Instance has not been initialized for decompression");
+
+  if (jpegBuf == NULL || jpegSize <= 0 || !dstPlanes || !dstPlanes[0] ||
+      !dstPlanes[1] || uvOrder < 0 || uvOrder >= TJ_NUMUV)
+    THROW("Invalid argument");
+
+  if (this->scanLimit || this->collectStats) {
+    memset(&progress, 0, sizeof(struct my_progress_mgr));
+    progress.pub.progress_monitor = my_progress_monitor;
+    progress.this = this;
+    dinfo->progress = &progress.pub;
+  } else
+    dinfo->progress = NULL;
+  if (this->collectStats) startDecompStats(this);
+
+  dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  if (dinfo->global_state <= DSTATE_INHEADER) {
+    jpeg_mem_src_tj(dinfo, jpegBuf, jpegSize);
+    jpeg_read_header(dinfo, TRUE);
+  }
+  setDecompParameters(this);
+  if (this->maxPixels &&
+      (unsigned long long)this->jpegWidth * this->jpegHeight >
+      (unsigned long long)this->maxPixels)
+    THROW("Image is too large");
+  if (this->lossless)
+    THROW("Semi-planar decompression requires a lossy JPEG image");
+  if (this->subsamp == TJSAMP_UNKNOWN)
+    THROW("Could not determine subsampling level of JPEG image");
+  if (this->subsamp == TJSAMP_GRAY || dinfo->num_components != 3)
+    THROW("JPEG image must have 3 components");
+
+  dinfo->scale_num = this->scalingFactor.num;
+  dinfo->scale_denom = this->scalingFactor.denom;
+  jpeg_calc_output_dimensions(dinfo);
+
+  dctsize = DCTSIZE * this->scalingFactor.num / this->scalingFactor.denom;
+
+  for (i = 0; i < 3; i++) {
+    jpeg_component_info *compptr = &dinfo->comp_info[i];
+
+    iw[i] = compptr->width_in_blocks * dctsize;
+    pw[i] = tj3YUVPlaneWidth(i, dinfo->output_width, this->subsamp);
+    ph[i] = tj3YUVPlaneHeight(i, dinfo->output_height, this->subsamp);
+    th[i] = compptr->v_samp_factor * dctsize;
+    tmpbufsize += iw[i] * th[i];
+  }
+  stride[0] = (strides && strides[0] != 0) ? strides[0] : pw[0];
+  stride[1] = (strides && strides[1] != 0) ? strides[1] : pw[1] * 2;
+
+  /* Only one iMCU row is interleaved at a time, so the temporary buffer stays
+     in the CPU cache. */
+  if ((_tmpbuf =
+       (_JSAMPLE *)MALLOC_LARGE(sizeof(_JSAMPLE) * tmpbufsize)) == NULL)
+    THROW("Memory allocation failure");
+  ptr = _tmpbuf;
+  for (i = 0; i < 3; i++) {
+    if ((tmpbuf[i] = (_JSAMPROW *)MALLOC(sizeof(_JSAMPROW) * th[i])) == NULL)
+      THROW("Memory allocation failure");
+    for (row = 0; row < th[i]; row++) {
+      tmpbuf[i][row] = ptr;
+      ptr += iw[i];
+    }
+  }
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  dinfo->do_fancy_upsampling = !this->fastUpsample;
+  dinfo->dct_method = this->fastDCT ? JDCT_FASTEST : JDCT_ISLOW;
+  dinfo->raw_data_out = TRUE;
+
+  jpeg_start_decompress(dinfo);
+  for (row = 0; row < (int)dinfo->output_height;
+       row += dinfo->max_v_samp_factor * dinfo->_min_DCT_scaled_size) {
+    if (this->subsamp == TJSAMP_420) {
+      /* See the corresponding comment in tj3DecompressToYUVPlanes8(). */
+      for (i = 0; i < 3; i++) {
+        jpeg_component_info *compptr = &dinfo->comp_info[i];
+
+        compptr->_DCT_scaled_size = dctsize;
+        compptr->MCU_sample_width = tjMCUWidth[this->subsamp] *
+          this->scalingFactor.num / this->scalingFactor.denom *
+          compptr->v_samp_factor / dinfo->max_v_samp_factor;
+        dinfo->idct->inverse_DCT[i] = dinfo->idct->inverse_DCT[0];
+      }
+    }
+    _jpeg_read_raw_data(dinfo, tmpbuf,
+                        dinfo->max_v_samp_factor * dinfo->_min_DCT_scaled_size);
+
+    for (i = 0; i < 3; i++) {
+      jpeg_component_info *compptr = &dinfo->comp_info[i];
+      int crow = row * compptr->v_samp_factor / dinfo->max_v_samp_factor;
+      int nrows = MIN(th[i], ph[i] - crow);
+
+      for (j = 0; j < nrows; j++) {
+        _JSAMPROW inptr = tmpbuf[i][j];
+
+        if (i == 0) {
+          _SPSAMPLE *outptr = &dstPlanes[0][(size_t)(crow + j) * stride[0]];
+
+          for (k = 0; k < pw[0]; k++)
+            outptr[k] = (_SPSAMPLE)(inptr[k] << SP_SHIFT);
+        } else {
+          _SPSAMPLE *outptr =
+            &dstPlanes[1][(size_t)(crow + j) * stride[1] +
+                          ((i == 1) == (uvOrder == TJUV_CBCR) ? 0 : 1)];
+
+          for (k = 0; k < pw[i]; k++)
+            outptr[k * 2] = (_SPSAMPLE)(inptr[k] << SP_SHIFT);
+        }
+      }
+    }
+  }
+  jpeg_finish_decompress(dinfo);
+
+bailout:
+  if (this->collectStats) finishDecompStats(this, jpegSize);
+  if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
+  for (i = 0; i < 3; i++)
+    FREE(tmpbuf[i]);
+  FREE(_tmpbuf);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+#endif /* BITS_IN_JSAMPLE != 16 */
+
+
 /*************************** Packed-Pixel Image I/O **************************/
 
 /* TurboJPEG 3+ */
@@ -532,10 +990,15 @@ bailout:
 
 #undef _JSAMPLE
 #undef _JSAMPROW
+#undef _JSAMPARRAY
+#undef _SPSAMPLE
+#undef SP_SHIFT
 #undef _buffer
 #undef _jinit_read_ppm
 #undef _jinit_write_ppm
 #undef _jpeg_crop_scanline
+#undef _jpeg_read_raw_data
 #undef _jpeg_read_scanlines
 #undef _jpeg_skip_scanlines
+#undef _jpeg_write_raw_data
 #undef _jpeg_write_scanlines
@@ -41,19 +41,30 @@
 #include <jerror.h>
 #include <setjmp.h>
 #include <errno.h>
+#include <time.h>
 #include "./turbojpeg.h"
 #include "./tjutil.h"
 #include "transupp.h"
 #include "./jpegapicomp.h"
+#include "./jchuff.h"
 #include "./cdjpeg.h"
 
 extern void jpeg_mem_dest_tj(j_compress_ptr, unsigned char **, size_t *,
                              boolean);
+extern void jpeg_chunk_dest_tj(j_compress_ptr, size_t, size_t *);
+extern void jpeg_get_chunks_tj(j_compress_ptr, const tjchunk **, int *);
+extern void jpeg_free_chunks_tj(j_compress_ptr);
+extern void jpeg_count_dest_tj(j_compress_ptr, size_t *);
 extern void jpeg_mem_src_tj(j_decompress_ptr, const unsigned char *, size_t);
 
 #define PAD(v, p)  ((v + (p) - 1) & (~((p) - 1)))
 #define IS_POW2(x)  (((x) & (x - 1)) == 0)
 
+/* tj3EstimateJPEGSize8() compresses every ESTIMATE_SAMPLE_RATIO-th MCU row,
+   but no fewer than ESTIMATE_MIN_SAMPLES MCU rows. */
+#define ESTIMATE_SAMPLE_RATIO  8
+#define ESTIMATE_MIN_SAMPLES  8
+
 
 /* Error handling (based on example in example.c) */
 
@@ -104,6 +115,52 @@ static void my_emit_message(j_common_ptr cinfo, int msg_level)
 
 enum { COMPRESS = 1, DECOMPRESS = 2 };
 
+/* Original decompression methods that have been replaced by instrumented
+   versions (TJPARAM_STATS) */
+typedef struct {
+  boolean (*decode_mcu) (j_decompress_ptr dinfo, JBLOCKROW *MCU_data);
+  JDIMENSION (*decode_mcus) (j_decompress_ptr dinfo, JDIFFIMAGE diff_buf,
+                             JDIMENSION MCU_row_num, JDIMENSION MCU_col_num,
+                             JDIMENSION nMCU);
+  int (*decompress_data) (j_decompress_ptr dinfo, JSAMPIMAGE output_buf);
+  int (*decompress_data_12) (j_decompress_ptr dinfo, J12SAMPIMAGE output_buf);
+#ifdef D_LOSSLESS_SUPPORTED
+  int (*decompress_data_16) (j_decompress_ptr dinfo, J16SAMPIMAGE output_buf);
+#endif
+  void (*post_process_data) (j_decompress_ptr dinfo, JSAMPIMAGE input_buf,
+                             JDIMENSION *in_row_group_ctr,
+                             JDIMENSION in_row_groups_avail,
+                             JSAMPARRAY output_buf, JDIMENSION *out_row_ctr,
+                             JDIMENSION out_rows_avail);
+  void (*post_process_data_12) (j_decompress_ptr dinfo,
+                                J12SAMPIMAGE input_buf,
+                                JDIMENSION *in_row_group_ctr,
+                                JDIMENSION in_row_groups_avail,
+                                J12SAMPARRAY output_buf,
+                                JDIMENSION *out_row_ctr,
+                                JDIMENSION out_rows_avail);
+#ifdef D_LOSSLESS_SUPPORTED
+  void (*post_process_data_16) (j_decompress_ptr dinfo,
+                                J16SAMPIMAGE input_buf,
+                                JDIMENSION *in_row_group_ctr,
+                                JDIMENSION in_row_groups_avail,
+                                J16SAMPARRAY output_buf,
+                                JDIMENSION *out_row_ctr,
+                                JDIMENSION out_rows_avail);
+#endif
+  void (*color_convert) (j_decompress_ptr dinfo, JSAMPIMAGE input_buf,
+                         JDIMENSION input_row, JSAMPARRAY output_buf,
+                         int num_rows);
+  void (*color_convert_12) (j_decompress_ptr dinfo, J12SAMPIMAGE input_buf,
+                            JDIMENSION input_row, J12SAMPARRAY output_buf,
+                            int num_rows);
+#ifdef D_LOSSLESS_SUPPORTED
+  void (*color_convert_16) (j_decompress_ptr dinfo, J16SAMPIMAGE input_buf,
+                            JDIMENSION input_row, J16SAMPARRAY output_buf,
+                            int num_rows);
+#endif
+} tjhooks;
+
 typedef struct _tjinstance {
   struct jpeg_compress_struct cinfo;
   struct jpeg_decompress_struct dinfo;
@@ -122,7 +179,7 @@ typedef struct _tjinstance {
   int colorspace;
   boolean fastUpsample;
   boolean fastDCT;
-  boolean optimize;
+  int optimize;
   boolean progressive;
   int scanLimit;
   boolean arithmetic;
@@ -138,17 +195,273 @@ typedef struct _tjinstance {
   tjregion croppingRegion;
   int maxMemory;
   int maxPixels;
+  int targetSize;
+  int chunkSize;
+  int colorMatrix;
+  /* Huffman tables loaded using tj3SetHuffmanTables() */
+  JHUFF_TBL huffTbls[2][NUM_HUFF_TBLS];
+  boolean huffTblDefined[2][NUM_HUFF_TBLS];
+  boolean haveHuffTbls;
+  /* Huffman symbol counts accumulated by tj3TrainHuffmanTables8() */
+  long (*huffCounts)[NUM_HUFF_TBLS][257];
+  /* Instrumentation (TJPARAM_STATS) */
+  boolean collectStats;
+  tjstats stats;
+  unsigned long long statsStartNs, nestedNs;
+  tjhooks hooks;
+  /* Allocator set using tj3SetAllocator() (alloc is NULL if none) */
+  tjallocator allocator;
 } tjinstance;
 
 static tjhandle _tjInitCompress(tjinstance *this);
 static tjhandle _tjInitDecompress(tjinstance *this);
 
+
+/***************************** Temporary buffers *****************************/
+
+/* Temporary buffers are obtained from the instance's allocator, if any (see
+   tj3SetAllocator().)  In that case, each buffer is preceded by a header that
+   records the arguments that must be passed back to the allocator's free()
+   function.  TEMP_HDR_SIZE preserves the alignment of the returned pointer. */
+
+#define TEMP_HDR_SIZE  16
+
+static void *allocTemp(tjinstance *this, size_t size, boolean large)
+{
+  size_t *hdr;
+
+  if (!this->allocator.alloc) return malloc(size);
+
+  if (size > (size_t)SIZE_MAX - TEMP_HDR_SIZE) return NULL;
+  size += TEMP_HDR_SIZE;
+  if ((hdr = (size_t *)this->allocator.alloc(this->allocator.opaque, size,
+                                             large)) == NULL)
+    return NULL;
+  hdr[0] = size;
+  hdr[1] = (size_t)large;
+  return (unsigned char *)hdr + TEMP_HDR_SIZE;
+}
+
+static void freeTemp(tjinstance *this, void *ptr)
+{
+  size_t *hdr;
+
+  if (!this->allocator.alloc) {
+    free(ptr);
+    return;
+  }
+  if (!ptr) return;
+
+  hdr = (size_t *)((unsigned char *)ptr - TEMP_HDR_SIZE);
+  this->allocator.free(this->allocator.opaque, hdr, hdr[0], (int)hdr[1]);
+}
+
+/* These require a tjinstance pointer named "this" to be in scope. */
+#define MALLOC(size)  allocTemp(this, size, FALSE)
+#define MALLOC_LARGE(size)  allocTemp(this, size, TRUE)
+#define FREE(ptr)  freeTemp(this, ptr)
+
 struct my_progress_mgr {
   struct jpeg_progress_mgr pub;
   tjinstance *this;
 };
 typedef struct my_progress_mgr *my_progress_ptr;
 
+
+/****************************** Instrumentation ******************************/
+
+/* When TJPARAM_STATS is set, the progress monitor replaces the methods of the
+   decompression modules with versions that time the original methods.  (The
+   methods are replaced again whenever a module reselects them, such as at the
+   start of each scan or output pass.)  The time spent in a method called from
+   another instrumented method is charged only to the inner method's stage.
+   Stats that are not collected from the modules are filled in by
+   finishDecompStats() after the operation. */
+
+static unsigned long long getTimeNs(void)
+{
+  struct timespec ts;
+
+#ifdef _WIN32
+  if (!timespec_get(&ts, TIME_UTC)) return 0;
+#else
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) return 0;
+#endif
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define BEGIN_STAGE(dinfo) \
+  tjinstance *this = ((my_progress_ptr)(dinfo)->progress)->this; \
+  unsigned long long startNs = getTimeNs(), outerNestedNs = this->nestedNs; \
+  this->nestedNs = 0;
+
+#define END_STAGE(stage) { \
+  unsigned long long elapsedNs = getTimeNs() - startNs; \
+  \
+  this->stats.stageNs[stage] += elapsedNs - this->nestedNs; \
+  this->nestedNs = outerNestedNs + elapsedNs; \
+}
+
+static boolean timed_decode_mcu(j_decompress_ptr dinfo, JBLOCKROW *MCU_data)
+{
+  boolean retval;
+  BEGIN_STAGE(dinfo)
+
+  retval = (*this->hooks.decode_mcu) (dinfo, MCU_data);
+  END_STAGE(TJSTAGE_ENTROPY)
+  if (retval) {
+    this->stats.mcus++;
+    this->stats.blocks += dinfo->blocks_in_MCU;
+  }
+  return retval;
+}
+
+static JDIMENSION timed_decode_mcus(j_decompress_ptr dinfo,
+                                    JDIFFIMAGE diff_buf,
+                                    JDIMENSION MCU_row_num,
+                                    JDIMENSION MCU_col_num, JDIMENSION nMCU)
+{
+  JDIMENSION retval;
+  BEGIN_STAGE(dinfo)
+
+  retval = (*this->hooks.decode_mcus) (dinfo, diff_buf, MCU_row_num,
+                                       MCU_col_num, nMCU);
+  END_STAGE(TJSTAGE_ENTROPY)
+  this->stats.mcus += retval;
+  return retval;
+}
+
+#define TIMED_DECOMPRESS_DATA(name, sampimage) \
+static int timed_##name(j_decompress_ptr dinfo, sampimage output_buf) \
+{ \
+  int retval; \
+  BEGIN_STAGE(dinfo) \
+  \
+  retval = (*this->hooks.name) (dinfo, output_buf); \
+  END_STAGE(TJSTAGE_IDCT) \
+  return retval; \
+}
+
+TIMED_DECOMPRESS_DATA(decompress_data, JSAMPIMAGE)
+TIMED_DECOMPRESS_DATA(decompress_data_12, J12SAMPIMAGE)
+#ifdef D_LOSSLESS_SUPPORTED
+TIMED_DECOMPRESS_DATA(decompress_data_16, J16SAMPIMAGE)
+#endif
+
+#define TIMED_POST_PROCESS_DATA(name, sampimage, samparray) \
+static void timed_##name(j_decompress_ptr dinfo, sampimage input_buf, \
+                         JDIMENSION *in_row_group_ctr, \
+                         JDIMENSION in_row_groups_avail, \
+                         samparray output_buf, JDIMENSION *out_row_ctr, \
+                         JDIMENSION out_rows_avail) \
+{ \
+  BEGIN_STAGE(dinfo) \
+  \
+  (*this->hooks.name) (dinfo, input_buf, in_row_group_ctr, \
+                       in_row_groups_avail, output_buf, out_row_ctr, \
+                       out_rows_avail); \
+  END_STAGE(TJSTAGE_UPSAMPLE) \
+}
+
+TIMED_POST_PROCESS_DATA(post_process_data, JSAMPIMAGE, JSAMPARRAY)
+TIMED_POST_PROCESS_DATA(post_process_data_12, J12SAMPIMAGE, J12SAMPARRAY)
+#ifdef D_LOSSLESS_SUPPORTED
+TIMED_POST_PROCESS_DATA(post_process_data_16, J16SAMPIMAGE, J16SAMPARRAY)
+#endif
+
+#define TIMED_COLOR_CONVERT(name, sampimage, samparray) \
+static void timed_##name(j_decompress_ptr dinfo, sampimage input_buf, \
+                         JDIMENSION input_row, samparray output_buf, \
+                         int num_rows) \
+{ \
+  BEGIN_STAGE(dinfo) \
+  \
+  (*this->hooks.name) (dinfo, input_buf, input_row, output_buf, num_rows); \
+  END_STAGE(TJSTAGE_COLOR) \
+}
+
+TIMED_COLOR_CONVERT(color_convert, JSAMPIMAGE, JSAMPARRAY)
+TIMED_COLOR_CONVERT(color_convert_12, J12SAMPIMAGE, J12SAMPARRAY)
+#ifdef D_LOSSLESS_SUPPORTED
+TIMED_COLOR_CONVERT(color_convert_16, J16SAMPIMAGE, J16SAMPARRAY)
+#endif
+
+#define HOOK(module, method) { \
+  if ((module) != NULL && (module)->method != NULL && \
+      (module)->method != timed_##method) { \
+    this->hooks.method = (module)->method; \
+    (module)->method = timed_##method; \
+  } \
+}
+
+static void hookDecompressor(tjinstance *this)
+{
+  j_decompress_ptr dinfo = &this->dinfo;
+
+  HOOK(dinfo->entropy, decode_mcu)
+  HOOK(dinfo->entropy, decode_mcus)
+  HOOK(dinfo->coef, decompress_data)
+  HOOK(dinfo->coef, decompress_data_12)
+#ifdef D_LOSSLESS_SUPPORTED
+  HOOK(dinfo->coef, decompress_data_16)
+#endif
+  HOOK(dinfo->post, post_process_data)
+  HOOK(dinfo->post, post_process_data_12)
+#ifdef D_LOSSLESS_SUPPORTED
+  HOOK(dinfo->post, post_process_data_16)
+#endif
+  HOOK(dinfo->cconvert, color_convert)
+  HOOK(dinfo->cconvert, color_convert_12)
+#ifdef D_LOSSLESS_SUPPORTED
+  HOOK(dinfo->cconvert, color_convert_16)
+#endif
+}
+
+static void startDecompStats(tjinstance *this)
+{
+  j_decompress_ptr dinfo = &this->dinfo;
+
+  memset(&this->stats, 0, sizeof(tjstats));
+  memset(&this->hooks, 0, sizeof(tjhooks));
+  this->nestedNs = 0;
+  /* The module pointers are left over from the previous image, and the modules
+     that are not used with this image (for instance, the post-processing
+     controller in raw data mode) will not reinitialize them. */
+  if (dinfo->global_state <= DSTATE_READY) {
+    dinfo->entropy = NULL;
+    dinfo->coef = NULL;
+    dinfo->post = NULL;
+    dinfo->cconvert = NULL;
+  }
+  jpeg_mem_peak((j_common_ptr)dinfo, TRUE);
+  this->statsStartNs = getTimeNs();
+}
+
+static void finishDecompStats(tjinstance *this, size_t jpegSize)
+{
+  j_decompress_ptr dinfo = &this->dinfo;
+  unsigned long long stagesNs = 0;
+  int i;
+
+  if (!this->statsStartNs) return;
+  this->stats.totalNs = getTimeNs() - this->statsStartNs;
+  for (i = 0; i < TJSTAGE_OTHER; i++) stagesNs += this->stats.stageNs[i];
+  this->stats.stageNs[TJSTAGE_OTHER] =
+    this->stats.totalNs > stagesNs ? this->stats.totalNs - stagesNs : 0;
+  if (dinfo->src != NULL && dinfo->src->bytes_in_buffer <= jpegSize)
+    this->stats.bytesConsumed = jpegSize - dinfo->src->bytes_in_buffer;
+  this->stats.scans = dinfo->input_scan_number;
+  this->stats.peakMemory = jpeg_mem_peak((j_common_ptr)dinfo, FALSE);
+  if (dinfo->master->simd_stages & JSTAGE_IDCT)
+    this->stats.simdStages |= 1 << TJSTAGE_IDCT;
+  if (dinfo->master->simd_stages & JSTAGE_UPSAMPLE)
+    this->stats.simdStages |= 1 << TJSTAGE_UPSAMPLE;
+  if (dinfo->master->simd_stages & JSTAGE_COLOR)
+    this->stats.simdStages |= 1 << TJSTAGE_COLOR;
+  this->statsStartNs = 0;
+}
+
+
 static void my_progress_monitor(j_common_ptr dinfo)
 {
   my_error_ptr myerr = (my_error_ptr)dinfo->err;
@@ -157,7 +470,9 @@ static void my_progress_monitor(j_common_ptr dinfo)
   if (dinfo->is_decompressor) {
     int scan_no = ((j_decompress_ptr)dinfo)->input_scan_number;
 
-    if (scan_no > myprog->this->scanLimit) {
+    if (myprog->this->collectStats) hookDecompressor(myprog->this);
+
+    if (myprog->this->scanLimit && scan_no > myprog->this->scanLimit) {
       SNPRINTF(myprog->this->errStr, JMSG_LENGTH_MAX,
                "Progressive JPEG image has more than %d scans",
                myprog->this->scanLimit);
@@ -326,6 +641,72 @@ static int getPixelFormat(int pixelSize, int flags)
   return -1;
 }
 
+/* Generate Huffman tables from the specified symbol counts (indexed by
+   [0 = DC, 1 = AC][table number][symbol].)  Every symbol that can occur in an
+   8-bit-per-sample baseline JPEG image is given a nonzero count, so the tables
+   can encode symbols that did not occur in the data from which the counts were
+   gathered.  Tables with no counts are marked as undefined. */
+static void genHuffTables(tjinstance *this,
+                          long (*huffCounts)[NUM_HUFF_TBLS][257],
+                          JHUFF_TBL (*tbls)[NUM_HUFF_TBLS],
+                          boolean (*defined)[NUM_HUFF_TBLS])
+{
+  long freq[257];
+  int i, tbl, k, run, size;
+
+  for (i = 0; i < 2; i++) {
+    for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+      long total = 0;
+
+      for (k = 0; k < 257; k++) total += huffCounts[i][tbl][k];
+      defined[i][tbl] = (total != 0);
+      if (!defined[i][tbl]) continue;
+
+      memcpy(freq, huffCounts[i][tbl], sizeof(freq));
+      if (i == 0) {
+        /* DC symbols are difference categories 0-11. */
+        for (size = 0; size <= 11; size++)
+          if (freq[size] == 0) freq[size] = 1;
+      } else {
+        /* AC symbols are EOB, ZRL, and run/size combinations with sizes
+           1-10. */
+        if (freq[0x00] == 0) freq[0x00] = 1;
+        if (freq[0xF0] == 0) freq[0xF0] = 1;
+        for (run = 0; run < 16; run++)
+          for (size = 1; size <= 10; size++)
+            if (freq[(run << 4) | size] == 0) freq[(run << 4) | size] = 1;
+      }
+      jpeg_gen_optimal_table(&this->cinfo, &tbls[i][tbl], freq);
+    }
+  }
+}
+
+/* Install the specified Huffman tables in the compressor, so that the image
+   will be compressed in a single pass using those tables.  Undefined tables
+   are left unchanged.  Must be called after jpeg_set_defaults(). */
+static void setHuffTables(tjinstance *this, JHUFF_TBL (*tbls)[NUM_HUFF_TBLS],
+                          boolean (*defined)[NUM_HUFF_TBLS])
+{
+  j_compress_ptr cinfo = &this->cinfo;
+  int i, tbl;
+
+  for (i = 0; i < 2; i++) {
+    for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+      JHUFF_TBL **htblptr = i == 0 ? &cinfo->dc_huff_tbl_ptrs[tbl] :
+                                     &cinfo->ac_huff_tbl_ptrs[tbl];
+
+      if (!defined[i][tbl]) continue;
+      if (*htblptr == NULL)
+        *htblptr = jpeg_alloc_huff_table((j_common_ptr)cinfo);
+      memcpy((*htblptr)->bits, tbls[i][tbl].bits, sizeof((*htblptr)->bits));
+      memcpy((*htblptr)->huffval, tbls[i][tbl].huffval,
+             sizeof((*htblptr)->huffval));
+      (*htblptr)->sent_table = FALSE;
+    }
+  }
+  cinfo->optimize_coding = FALSE;
+}
+
 static void setCompDefaults(tjinstance *this, int pixelFormat)
 {
   this->cinfo.in_color_space = pf2cs[pixelFormat];
@@ -338,6 +719,7 @@ static void setCompDefaults(tjinstance *this, int pixelFormat)
   this->cinfo.Y_density = (UINT16)this->yDensity;
   this->cinfo.density_unit = (UINT8)this->densityUnits;
   this->cinfo.mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
+  this->cinfo.master->color_matrix = (J_COLOR_MATRIX)this->colorMatrix;
 
   if (this->lossless) {
 #ifdef C_LOSSLESS_SUPPORTED
@@ -372,13 +754,21 @@ static void setCompDefaults(tjinstance *this, int pixelFormat)
     else
       jpeg_set_colorspace(&this->cinfo, JCS_YCbCr);
   }
+  /* JFIF implies the BT.601 full-range color matrix. */
+  if (this->cinfo.jpeg_color_space == JCS_YCbCr &&
+      this->colorMatrix != TJCM_BT601)
+    this->cinfo.write_JFIF_header = FALSE;
 
   if (this->cinfo.data_precision == 8)
-    this->cinfo.optimize_coding = this->optimize;
+    this->cinfo.optimize_coding = (this->optimize != 0);
 #ifdef C_PROGRESSIVE_SUPPORTED
   if (this->progressive) jpeg_simple_progression(&this->cinfo);
 #endif
   this->cinfo.arith_code = this->arithmetic;
+  if (this->haveHuffTbls && this->cinfo.data_precision == 8 &&
+      !this->optimize && !this->progressive && !this->arithmetic &&
+      !this->lossless)
+    setHuffTables(this, this->huffTbls, this->huffTblDefined);
 
   this->cinfo.comp_info[0].h_samp_factor = tjMCUWidth[this->subsamp] / 8;
   this->cinfo.comp_info[1].h_samp_factor = 1;
@@ -644,7 +1034,7 @@ DLLEXPORT int tj3Set(tjhandle handle, int param, int value)
   case TJPARAM_OPTIMIZE:
     if (!(this->init & COMPRESS))
       THROW("TJPARAM_OPTIMIZE is not applicable to decompression instances.");
-    SET_BOOL_PARAM(optimize);
+    SET_PARAM(optimize, 0, 2);
     break;
   case TJPARAM_PROGRESSIVE:
     if (!(this->init & COMPRESS))
@@ -709,6 +1099,24 @@ DLLEXPORT int tj3Set(tjhandle handle, int param, int value)
   case TJPARAM_MAXPIXELS:
     SET_PARAM(maxPixels, 0, -1);
     break;
+  case TJPARAM_TARGETSIZE:
+    if (!(this->init & COMPRESS))
+      THROW("TJPARAM_TARGETSIZE is not applicable to decompression instances.");
+    SET_PARAM(targetSize, 0, -1);
+    break;
+  case TJPARAM_CHUNKSIZE:
+    if (!(this->init & COMPRESS))
+      THROW("TJPARAM_CHUNKSIZE is not applicable to decompression instances.");
+    SET_PARAM(chunkSize, 0, -1);
+    break;
+  case TJPARAM_STATS:
+    if (!(this->init & DECOMPRESS))
+      THROW("TJPARAM_STATS is not applicable to compression instances.");
+    SET_BOOL_PARAM(collectStats);
+    break;
+  case TJPARAM_COLORMATRIX:
+    SET_PARAM(colorMatrix, 0, TJ_NUMCM - 1);
+    break;
   default:
     THROW("Invalid parameter");
   }
@@ -775,6 +1183,14 @@ DLLEXPORT int tj3Get(tjhandle handle, int param)
     return this->maxMemory;
   case TJPARAM_MAXPIXELS:
     return this->maxPixels;
+  case TJPARAM_TARGETSIZE:
+    return this->targetSize;
+  case TJPARAM_CHUNKSIZE:
+    return this->chunkSize;
+  case TJPARAM_STATS:
+    return this->collectStats;
+  case TJPARAM_COLORMATRIX:
+    return this->colorMatrix;
   }
 
   return -1;
@@ -822,6 +1238,65 @@ DLLEXPORT int tjGetErrorCode(tjhandle handle)
 }
 
 
+/* Trampolines between the libjpeg memory manager and tjallocator */
+
+static void *tjGetMem(void *opaque, size_t sizeofobject, boolean large)
+{
+  tjinstance *this = (tjinstance *)opaque;
+
+  return this->allocator.alloc(this->allocator.opaque, sizeofobject, large);
+}
+
+static void tjFreeMem(void *opaque, void *object, size_t sizeofobject,
+                      boolean large)
+{
+  tjinstance *this = (tjinstance *)opaque;
+
+  this->allocator.free(this->allocator.opaque, object, sizeofobject, large);
+}
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3SetAllocator(tjhandle handle, const tjallocator *allocator)
+{
+  static const char FUNCTION_NAME[] = "tj3SetAllocator";
+  struct jpeg_allocator jallocator;
+  int retval = 0;
+
+  GET_INSTANCE(handle);
+
+  if (allocator && (!allocator->alloc || !allocator->free))
+    THROW("Invalid argument");
+
+  jallocator.get_mem = tjGetMem;
+  jallocator.free_mem = tjFreeMem;
+  jallocator.opaque = this;
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  /* Memory must be released using the allocator that obtained it, so discard
+     any state (such as a JPEG header read by tj3DecompressHeader()) that is
+     held in the libjpeg image pool. */
+  if (this->init & COMPRESS) {
+    if (cinfo->global_state > CSTATE_START) jpeg_abort_compress(cinfo);
+    jpeg_set_allocator((j_common_ptr)cinfo, allocator ? &jallocator : NULL);
+  }
+  if (this->init & DECOMPRESS) {
+    if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
+    jpeg_set_allocator((j_common_ptr)dinfo, allocator ? &jallocator : NULL);
+  }
+  if (allocator)
+    this->allocator = *allocator;
+  else
+    memset(&this->allocator, 0, sizeof(tjallocator));
+
+bailout:
+  return retval;
+}
+
+
 /* TurboJPEG 3+ */
 DLLEXPORT void tj3Destroy(tjhandle handle)
 {
@@ -836,8 +1311,12 @@ DLLEXPORT void tj3Destroy(tjhandle handle)
   this->isInstanceError = FALSE;
 
   if (setjmp(this->jerr.setjmp_buffer)) return;
-  if (this->init & COMPRESS) jpeg_destroy_compress(cinfo);
+  if (this->init & COMPRESS) {
+    jpeg_free_chunks_tj(cinfo);
+    jpeg_destroy_compress(cinfo);
+  }
   if (this->init & DECOMPRESS) jpeg_destroy_decompress(dinfo);
+  free(this->huffCounts);
   free(this);
 }
 
@@ -1131,85 +1610,814 @@ DLLEXPORT size_t tj3YUVPlaneSize(int componentID, int width, int stride,
   if (stride == 0) stride = pw;
   else stride = abs(stride);
 
-  retval = (unsigned long long)stride * (ph - 1) + pw;
-#if ULLONG_MAX > ULONG_MAX
-  if (retval > (unsigned long long)((unsigned long)-1))
-    THROWG("Image is too large", 0);
-#endif
+  retval = (unsigned long long)stride * (ph - 1) + pw;
+#if ULLONG_MAX > ULONG_MAX
+  if (retval > (unsigned long long)((unsigned long)-1))
+    THROWG("Image is too large", 0);
+#endif
+
+bailout:
+  return (size_t)retval;
+}
+
+/* TurboJPEG 1.4+ */
+DLLEXPORT unsigned long tjPlaneSizeYUV(int componentID, int width, int stride,
+                                       int height, int subsamp)
+{
+  size_t retval = tj3YUVPlaneSize(componentID, width, stride, height, subsamp);
+  return (retval == 0) ? -1 : (unsigned long)retval;
+}
+
+
+/* Set up the destination manager for a compression or transform operation,
+   using either the instance's chunk list (if TJPARAM_CHUNKSIZE is set) or the
+   caller's JPEG buffer.  Returns TRUE if the library may allocate or grow the
+   JPEG buffer, in which case the destination manager must be terminated if an
+   error occurs, so that the caller can free the buffer. */
+static boolean setJPEGDestination(tjinstance *this, unsigned char **jpegBuf,
+                                  size_t *jpegSize, int width, int height)
+{
+  if (this->chunkSize) {
+    jpeg_chunk_dest_tj(&this->cinfo, (size_t)this->chunkSize, jpegSize);
+    return FALSE;
+  }
+  if (this->noRealloc)
+    *jpegSize = tj3JPEGBufSize(width, height, this->subsamp);
+  jpeg_mem_dest_tj(&this->cinfo, jpegBuf, jpegSize, !this->noRealloc);
+  return !this->noRealloc;
+}
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3GetChunks(tjhandle handle, const tjchunk **chunks,
+                           int *numChunks)
+{
+  static const char FUNCTION_NAME[] = "tj3GetChunks";
+  int retval = 0;
+
+  GET_CINSTANCE(handle)
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
+
+  if (chunks == NULL || numChunks == NULL)
+    THROW("Invalid argument");
+
+  jpeg_get_chunks_tj(cinfo, chunks, numChunks);
+  if (*numChunks == 0)
+    THROW("No JPEG image has been generated with TJPARAM_CHUNKSIZE set");
+
+bailout:
+  return retval;
+}
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3GetStats(tjhandle handle, tjstats *stats)
+{
+  static const char FUNCTION_NAME[] = "tj3GetStats";
+  int retval = 0;
+
+  GET_TJINSTANCE(handle, -1);
+  if ((this->init & DECOMPRESS) == 0)
+    THROW("Instance has not been initialized for decompression");
+
+  if (stats == NULL)
+    THROW("Invalid argument");
+  if (!this->collectStats)
+    THROW("TJPARAM_STATS is not set");
+
+  *stats = this->stats;
+
+bailout:
+  return retval;
+}
+
+
+/* Unquantized DCT output of an 8-bit-per-sample image, which allows the image
+   to be recompressed with different quality levels without repeating color
+   conversion, downsampling, or the forward DCT */
+typedef struct {
+  JBLOCKROW blocks;
+  JSAMPROW dummyRow;
+} dctcache;
+
+static void freeDCTCache(tjinstance *this, dctcache *cache)
+{
+  FREE(cache->blocks);
+  FREE(cache->dummyRow);
+  cache->blocks = NULL;
+  cache->dummyRow = NULL;
+}
+
+/* Compress an 8-bit-per-sample packed-pixel image using the specified quality
+   level.  If the DCT cache is empty, then the image is compressed from the
+   packed pixels, and the cache is filled.  Otherwise, the cached DCT output is
+   quantized and entropy-coded, and the packed pixels are ignored.  The caller
+   must establish the setjmp() return point. */
+static int compressCached(tjinstance *this, const char *FUNCTION_NAME,
+                          JSAMPROW *row_pointer, int width, int height,
+                          int pixelFormat, int quality,
+                          unsigned char **jpegBuf, size_t *jpegSize,
+                          dctcache *cache)
+{
+  j_compress_ptr cinfo = &this->cinfo;
+  int ci, i, retval = 0, savedQuality = this->quality;
+  boolean fill = (cache->blocks == NULL);
+
+  cinfo->image_width = width;
+  cinfo->image_height = height;
+  cinfo->data_precision = 8;
+
+  this->quality = quality;
+  setCompDefaults(this, pixelFormat);
+  this->quality = savedQuality;
+  if (!fill) cinfo->raw_data_in = TRUE;
+  setJPEGDestination(this, jpegBuf, jpegSize, width, height);
+
+  jpeg_start_compress(cinfo, TRUE);
+
+  if (fill) {
+    size_t numBlocks = 0;
+    JDIMENSION maxWidth = 0;
+
+    for (ci = 0; ci < cinfo->num_components; ci++) {
+      jpeg_component_info *compptr = &cinfo->comp_info[ci];
+
+      numBlocks += (size_t)compptr->width_in_blocks *
+                   compptr->height_in_blocks;
+      maxWidth = MAX(maxWidth, compptr->width_in_blocks * DCTSIZE);
+    }
+    if ((cache->blocks =
+         (JBLOCKROW)MALLOC_LARGE(sizeof(JBLOCK) * numBlocks)) == NULL)
+      THROW("Memory allocation failure");
+    if ((cache->dummyRow =
+         (JSAMPROW)MALLOC_LARGE(sizeof(JSAMPLE) * maxWidth)) == NULL)
+      THROW("Memory allocation failure");
+    memset(cache->dummyRow, 0, sizeof(JSAMPLE) * maxWidth);
+  }
+  cinfo->fdct->dct_cache = cache->blocks;
+  cinfo->fdct->dct_cache_valid = !fill;
+
+  if (fill) {
+    while (cinfo->next_scanline < cinfo->image_height)
+      jpeg_write_scanlines(cinfo, &row_pointer[cinfo->next_scanline],
+                           cinfo->image_height - cinfo->next_scanline);
+  } else {
+    JSAMPROW dummyRows[MAX_SAMP_FACTOR * DCTSIZE];
+    JSAMPARRAY dummyPlanes[MAX_COMPONENTS];
+
+    /* The sample data is ignored when the DCT cache is valid. */
+    for (i = 0; i < MAX_SAMP_FACTOR * DCTSIZE; i++)
+      dummyRows[i] = cache->dummyRow;
+    for (ci = 0; ci < MAX_COMPONENTS; ci++)
+      dummyPlanes[ci] = dummyRows;
+    while (cinfo->next_scanline < cinfo->image_height)
+      jpeg_write_raw_data(cinfo, dummyPlanes,
+                          cinfo->max_v_samp_factor * DCTSIZE);
+  }
+  jpeg_finish_compress(cinfo);
+
+bailout:
+  return retval;
+}
+
+/* Natural logarithm (accurate to about 1e-6), which avoids a dependency on
+   libm */
+static double tjLog(double x)
+{
+  double y, y2;
+  int e = 0;
+
+  while (x >= 2.0) { x *= 0.5;  e++; }
+  while (x < 1.0) { x *= 2.0;  e--; }
+  y = (x - 1.0) / (x + 1.0);  y2 = y * y;
+  return 2.0 * y * (1.0 + y2 * (1.0 / 3.0 + y2 * (1.0 / 5.0 +
+                    y2 * (1.0 / 7.0 + y2 * (1.0 / 9.0))))) +
+         e * 0.69314718055994531;
+}
+
+/* Logarithm of the quantization table scaling factor that jpeg_set_quality()
+   uses for the specified quality level.  Since quantization table entries
+   cannot be less than 1, scaling factors below 3% have little additional
+   effect. */
+static double logQualityScale(int quality)
+{
+  return tjLog((double)MAX(jpeg_quality_scaling(quality), 3));
+}
+
+/* Compress an 8-bit-per-sample packed-pixel image using the highest quality
+   level (no higher than TJPARAM_QUALITY) that produces a JPEG image no larger
+   than TJPARAM_TARGETSIZE.  Only the first iteration of the search performs
+   color conversion, downsampling, and the forward DCT.  The caller must
+   establish the setjmp() return point. */
+static int compressTargetSize(tjinstance *this, const char *FUNCTION_NAME,
+                              JSAMPROW *row_pointer, int width, int height,
+                              int pixelFormat, unsigned char **jpegBuf,
+                              size_t *jpegSize)
+{
+  int maxQuality = this->quality == -1 ? 100 : this->quality, lo = 0,
+    hi = maxQuality + 1, quality = maxQuality, last = 0, q, width0,
+    retval = 0;
+  boolean interpolated = FALSE;
+  size_t size = *jpegSize;
+  double logTarget = tjLog((double)this->targetSize), logLoSize = 0.0,
+    logHiSize = 0.0, logScale, bestDiff;
+  dctcache cache = { NULL, NULL };
+
+  /* lo is the highest quality level known to produce a JPEG image that is
+     small enough (0 if none), and hi is the lowest quality level known to
+     produce a JPEG image that is too large (maxQuality + 1 if none.)  The
+     JPEG image size is approximately proportional to a power of the
+     quantization table scaling factor, so the next quality level is estimated
+     by interpolating between the logarithms of the sizes and scaling factors
+     at lo and hi.  Until lo is known, an exponent of -0.6 is assumed, and the
+     estimate aims about 10% below the target size so that lo is found
+     quickly.  This usually converges in a few iterations.  Bisection is used
+     if interpolation fails to halve the search interval. */
+  while (hi - lo > 1) {
+    width0 = hi - lo;
+    if (compressCached(this, FUNCTION_NAME, row_pointer, width, height,
+                       pixelFormat, quality, jpegBuf, &size, &cache) == -1) {
+      retval = -1;  goto bailout;
+    }
+    last = quality;
+    if (size <= (size_t)this->targetSize) {
+      lo = quality;  logLoSize = tjLog((double)size);
+    } else {
+      hi = quality;  logHiSize = tjLog((double)size);
+    }
+    if (hi - lo <= 1) break;
+
+    if (!interpolated || lo == 0 || (hi - lo) * 2 <= width0) {
+      if (lo > 0 && logHiSize > logLoSize)
+        logScale = logQualityScale(lo) +
+                   (logTarget - logLoSize) *
+                   (logQualityScale(hi) - logQualityScale(lo)) /
+                   (logHiSize - logLoSize);
+      else
+        logScale = logQualityScale(hi) +
+                   (logHiSize - logTarget + 0.1) / 0.6;
+      /* Find the quality level whose scaling factor is closest to the
+         estimate. */
+      quality = lo + 1;  bestDiff = -1.0;
+      for (q = lo + 1; q < hi; q++) {
+        double diff = logQualityScale(q) - logScale;
+
+        if (diff < 0.0) diff = -diff;
+        if (bestDiff < 0.0 || diff < bestDiff) {
+          quality = q;  bestDiff = diff;
+        }
+      }
+      interpolated = TRUE;
+    } else {
+      quality = (lo + hi) / 2;
+      interpolated = FALSE;
+    }
+  }
+
+  if (lo == 0) {
+    /* Even the lowest quality level produces a JPEG image that is too large.
+       Return that image, but issue a warning. */
+    SNPRINTF(this->errStr, JMSG_LENGTH_MAX,
+             "%s(): Unable to meet TJPARAM_TARGETSIZE", FUNCTION_NAME);
+    SNPRINTF(errStr, JMSG_LENGTH_MAX,
+             "%s(): Unable to meet TJPARAM_TARGETSIZE", FUNCTION_NAME);
+    this->isInstanceError = TRUE;
+    this->jerr.warning = TRUE;
+  } else if (lo != last) {
+    /* The most recent iteration produced a JPEG image that was too large, so
+       regenerate the best one. */
+    if (compressCached(this, FUNCTION_NAME, row_pointer, width, height,
+                       pixelFormat, lo, jpegBuf, &size, &cache) == -1) {
+      retval = -1;  goto bailout;
+    }
+  }
+  *jpegSize = size;
+
+bailout:
+  freeDCTCache(this, &cache);
+  return retval;
+}
+
+
+/* Select a representative subset of the MCU rows in an 8-bit-per-sample
+   packed-pixel image.  The image is divided into bands one MCU row high, and
+   the middle band of each of numSamples evenly distributed groups of bands is
+   selected.  The last band, which may be partial, is never selected.
+   sample_pointer must have room for height row pointers.  Returns the height
+   of the subset, or 0 if the image is too small for sampling to be
+   worthwhile. */
+static int selectSampleRows(tjinstance *this, JSAMPROW *row_pointer,
+                            int height, int pixelFormat,
+                            JSAMPROW *sample_pointer)
+{
+  int i, b, bandHeight, numBands, numSamples;
+
+  bandHeight = (this->lossless || pixelFormat == TJPF_GRAY ||
+                this->subsamp == TJSAMP_GRAY) ? 8 : tjMCUHeight[this->subsamp];
+  numBands = (height + bandHeight - 1) / bandHeight;
+  numSamples = MAX(ESTIMATE_MIN_SAMPLES, numBands / ESTIMATE_SAMPLE_RATIO);
+  if (numSamples * 2 >= numBands)
+    return 0;
+
+  for (b = 0; b < numSamples; b++) {
+    int band = (int)(((long long)b * 2 + 1) * (numBands - 1) /
+                     (numSamples * 2));
+
+    for (i = 0; i < bandHeight; i++)
+      sample_pointer[b * bandHeight + i] = row_pointer[band * bandHeight + i];
+  }
+
+  return numSamples * bandHeight;
+}
+
+
+/* Compress the specified rows of an 8-bit-per-sample packed-pixel image,
+   counting the bytes in the JPEG image without storing them.  If huffCounts
+   is not NULL, then Huffman tables are optimized, and the Huffman symbol
+   counts are added to huffCounts.  The caller must establish the setjmp()
+   return point. */
+static size_t countJPEGSize(tjinstance *this, JSAMPROW *row_pointer,
+                            int width, int height, int pixelFormat,
+                            long (*huffCounts)[NUM_HUFF_TBLS][257])
+{
+  j_compress_ptr cinfo = &this->cinfo;
+  size_t size = 0;
+
+  cinfo->image_width = width;
+  cinfo->image_height = height;
+  cinfo->data_precision = 8;
+
+  setCompDefaults(this, pixelFormat);
+  if (huffCounts) cinfo->optimize_coding = TRUE;
+  jpeg_count_dest_tj(cinfo, &size);
+
+  jpeg_start_compress(cinfo, TRUE);
+  if (huffCounts) cinfo->entropy->huff_counts = huffCounts;
+  while (cinfo->next_scanline < cinfo->image_height)
+    jpeg_write_scanlines(cinfo, &row_pointer[cinfo->next_scanline],
+                         cinfo->image_height - cinfo->next_scanline);
+  jpeg_finish_compress(cinfo);
+
+  return size;
+}
+
+
+/* Gather Huffman symbol counts from a representative subset of the MCU rows
+   in an 8-bit-per-sample packed-pixel image (TJPARAM_OPTIMIZE = 2.)  Returns
+   FALSE if the image is too small for sampling to be worthwhile, in which case
+   the caller should fall back to two-pass Huffman optimization.  The caller
+   must establish the setjmp() return point. */
+static boolean sampleHuffCounts(tjinstance *this, JSAMPROW *row_pointer,
+                                int width, int height, int pixelFormat,
+                                long (*huffCounts)[NUM_HUFF_TBLS][257])
+{
+  JSAMPROW *sample_pointer;
+  int sampleHeight;
+
+  if ((sample_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * height)) ==
+      NULL)
+    ERREXIT1(&this->cinfo, JERR_OUT_OF_MEMORY, 0);
+  sampleHeight = selectSampleRows(this, row_pointer, height, pixelFormat,
+                                  sample_pointer);
+  if (sampleHeight > 0) {
+    memset(huffCounts, 0, sizeof(long) * 2 * NUM_HUFF_TBLS * 257);
+    countJPEGSize(this, sample_pointer, width, sampleHeight, pixelFormat,
+                  huffCounts);
+  }
+  FREE(sample_pointer);
+  return sampleHeight > 0;
+}
+
+
+/* tj3Compress*() is implemented in turbojpeg-mp.c */
+#define BITS_IN_JSAMPLE  8
+#include "turbojpeg-mp.c"
+#undef BITS_IN_JSAMPLE
+#define BITS_IN_JSAMPLE  12
+#include "turbojpeg-mp.c"
+#undef BITS_IN_JSAMPLE
+#define BITS_IN_JSAMPLE  16
+#include "turbojpeg-mp.c"
+#undef BITS_IN_JSAMPLE
+
+/* TurboJPEG 1.2+ */
+DLLEXPORT int tjCompress2(tjhandle handle, const unsigned char *srcBuf,
+                          int width, int pitch, int height, int pixelFormat,
+                          unsigned char **jpegBuf, unsigned long *jpegSize,
+                          int jpegSubsamp, int jpegQual, int flags)
+{
+  static const char FUNCTION_NAME[] = "tjCompress2";
+  int retval = 0;
+  size_t size;
+
+  GET_TJINSTANCE(handle, -1);
+
+  if (jpegSize == NULL || jpegSubsamp < 0 || jpegSubsamp >= TJ_NUMSAMP ||
+      jpegQual < 0 || jpegQual > 100)
+    THROW("Invalid argument");
+
+  this->quality = jpegQual;
+  this->subsamp = jpegSubsamp;
+  processFlags(handle, flags, COMPRESS);
+
+  size = (size_t)(*jpegSize);
+  retval = tj3Compress8(handle, srcBuf, width, pitch, height, pixelFormat,
+                        jpegBuf, &size);
+  *jpegSize = (unsigned long)size;
+
+bailout:
+  return retval;
+}
+
+/* TurboJPEG 1.0+ */
+DLLEXPORT int tjCompress(tjhandle handle, unsigned char *srcBuf, int width,
+                         int pitch, int height, int pixelSize,
+                         unsigned char *jpegBuf, unsigned long *jpegSize,
+                         int jpegSubsamp, int jpegQual, int flags)
+{
+  int retval = 0;
+  unsigned long size = jpegSize ? *jpegSize : 0;
+
+  if (flags & TJ_YUV) {
+    size = tjBufSizeYUV(width, height, jpegSubsamp);
+    retval = tjEncodeYUV2(handle, srcBuf, width, pitch, height,
+                          getPixelFormat(pixelSize, flags), jpegBuf,
+                          jpegSubsamp, flags);
+  } else {
+    retval = tjCompress2(handle, srcBuf, width, pitch, height,
+                         getPixelFormat(pixelSize, flags), &jpegBuf, &size,
+                         jpegSubsamp, jpegQual, flags | TJFLAG_NOREALLOC);
+  }
+  *jpegSize = size;
+  return retval;
+}
+
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3CompressMulti8(tjhandle handle, const unsigned char *srcBuf,
+                                int width, int pitch, int height,
+                                int pixelFormat, int numQualities,
+                                const int *qualities, unsigned char **jpegBufs,
+                                size_t *jpegSizes)
+{
+  static const char FUNCTION_NAME[] = "tj3CompressMulti8";
+  int i, q, retval = 0;
+  JSAMPROW *row_pointer = NULL;
+  dctcache cache = { NULL, NULL };
+
+  GET_CINSTANCE(handle)
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
+
+  if (srcBuf == NULL || width <= 0 || pitch < 0 || height <= 0 ||
+      pixelFormat < 0 || pixelFormat >= TJ_NUMPF || numQualities < 1 ||
+      qualities == NULL || jpegBufs == NULL || jpegSizes == NULL)
+    THROW("Invalid argument");
+  for (q = 0; q < numQualities; q++) {
+    if (qualities[q] < 1 || qualities[q] > 100)
+      THROW("Invalid argument");
+  }
+
+  if (this->lossless)
+    THROW("Multi-quality compression requires lossy JPEG compression");
+  if (this->chunkSize)
+    THROW("TJPARAM_CHUNKSIZE cannot be used with multi-quality compression");
+  if (this->subsamp == TJSAMP_UNKNOWN)
+    THROW("TJPARAM_SUBSAMP must be specified");
+
+  if (pitch == 0) pitch = width * tjPixelSize[pixelFormat];
+
+  if ((row_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * height)) == NULL)
+    THROW("Memory allocation failure");
+  for (i = 0; i < height; i++) {
+    if (this->bottomUp)
+      row_pointer[i] = (JSAMPROW)&srcBuf[(height - i - 1) * (size_t)pitch];
+    else
+      row_pointer[i] = (JSAMPROW)&srcBuf[i * (size_t)pitch];
+  }
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  for (q = 0; q < numQualities; q++) {
+    if (compressCached(this, FUNCTION_NAME, row_pointer, width, height,
+                       pixelFormat, qualities[q], &jpegBufs[q], &jpegSizes[q],
+                       &cache) == -1) {
+      retval = -1;  goto bailout;
+    }
+  }
+
+bailout:
+  if (cinfo->global_state > CSTATE_START && !this->noRealloc &&
+      !this->chunkSize)
+    (*cinfo->dest->term_destination) (cinfo);
+  if (cinfo->global_state > CSTATE_START || retval == -1)
+    jpeg_abort_compress(cinfo);
+  FREE(row_pointer);
+  freeDCTCache(this, &cache);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3EstimateJPEGSize8(tjhandle handle,
+                                   const unsigned char *srcBuf, int width,
+                                   int pitch, int height, int pixelFormat,
+                                   size_t *jpegSize)
+{
+  static const char FUNCTION_NAME[] = "tj3EstimateJPEGSize8";
+  int i, retval = 0, sampleHeight;
+  size_t headerSize, sampleSize;
+  JSAMPROW *row_pointer = NULL, *sample_pointer = NULL;
+
+  GET_CINSTANCE(handle)
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
+
+  if (srcBuf == NULL || width <= 0 || pitch < 0 || height <= 0 ||
+      pixelFormat < 0 || pixelFormat >= TJ_NUMPF || jpegSize == NULL)
+    THROW("Invalid argument");
+
+  if (!this->lossless && this->quality == -1)
+    THROW("TJPARAM_QUALITY must be specified");
+  if (!this->lossless && this->subsamp == TJSAMP_UNKNOWN)
+    THROW("TJPARAM_SUBSAMP must be specified");
+
+  if (pitch == 0) pitch = width * tjPixelSize[pixelFormat];
+
+  if ((row_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * height)) == NULL)
+    THROW("Memory allocation failure");
+  for (i = 0; i < height; i++) {
+    if (this->bottomUp)
+      row_pointer[i] = (JSAMPROW)&srcBuf[(height - i - 1) * (size_t)pitch];
+    else
+      row_pointer[i] = (JSAMPROW)&srcBuf[i * (size_t)pitch];
+  }
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  /* A subset of the bands (MCU rows), evenly distributed throughout the
+     image, is compressed (including color conversion, downsampling, the
+     forward DCT, quantization, and entropy coding) with the current
+     compression parameters.  The size of the entropy-coded data is then
+     scaled by the ratio of the image height to the total height of the
+     sampled bands.  Small images are compressed in their entirety, so the
+     estimate is exact. */
+  if ((sample_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * height)) ==
+      NULL)
+    THROW("Memory allocation failure");
+  sampleHeight = selectSampleRows(this, row_pointer, height, pixelFormat,
+                                  sample_pointer);
+  if (sampleHeight == 0) {
+    *jpegSize = countJPEGSize(this, row_pointer, width, height, pixelFormat,
+                              NULL);
+    goto bailout;
+  }
+
+  /* The size of the headers is estimated by compressing one MCU. */
+  headerSize = countJPEGSize(this, row_pointer, MIN(width, 8), 1,
+                             pixelFormat, NULL);
+  sampleSize = countJPEGSize(this, sample_pointer, width, sampleHeight,
+                             pixelFormat, NULL);
+  if (sampleSize < headerSize) sampleSize = headerSize;
+  *jpegSize = headerSize + (size_t)((double)(sampleSize - headerSize) *
+                                    (double)height / (double)sampleHeight +
+                                    0.5);
+
+bailout:
+  if (cinfo->global_state > CSTATE_START || retval == -1)
+    jpeg_abort_compress(cinfo);
+  FREE(row_pointer);
+  FREE(sample_pointer);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3TrainHuffmanTables8(tjhandle handle,
+                                     const unsigned char *srcBuf, int width,
+                                     int pitch, int height, int pixelFormat)
+{
+  static const char FUNCTION_NAME[] = "tj3TrainHuffmanTables8";
+  int i, retval = 0;
+  JSAMPROW *row_pointer = NULL;
+
+  GET_CINSTANCE(handle)
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
+
+  if (srcBuf == NULL || width <= 0 || pitch < 0 || height <= 0 ||
+      pixelFormat < 0 || pixelFormat >= TJ_NUMPF)
+    THROW("Invalid argument");
+
+  if (this->lossless || this->progressive || this->arithmetic)
+    THROW("Huffman table training requires baseline entropy coding");
+  if (this->quality == -1)
+    THROW("TJPARAM_QUALITY must be specified");
+  if (this->subsamp == TJSAMP_UNKNOWN)
+    THROW("TJPARAM_SUBSAMP must be specified");
+
+  if (pitch == 0) pitch = width * tjPixelSize[pixelFormat];
+
+  if (this->huffCounts == NULL) {
+    if ((this->huffCounts = (long (*)[NUM_HUFF_TBLS][257])
+         calloc(2, sizeof(long) * NUM_HUFF_TBLS * 257)) == NULL)
+      THROW("Memory allocation failure");
+  }
+  if ((row_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * height)) == NULL)
+    THROW("Memory allocation failure");
+  for (i = 0; i < height; i++) {
+    if (this->bottomUp)
+      row_pointer[i] = (JSAMPROW)&srcBuf[(height - i - 1) * (size_t)pitch];
+    else
+      row_pointer[i] = (JSAMPROW)&srcBuf[i * (size_t)pitch];
+  }
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
 
-bailout:
-  return (size_t)retval;
-}
+  countJPEGSize(this, row_pointer, width, height, pixelFormat,
+                this->huffCounts);
 
-/* TurboJPEG 1.4+ */
-DLLEXPORT unsigned long tjPlaneSizeYUV(int componentID, int width, int stride,
-                                       int height, int subsamp)
-{
-  size_t retval = tj3YUVPlaneSize(componentID, width, stride, height, subsamp);
-  return (retval == 0) ? -1 : (unsigned long)retval;
+bailout:
+  if (cinfo->global_state > CSTATE_START || retval == -1)
+    jpeg_abort_compress(cinfo);
+  FREE(row_pointer);
+  if (this->jerr.warning) retval = -1;
+  return retval;
 }
 
 
-/* tj3Compress*() is implemented in turbojpeg-mp.c */
-#define BITS_IN_JSAMPLE  8
-#include "turbojpeg-mp.c"
-#undef BITS_IN_JSAMPLE
-#define BITS_IN_JSAMPLE  12
-#include "turbojpeg-mp.c"
-#undef BITS_IN_JSAMPLE
-#define BITS_IN_JSAMPLE  16
-#include "turbojpeg-mp.c"
-#undef BITS_IN_JSAMPLE
+#define HUFF_MARKER_SOI  0xD8
+#define HUFF_MARKER_EOI  0xD9
+#define HUFF_MARKER_DHT  0xC4
 
-/* TurboJPEG 1.2+ */
-DLLEXPORT int tjCompress2(tjhandle handle, const unsigned char *srcBuf,
-                          int width, int pitch, int height, int pixelFormat,
-                          unsigned char **jpegBuf, unsigned long *jpegSize,
-                          int jpegSubsamp, int jpegQual, int flags)
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3GetHuffmanTables(tjhandle handle, unsigned char **tables,
+                                  size_t *size)
 {
-  static const char FUNCTION_NAME[] = "tjCompress2";
-  int retval = 0;
-  size_t size;
+  static const char FUNCTION_NAME[] = "tj3GetHuffmanTables";
+  JHUFF_TBL huffTbls[2][NUM_HUFF_TBLS];
+  boolean huffTblDefined[2][NUM_HUFF_TBLS];
+  unsigned char *ptr;
+  size_t length = 2;
+  int i, tbl, k, numSymbols, retval = 0;
 
   GET_TJINSTANCE(handle, -1);
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
 
-  if (jpegSize == NULL || jpegSubsamp < 0 || jpegSubsamp >= TJ_NUMSAMP ||
-      jpegQual < 0 || jpegQual > 100)
+  if (tables == NULL || size == NULL)
     THROW("Invalid argument");
+  *tables = NULL;  *size = 0;
 
-  this->quality = jpegQual;
-  this->subsamp = jpegSubsamp;
-  processFlags(handle, flags, COMPRESS);
+  if (this->huffCounts == NULL)
+    THROW("No Huffman tables have been trained");
 
-  size = (size_t)(*jpegSize);
-  retval = tj3Compress8(handle, srcBuf, width, pitch, height, pixelFormat,
-                        jpegBuf, &size);
-  *jpegSize = (unsigned long)size;
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  genHuffTables(this, this->huffCounts, huffTbls, huffTblDefined);
+
+  /* The tables are stored as an abbreviated table-specification datastream
+     (SOI, a single DHT marker, and EOI), which is also valid input to
+     jpeg_read_header() in the libjpeg API. */
+  for (i = 0; i < 2; i++) {
+    for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+      if (!huffTblDefined[i][tbl]) continue;
+      for (k = 1, numSymbols = 0; k <= 16; k++)
+        numSymbols += huffTbls[i][tbl].bits[k];
+      length += 1 + 16 + numSymbols;
+    }
+  }
+  if (length == 2)
+    THROW("No Huffman tables have been trained");
+  if ((*tables = (unsigned char *)tj3Alloc(length + 8)) == NULL)
+    THROW("Memory allocation failure");
+  ptr = *tables;
+  *ptr++ = 0xFF;  *ptr++ = HUFF_MARKER_SOI;
+  *ptr++ = 0xFF;  *ptr++ = HUFF_MARKER_DHT;
+  *ptr++ = (unsigned char)(length >> 8);  *ptr++ = (unsigned char)length;
+  for (i = 0; i < 2; i++) {
+    for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+      if (!huffTblDefined[i][tbl]) continue;
+      *ptr++ = (unsigned char)((i << 4) | tbl);
+      for (k = 1, numSymbols = 0; k <= 16; k++) {
+        *ptr++ = huffTbls[i][tbl].bits[k];
+        numSymbols += huffTbls[i][tbl].bits[k];
+      }
+      memcpy(ptr, huffTbls[i][tbl].huffval, numSymbols);
+      ptr += numSymbols;
+    }
+  }
+  *ptr++ = 0xFF;  *ptr++ = HUFF_MARKER_EOI;
+  *size = ptr - *tables;
+
+  /* The next call to tj3TrainHuffmanTables8() starts a new training set. */
+  memset(this->huffCounts, 0, sizeof(long) * 2 * NUM_HUFF_TBLS * 257);
 
 bailout:
+  if (retval == -1) {
+    tj3Free(*tables);  *tables = NULL;  *size = 0;
+  }
   return retval;
 }
 
-/* TurboJPEG 1.0+ */
-DLLEXPORT int tjCompress(tjhandle handle, unsigned char *srcBuf, int width,
-                         int pitch, int height, int pixelSize,
-                         unsigned char *jpegBuf, unsigned long *jpegSize,
-                         int jpegSubsamp, int jpegQual, int flags)
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3SetHuffmanTables(tjhandle handle,
+                                  const unsigned char *tables, size_t size)
 {
-  int retval = 0;
-  unsigned long size = jpegSize ? *jpegSize : 0;
+  static const char FUNCTION_NAME[] = "tj3SetHuffmanTables";
+  JHUFF_TBL huffTbls[2][NUM_HUFF_TBLS];
+  boolean huffTblDefined[2][NUM_HUFF_TBLS];
+  const unsigned char *ptr = tables, *end = tables + size;
+  JHUFF_TBL *savedTbls[2][NUM_HUFF_TBLS];
+  int i, tbl, k, numSymbols, retval = 0;
 
-  if (flags & TJ_YUV) {
-    size = tjBufSizeYUV(width, height, jpegSubsamp);
-    retval = tjEncodeYUV2(handle, srcBuf, width, pitch, height,
-                          getPixelFormat(pixelSize, flags), jpegBuf,
-                          jpegSubsamp, flags);
-  } else {
-    retval = tjCompress2(handle, srcBuf, width, pitch, height,
-                         getPixelFormat(pixelSize, flags), &jpegBuf, &size,
-                         jpegSubsamp, jpegQual, flags | TJFLAG_NOREALLOC);
+  GET_CINSTANCE(handle)
+  for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+    savedTbls[0][tbl] = cinfo->dc_huff_tbl_ptrs[tbl];
+    savedTbls[1][tbl] = cinfo->ac_huff_tbl_ptrs[tbl];
+  }
+  if ((this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for compression");
+
+  if (tables == NULL) {
+    this->haveHuffTbls = FALSE;
+    goto bailout;
+  }
+  if (size < 4) THROW("Invalid argument");
+
+  memset(huffTblDefined, 0, sizeof(huffTblDefined));
+  if (ptr[0] != 0xFF || ptr[1] != HUFF_MARKER_SOI)
+    THROW("Invalid Huffman table data");
+  ptr += 2;
+  while (ptr + 2 <= end && ptr[0] == 0xFF && ptr[1] == HUFF_MARKER_DHT) {
+    const unsigned char *segEnd;
+
+    if (end - ptr < 4) THROW("Invalid Huffman table data");
+    segEnd = ptr + 2 + ((ptr[2] << 8) | ptr[3]);
+    if (segEnd > end || segEnd < ptr + 4)
+      THROW("Invalid Huffman table data");
+    ptr += 4;
+    while (ptr < segEnd) {
+      if (segEnd - ptr < 17) THROW("Invalid Huffman table data");
+      i = ptr[0] >> 4;  tbl = ptr[0] & 0x0F;
+      if (i > 1 || tbl >= NUM_HUFF_TBLS)
+        THROW("Invalid Huffman table data");
+      memset(&huffTbls[i][tbl], 0, sizeof(JHUFF_TBL));
+      for (k = 1, numSymbols = 0; k <= 16; k++) {
+        huffTbls[i][tbl].bits[k] = ptr[k];
+        numSymbols += ptr[k];
+      }
+      ptr += 17;
+      if (numSymbols < 1 || numSymbols > 256 || segEnd - ptr < numSymbols)
+        THROW("Invalid Huffman table data");
+      memcpy(huffTbls[i][tbl].huffval, ptr, numSymbols);
+      ptr += numSymbols;
+      huffTblDefined[i][tbl] = TRUE;
+    }
+  }
+  if (end - ptr != 2 || ptr[0] != 0xFF || ptr[1] != HUFF_MARKER_EOI)
+    THROW("Invalid Huffman table data");
+
+  /* Validate the tables.  (jpeg_make_c_derived_tbl() throws an error if a
+     table is invalid.) */
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+  for (i = 0; i < 2; i++) {
+    for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+      c_derived_tbl dtbl, *dtblptr = &dtbl;
+
+      if (!huffTblDefined[i][tbl]) continue;
+      if (i == 0) cinfo->dc_huff_tbl_ptrs[tbl] = &huffTbls[i][tbl];
+      else cinfo->ac_huff_tbl_ptrs[tbl] = &huffTbls[i][tbl];
+      jpeg_make_c_derived_tbl(cinfo, i == 0, tbl, &dtblptr);
+    }
+  }
+
+  memcpy(this->huffTbls, huffTbls, sizeof(huffTbls));
+  memcpy(this->huffTblDefined, huffTblDefined, sizeof(huffTblDefined));
+  this->haveHuffTbls = TRUE;
+
+bailout:
+  for (tbl = 0; tbl < NUM_HUFF_TBLS; tbl++) {
+    cinfo->dc_huff_tbl_ptrs[tbl] = savedTbls[0][tbl];
+    cinfo->ac_huff_tbl_ptrs[tbl] = savedTbls[1][tbl];
   }
-  *jpegSize = size;
   return retval;
 }
 
@@ -1279,7 +2487,7 @@ DLLEXPORT int tj3EncodeYUVPlanes8(tjhandle handle, const unsigned char *srcBuf,
   pw0 = PAD(width, cinfo->max_h_samp_factor);
   ph0 = PAD(height, cinfo->max_v_samp_factor);
 
-  if ((row_pointer = (JSAMPROW *)malloc(sizeof(JSAMPROW) * ph0)) == NULL)
+  if ((row_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * ph0)) == NULL)
     THROW("Memory allocation failure");
   for (i = 0; i < height; i++) {
     if (this->bottomUp)
@@ -1292,14 +2500,14 @@ DLLEXPORT int tj3EncodeYUVPlanes8(tjhandle handle, const unsigned char *srcBuf,
 
   for (i = 0; i < cinfo->num_components; i++) {
     compptr = &cinfo->comp_info[i];
-    _tmpbuf[i] = (JSAMPLE *)malloc(
+    _tmpbuf[i] = (JSAMPLE *)MALLOC_LARGE(
       PAD((compptr->width_in_blocks * cinfo->max_h_samp_factor * DCTSIZE) /
           compptr->h_samp_factor, 32) *
       cinfo->max_v_samp_factor + 32);
     if (!_tmpbuf[i])
       THROW("Memory allocation failure");
     tmpbuf[i] =
-      (JSAMPROW *)malloc(sizeof(JSAMPROW) * cinfo->max_v_samp_factor);
+      (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * cinfo->max_v_samp_factor);
     if (!tmpbuf[i])
       THROW("Memory allocation failure");
     for (row = 0; row < cinfo->max_v_samp_factor; row++) {
@@ -1311,11 +2519,11 @@ DLLEXPORT int tj3EncodeYUVPlanes8(tjhandle handle, const unsigned char *srcBuf,
             compptr->h_samp_factor, 32) * row];
     }
     _tmpbuf2[i] =
-      (JSAMPLE *)malloc(PAD(compptr->width_in_blocks * DCTSIZE, 32) *
+      (JSAMPLE *)MALLOC_LARGE(PAD(compptr->width_in_blocks * DCTSIZE, 32) *
                         compptr->v_samp_factor + 32);
     if (!_tmpbuf2[i])
       THROW("Memory allocation failure");
-    tmpbuf2[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * compptr->v_samp_factor);
+    tmpbuf2[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * compptr->v_samp_factor);
     if (!tmpbuf2[i])
       THROW("Memory allocation failure");
     for (row = 0; row < compptr->v_samp_factor; row++) {
@@ -1327,7 +2535,7 @@ DLLEXPORT int tj3EncodeYUVPlanes8(tjhandle handle, const unsigned char *srcBuf,
     }
     pw[i] = pw0 * compptr->h_samp_factor / cinfo->max_h_samp_factor;
     ph[i] = ph0 * compptr->v_samp_factor / cinfo->max_v_samp_factor;
-    outbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * ph[i]);
+    outbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * ph[i]);
     if (!outbuf[i])
       THROW("Memory allocation failure");
     ptr = dstPlanes[i];
@@ -1357,13 +2565,13 @@ DLLEXPORT int tj3EncodeYUVPlanes8(tjhandle handle, const unsigned char *srcBuf,
 
 bailout:
   if (cinfo->global_state > CSTATE_START) jpeg_abort_compress(cinfo);
-  free(row_pointer);
+  FREE(row_pointer);
   for (i = 0; i < MAX_COMPONENTS; i++) {
-    free(tmpbuf[i]);
-    free(_tmpbuf[i]);
-    free(tmpbuf2[i]);
-    free(_tmpbuf2[i]);
-    free(outbuf[i]);
+    FREE(tmpbuf[i]);
+    FREE(_tmpbuf[i]);
+    FREE(tmpbuf2[i]);
+    FREE(_tmpbuf2[i]);
+    FREE(outbuf[i]);
   }
   if (this->jerr.warning) retval = -1;
   return retval;
@@ -1509,7 +2717,7 @@ DLLEXPORT int tj3CompressFromYUVPlanes8(tjhandle handle,
     THROW("Instance has not been initialized for compression");
 
   if (!srcPlanes || !srcPlanes[0] || width <= 0 || height <= 0 ||
-      jpegBuf == NULL || jpegSize == NULL)
+      (jpegBuf == NULL && !this->chunkSize) || jpegSize == NULL)
     THROW("Invalid argument");
   if (this->subsamp != TJSAMP_GRAY && (!srcPlanes[1] || !srcPlanes[2]))
     THROW("Invalid argument");
@@ -1528,10 +2736,7 @@ DLLEXPORT int tj3CompressFromYUVPlanes8(tjhandle handle,
   cinfo->image_height = height;
   cinfo->data_precision = 8;
 
-  if (this->noRealloc) {
-    alloc = FALSE;  *jpegSize = tj3JPEGBufSize(width, height, this->subsamp);
-  }
-  jpeg_mem_dest_tj(cinfo, jpegBuf, jpegSize, alloc);
+  alloc = setJPEGDestination(this, jpegBuf, jpegSize, width, height);
   setCompDefaults(this, TJPF_RGB);
   cinfo->raw_data_in = TRUE;
 
@@ -1549,7 +2754,7 @@ DLLEXPORT int tj3CompressFromYUVPlanes8(tjhandle handle,
     if (iw[i] != pw[i] || ih != ph[i]) usetmpbuf = 1;
     th[i] = compptr->v_samp_factor * DCTSIZE;
     tmpbufsize += iw[i] * th[i];
-    if ((inbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * ph[i])) == NULL)
+    if ((inbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * ph[i])) == NULL)
       THROW("Memory allocation failure");
     ptr = (JSAMPLE *)srcPlanes[i];
     for (row = 0; row < ph[i]; row++) {
@@ -1558,11 +2763,12 @@ DLLEXPORT int tj3CompressFromYUVPlanes8(tjhandle handle,
     }
   }
   if (usetmpbuf) {
-    if ((_tmpbuf = (JSAMPLE *)malloc(sizeof(JSAMPLE) * tmpbufsize)) == NULL)
+    if ((_tmpbuf =
+         (JSAMPLE *)MALLOC_LARGE(sizeof(JSAMPLE) * tmpbufsize)) == NULL)
       THROW("Memory allocation failure");
     ptr = _tmpbuf;
     for (i = 0; i < cinfo->num_components; i++) {
-      if ((tmpbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * th[i])) == NULL)
+      if ((tmpbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * th[i])) == NULL)
         THROW("Memory allocation failure");
       for (row = 0; row < th[i]; row++) {
         tmpbuf[i][row] = ptr;
@@ -1611,10 +2817,10 @@ bailout:
   if (cinfo->global_state > CSTATE_START || retval == -1)
     jpeg_abort_compress(cinfo);
   for (i = 0; i < MAX_COMPONENTS; i++) {
-    free(tmpbuf[i]);
-    free(inbuf[i]);
+    FREE(tmpbuf[i]);
+    FREE(inbuf[i]);
   }
-  free(_tmpbuf);
+  FREE(_tmpbuf);
   if (this->jerr.warning) retval = -1;
   return retval;
 }
@@ -2024,6 +3230,264 @@ DLLEXPORT int tjDecompress(tjhandle handle, unsigned char *jpegBuf,
 }
 
 
+/* Convert an IEEE single-precision floating point value to half precision,
+   rounding to the nearest even value.  The function has no branches, so the
+   compiler can vectorize loops that call it. */
+static unsigned short floatToHalf(float f)
+{
+  union {
+    float f;
+    unsigned int u;
+  } v, absv;
+  unsigned int a, normal, subnormal, isSubnormal, isInfinite, isNaN, h;
+
+  v.f = f;
+  a = v.u & 0x7FFFFFFF;
+
+  /* Rebias the exponent, and round the mantissa to 10 bits.  A carry out of
+     the mantissa correctly increments the exponent. */
+  normal = (a - ((127 - 15) << 23) + 0xFFF + ((a >> 13) & 1)) >> 13;
+
+  /* Adding 0.5 to a value less than 2^-14 leaves a single-precision value
+     whose least significant mantissa bit has the same weight (2^-24) as that
+     of a half-precision subnormal value, so the FPU performs the rounding. */
+  absv.u = a;
+  absv.f += 0.5f;
+  subnormal = absv.u - 0x3F000000;
+
+  /* Select the result using masks rather than conditional expressions.
+     Otherwise, the compiler may move the floating point addition into a
+     branch, which prevents vectorization. */
+  isSubnormal = 0U - (unsigned int)(a < ((127 - 14) << 23));
+  isInfinite = 0U - (unsigned int)(a >= 0x477FF000);
+  isNaN = 0U - (unsigned int)(a > 0x7F800000);
+  h = (subnormal & isSubnormal) | (normal & ~isSubnormal);
+  h = (h & ~isInfinite) | (0x7C00 & isInfinite) | (0x200 & isNaN);
+  return (unsigned short)(((v.u >> 16) & 0x8000) | h);
+}
+
+
+/* Convert n samples, spaced srcStep samples apart, into consecutive tensor
+   elements, applying a separate scale factor and offset to each.  Both the
+   destination and the scale factors/offsets are contiguous, so the compiler
+   can vectorize all three loops. */
+static void samplesToElements(const JSAMPLE *src, int srcStep,
+                              const float *scale, const float *bias, int n,
+                              int type, void *dstBuf)
+{
+  int i;
+
+  switch (type) {
+  case TJTT_FLOAT32:
+    {
+      float *dst = (float *)dstBuf;
+
+      for (i = 0; i < n; i++)
+        dst[i] = (float)src[i * srcStep] * scale[i] + bias[i];
+    }
+    break;
+  case TJTT_FLOAT16:
+    {
+      unsigned short *dst = (unsigned short *)dstBuf;
+
+      for (i = 0; i < n; i++)
+        dst[i] = floatToHalf((float)src[i * srcStep] * scale[i] + bias[i]);
+    }
+    break;
+  default:
+    {
+      signed char *dst = (signed char *)dstBuf;
+
+      for (i = 0; i < n; i++) {
+        float val = (float)src[i * srcStep] * scale[i] + bias[i];
+
+        /* Round before clamping, so that no floating point operation depends
+           on the result of a comparison. */
+        val += val < 0.0f ? -0.5f : 0.5f;
+        val = val < -128.0f ? -128.0f : val;
+        val = val > 127.0f ? 127.0f : val;
+        dst[i] = (signed char)val;
+      }
+    }
+  }
+}
+
+
+/* Convert a strip of decompressed rows into tensor elements.  scaleRow and
+   biasRow contain the scale factor and offset for each element of a tensor
+   row (interleaved) or of each channel's row (planar, one channel after
+   another.) */
+static void samplesToTensor(JSAMPARRAY rows, int numRows, int startRow,
+                            int width, int height, int nc, boolean bottomUp,
+                            const tjtensor *tensor, const float *scaleRow,
+                            const float *biasRow, void *dstBuf)
+{
+  int c, y, elementSize = tensor->type == TJTT_FLOAT32 ? 4 :
+                          (tensor->type == TJTT_FLOAT16 ? 2 : 1);
+
+  for (y = 0; y < numRows; y++) {
+    int dstRow = bottomUp ? height - startRow - y - 1 : startRow + y;
+
+    if (tensor->planar) {
+      for (c = 0; c < nc; c++)
+        samplesToElements(&rows[y][c], nc, &scaleRow[c * width],
+                          &biasRow[c * width], width, tensor->type,
+                          (char *)dstBuf + ((size_t)c * height + dstRow) *
+                                           width * elementSize);
+    } else
+      samplesToElements(rows[y], 1, scaleRow, biasRow, width * nc,
+                        tensor->type,
+                        (char *)dstBuf + (size_t)dstRow * width * nc *
+                                         elementSize);
+  }
+}
+
+
+/* Number of rows that tj3DecompressToTensor8() decompresses before converting
+   them into tensor elements */
+#define TENSOR_STRIP_HEIGHT  16
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3DecompressToTensor8(tjhandle handle,
+                                     const unsigned char *jpegBuf,
+                                     size_t jpegSize, void *dstBuf,
+                                     int pixelFormat, const tjtensor *tensor)
+{
+  static const char FUNCTION_NAME[] = "tj3DecompressToTensor8";
+  JSAMPROW strip[TENSOR_STRIP_HEIGHT];
+  JSAMPLE *stripBuf = NULL;
+  float *scaleRow = NULL, *biasRow;
+  int width, height, nc, scaledWidth, numRows, c, i, x, y, retval = 0;
+  struct my_progress_mgr progress;
+
+  GET_DINSTANCE(handle);
+  if ((this->init & DECOMPRESS) == 0)
+    THROW("Instance has not been initialized for decompression");
+
+  if (jpegBuf == NULL || jpegSize <= 0 || dstBuf == NULL ||
+      pixelFormat < 0 || pixelFormat >= TJ_NUMPF || tensor == NULL ||
+      tensor->type < 0 || tensor->type >= TJ_NUMTT)
+    THROW("Invalid argument");
+  if (pixelFormat != TJPF_RGB && pixelFormat != TJPF_BGR &&
+      pixelFormat != TJPF_GRAY && pixelFormat != TJPF_CMYK)
+    THROW("Unsupported pixel format");
+  nc = tjPixelSize[pixelFormat];
+
+  if (this->scanLimit || this->collectStats) {
+    memset(&progress, 0, sizeof(struct my_progress_mgr));
+    progress.pub.progress_monitor = my_progress_monitor;
+    progress.this = this;
+    dinfo->progress = &progress.pub;
+  } else
+    dinfo->progress = NULL;
+  if (this->collectStats) startDecompStats(this);
+
+  dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
+
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  if (dinfo->global_state <= DSTATE_INHEADER) {
+    jpeg_mem_src_tj(dinfo, jpegBuf, jpegSize);
+    jpeg_read_header(dinfo, TRUE);
+  }
+  setDecompParameters(this);
+  if (this->maxPixels &&
+      (unsigned long long)this->jpegWidth * this->jpegHeight >
+      (unsigned long long)this->maxPixels)
+    THROW("Image is too large");
+  this->dinfo.out_color_space = pf2cs[pixelFormat];
+  scaledWidth = TJSCALED(dinfo->image_width, this->scalingFactor);
+  dinfo->do_fancy_upsampling = !this->fastUpsample;
+  dinfo->master->color_matrix = (J_COLOR_MATRIX)this->colorMatrix;
+  this->dinfo.dct_method = this->fastDCT ? JDCT_FASTEST : JDCT_ISLOW;
+
+  dinfo->scale_num = this->scalingFactor.num;
+  dinfo->scale_denom = this->scalingFactor.denom;
+
+  jpeg_start_decompress(dinfo);
+
+  if (this->croppingRegion.x != 0 ||
+      (this->croppingRegion.w != 0 && this->croppingRegion.w != scaledWidth)) {
+    JDIMENSION crop_x = this->croppingRegion.x;
+    JDIMENSION crop_w = this->croppingRegion.w;
+
+    jpeg_crop_scanline(dinfo, &crop_x, &crop_w);
+    if ((int)crop_x != this->croppingRegion.x)
+      THROWI("Unexplained mismatch between specified (%d) and\n"
+             "actual (%d) cropping region left boundary",
+             this->croppingRegion.x, (int)crop_x);
+    if ((int)crop_w != this->croppingRegion.w)
+      THROWI("Unexplained mismatch between specified (%d) and\n"
+             "actual (%d) cropping region width",
+             this->croppingRegion.w, (int)crop_w);
+  }
+
+  width = dinfo->output_width;
+  height = dinfo->output_height;
+  if (this->croppingRegion.y != 0 || this->croppingRegion.h != 0)
+    height = this->croppingRegion.h;
+
+  if ((stripBuf = (JSAMPLE *)MALLOC_LARGE((size_t)width * nc *
+                                          TENSOR_STRIP_HEIGHT)) == NULL ||
+      (scaleRow = (float *)MALLOC(sizeof(float) * width * nc * 2)) == NULL)
+    THROW("Memory allocation failure");
+  if (setjmp(this->jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+  for (i = 0; i < TENSOR_STRIP_HEIGHT; i++)
+    strip[i] = &stripBuf[(size_t)width * nc * i];
+  biasRow = &scaleRow[width * nc];
+  for (c = 0; c < nc; c++) {
+    for (x = 0; x < width; x++) {
+      i = tensor->planar ? c * width + x : x * nc + c;
+      scaleRow[i] = tensor->scale[c];
+      biasRow[i] = tensor->bias[c];
+    }
+  }
+
+  if (this->croppingRegion.y != 0) {
+    JDIMENSION lines = jpeg_skip_scanlines(dinfo, this->croppingRegion.y);
+
+    if ((int)lines != this->croppingRegion.y)
+      THROWI("Unexplained mismatch between specified (%d) and\n"
+             "actual (%d) cropping region upper boundary",
+             this->croppingRegion.y, (int)lines);
+  }
+  for (y = 0; y < height; y += numRows) {
+    numRows = height - y < TENSOR_STRIP_HEIGHT ?
+              height - y : TENSOR_STRIP_HEIGHT;
+    for (i = 0; i < numRows; )
+      i += jpeg_read_scanlines(dinfo, &strip[i], numRows - i);
+    samplesToTensor(strip, numRows, y, width, height, nc, this->bottomUp,
+                    tensor, scaleRow, biasRow, dstBuf);
+  }
+  if (dinfo->output_scanline < dinfo->output_height) {
+    JDIMENSION lines = jpeg_skip_scanlines(dinfo, dinfo->output_height -
+                                                  dinfo->output_scanline);
+
+    if ((int)lines !=
+        (int)dinfo->output_height - this->croppingRegion.y - height)
+      THROWI("Unexplained mismatch between specified (%d) and\n"
+             "actual (%d) cropping region lower boundary",
+             this->croppingRegion.y + height,
+             (int)(dinfo->output_height - lines));
+  }
+  jpeg_finish_decompress(dinfo);
+
+bailout:
+  if (this->collectStats) finishDecompStats(this, jpegSize);
+  if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
+  FREE(stripBuf);
+  FREE(scaleRow);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+
 static void setDecodeDefaults(tjinstance *this, int pixelFormat)
 {
   int i;
@@ -2062,6 +3526,7 @@ static void setDecodeDefaults(tjinstance *this, int pixelFormat)
   }
 
   this->dinfo.mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
+  this->dinfo.master->color_matrix = (J_COLOR_MATRIX)this->colorMatrix;
 }
 
 
@@ -2144,7 +3609,7 @@ DLLEXPORT int tj3DecodeYUVPlanes8(tjhandle handle,
 
   if (pitch == 0) pitch = dinfo->output_width * tjPixelSize[pixelFormat];
 
-  if ((row_pointer = (JSAMPROW *)malloc(sizeof(JSAMPROW) * ph0)) == NULL)
+  if ((row_pointer = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * ph0)) == NULL)
     THROW("Memory allocation failure");
   for (i = 0; i < height; i++) {
     if (this->bottomUp)
@@ -2158,11 +3623,11 @@ DLLEXPORT int tj3DecodeYUVPlanes8(tjhandle handle,
   for (i = 0; i < dinfo->num_components; i++) {
     compptr = &dinfo->comp_info[i];
     _tmpbuf[i] =
-      (JSAMPLE *)malloc(PAD(compptr->width_in_blocks * DCTSIZE, 32) *
+      (JSAMPLE *)MALLOC_LARGE(PAD(compptr->width_in_blocks * DCTSIZE, 32) *
                         compptr->v_samp_factor + 32);
     if (!_tmpbuf[i])
       THROW("Memory allocation failure");
-    tmpbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * compptr->v_samp_factor);
+    tmpbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * compptr->v_samp_factor);
     if (!tmpbuf[i])
       THROW("Memory allocation failure");
     for (row = 0; row < compptr->v_samp_factor; row++) {
@@ -2174,7 +3639,7 @@ DLLEXPORT int tj3DecodeYUVPlanes8(tjhandle handle,
     }
     pw[i] = pw0 * compptr->h_samp_factor / dinfo->max_h_samp_factor;
     ph[i] = ph0 * compptr->v_samp_factor / dinfo->max_v_samp_factor;
-    inbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * ph[i]);
+    inbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * ph[i]);
     if (!inbuf[i])
       THROW("Memory allocation failure");
     ptr = (JSAMPLE *)srcPlanes[i];
@@ -2205,11 +3670,11 @@ DLLEXPORT int tj3DecodeYUVPlanes8(tjhandle handle,
 
 bailout:
   if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
-  free(row_pointer);
+  FREE(row_pointer);
   for (i = 0; i < MAX_COMPONENTS; i++) {
-    free(tmpbuf[i]);
-    free(_tmpbuf[i]);
-    free(inbuf[i]);
+    FREE(tmpbuf[i]);
+    FREE(_tmpbuf[i]);
+    FREE(inbuf[i]);
   }
   if (this->jerr.warning) retval = -1;
   return retval;
@@ -2340,13 +3805,14 @@ DLLEXPORT int tj3DecompressToYUVPlanes8(tjhandle handle,
   if (jpegBuf == NULL || jpegSize <= 0 || !dstPlanes || !dstPlanes[0])
     THROW("Invalid argument");
 
-  if (this->scanLimit) {
+  if (this->scanLimit || this->collectStats) {
     memset(&progress, 0, sizeof(struct my_progress_mgr));
     progress.pub.progress_monitor = my_progress_monitor;
     progress.this = this;
     dinfo->progress = &progress.pub;
   } else
     dinfo->progress = NULL;
+  if (this->collectStats) startDecompStats(this);
 
   dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
 
@@ -2390,7 +3856,7 @@ DLLEXPORT int tj3DecompressToYUVPlanes8(tjhandle handle,
     if (iw[i] != pw[i] || ih != ph[i]) usetmpbuf = 1;
     th[i] = compptr->v_samp_factor * dctsize;
     tmpbufsize += iw[i] * th[i];
-    if ((outbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * ph[i])) == NULL)
+    if ((outbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * ph[i])) == NULL)
       THROW("Memory allocation failure");
     ptr = dstPlanes[i];
     for (row = 0; row < ph[i]; row++) {
@@ -2399,11 +3865,12 @@ DLLEXPORT int tj3DecompressToYUVPlanes8(tjhandle handle,
     }
   }
   if (usetmpbuf) {
-    if ((_tmpbuf = (JSAMPLE *)malloc(sizeof(JSAMPLE) * tmpbufsize)) == NULL)
+    if ((_tmpbuf =
+         (JSAMPLE *)MALLOC_LARGE(sizeof(JSAMPLE) * tmpbufsize)) == NULL)
       THROW("Memory allocation failure");
     ptr = _tmpbuf;
     for (i = 0; i < dinfo->num_components; i++) {
-      if ((tmpbuf[i] = (JSAMPROW *)malloc(sizeof(JSAMPROW) * th[i])) == NULL)
+      if ((tmpbuf[i] = (JSAMPROW *)MALLOC(sizeof(JSAMPROW) * th[i])) == NULL)
         THROW("Memory allocation failure");
       for (row = 0; row < th[i]; row++) {
         tmpbuf[i][row] = ptr;
@@ -2468,12 +3935,13 @@ DLLEXPORT int tj3DecompressToYUVPlanes8(tjhandle handle,
   jpeg_finish_decompress(dinfo);
 
 bailout:
+  if (this->collectStats) finishDecompStats(this, jpegSize);
   if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
   for (i = 0; i < MAX_COMPONENTS; i++) {
-    free(tmpbuf[i]);
-    free(outbuf[i]);
+    FREE(tmpbuf[i]);
+    FREE(outbuf[i]);
   }
-  free(_tmpbuf);
+  FREE(_tmpbuf);
   if (this->jerr.warning) retval = -1;
   return retval;
 }
@@ -2657,6 +4125,33 @@ DLLEXPORT tjhandle tjInitTransform(void)
 }
 
 
+/* Set up the transupp transform info for a TurboJPEG transform.  (The fields
+   that depend on the number of simultaneous transforms are set by the
+   caller.) */
+static void setTransformInfo(jpeg_transform_info *xinfo,
+                             const tjtransform *t)
+{
+  xinfo->transform = xformtypes[t->op];
+  xinfo->perfect = (t->options & TJXOPT_PERFECT) ? 1 : 0;
+  xinfo->trim = (t->options & TJXOPT_TRIM) ? 1 : 0;
+  xinfo->force_grayscale = (t->options & TJXOPT_GRAY) ? 1 : 0;
+  xinfo->crop = (t->options & TJXOPT_CROP) ? 1 : 0;
+  xinfo->requant = (t->options & TJXOPT_REQUANT) ? 1 : 0;
+
+  if (xinfo->crop) {
+    xinfo->crop_xoffset = t->r.x;  xinfo->crop_xoffset_set = JCROP_POS;
+    xinfo->crop_yoffset = t->r.y;  xinfo->crop_yoffset_set = JCROP_POS;
+    if (t->r.w != 0) {
+      xinfo->crop_width = t->r.w;  xinfo->crop_width_set = JCROP_POS;
+    } else
+      xinfo->crop_width = JCROP_UNSET;
+    if (t->r.h != 0) {
+      xinfo->crop_height = t->r.h;  xinfo->crop_height_set = JCROP_POS;
+    } else
+      xinfo->crop_height = JCROP_UNSET;
+  }
+}
+
 /* TurboJPEG 3+ */
 DLLEXPORT int tj3Transform(tjhandle handle, const unsigned char *jpegBuf,
                            size_t jpegSize, int n, unsigned char **dstBufs,
@@ -2673,22 +4168,25 @@ DLLEXPORT int tj3Transform(tjhandle handle, const unsigned char *jpegBuf,
   if ((this->init & COMPRESS) == 0 || (this->init & DECOMPRESS) == 0)
     THROW("Instance has not been initialized for transformation");
 
-  if (jpegBuf == NULL || jpegSize <= 0 || n < 1 || dstBufs == NULL ||
-      dstSizes == NULL || t == NULL)
+  if (jpegBuf == NULL || jpegSize <= 0 || n < 1 ||
+      (dstBufs == NULL && !this->chunkSize) || dstSizes == NULL || t == NULL)
     THROW("Invalid argument");
+  if (this->chunkSize && n > 1)
+    THROW("TJPARAM_CHUNKSIZE cannot be used with multiple transforms");
 
-  if (this->scanLimit) {
+  if (this->scanLimit || this->collectStats) {
     memset(&progress, 0, sizeof(struct my_progress_mgr));
     progress.pub.progress_monitor = my_progress_monitor;
     progress.this = this;
     dinfo->progress = &progress.pub;
   } else
     dinfo->progress = NULL;
+  if (this->collectStats) startDecompStats(this);
 
   dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
 
   if ((xinfo =
-       (jpeg_transform_info *)malloc(sizeof(jpeg_transform_info) * n)) == NULL)
+       (jpeg_transform_info *)MALLOC(sizeof(jpeg_transform_info) * n)) == NULL)
     THROW("Memory allocation failure");
   memset(xinfo, 0, sizeof(jpeg_transform_info) * n);
 
@@ -2703,26 +4201,12 @@ DLLEXPORT int tj3Transform(tjhandle handle, const unsigned char *jpegBuf,
   for (i = 0; i < n; i++) {
     if (t[i].op < 0 || t[i].op >= TJ_NUMXOP)
       THROW("Invalid transform operation");
-    xinfo[i].transform = xformtypes[t[i].op];
-    xinfo[i].perfect = (t[i].options & TJXOPT_PERFECT) ? 1 : 0;
-    xinfo[i].trim = (t[i].options & TJXOPT_TRIM) ? 1 : 0;
-    xinfo[i].force_grayscale = (t[i].options & TJXOPT_GRAY) ? 1 : 0;
-    xinfo[i].crop = (t[i].options & TJXOPT_CROP) ? 1 : 0;
-    if (n != 1 && t[i].op == TJXOP_HFLIP) xinfo[i].slow_hflip = 1;
+    setTransformInfo(&xinfo[i], &t[i]);
+    if (n != 1 && (t[i].op == TJXOP_HFLIP || xinfo[i].requant))
+      xinfo[i].slow_hflip = 1;
     else xinfo[i].slow_hflip = 0;
-
-    if (xinfo[i].crop) {
-      xinfo[i].crop_xoffset = t[i].r.x;  xinfo[i].crop_xoffset_set = JCROP_POS;
-      xinfo[i].crop_yoffset = t[i].r.y;  xinfo[i].crop_yoffset_set = JCROP_POS;
-      if (t[i].r.w != 0) {
-        xinfo[i].crop_width = t[i].r.w;  xinfo[i].crop_width_set = JCROP_POS;
-      } else
-        xinfo[i].crop_width = JCROP_UNSET;
-      if (t[i].r.h != 0) {
-        xinfo[i].crop_height = t[i].r.h;  xinfo[i].crop_height_set = JCROP_POS;
-      } else
-        xinfo[i].crop_height = JCROP_UNSET;
-    }
+    if (xinfo[i].requant && this->quality == -1)
+      THROW("TJXOPT_REQUANT requires TJPARAM_QUALITY to be set");
     if (!(t[i].options & TJXOPT_COPYNONE)) saveMarkers = 1;
   }
 
@@ -2764,13 +4248,24 @@ DLLEXPORT int tj3Transform(tjhandle handle, const unsigned char *jpegBuf,
     } else {
       w = xinfo[i].crop_width;  h = xinfo[i].crop_height;
     }
-    if (this->noRealloc) {
-      alloc = FALSE;  dstSizes[i] = tj3JPEGBufSize(w, h, this->subsamp);
-    }
     if (!(t[i].options & TJXOPT_NOOUTPUT))
-      jpeg_mem_dest_tj(cinfo, &dstBufs[i], &dstSizes[i], alloc);
+      alloc = setJPEGDestination(this, dstBufs ? &dstBufs[i] : NULL,
+                                 &dstSizes[i], w, h);
     jpeg_copy_critical_parameters(dinfo, cinfo);
     dstcoefs = jtransform_adjust_parameters(dinfo, cinfo, srccoefs, &xinfo[i]);
+    if (xinfo[i].requant) {
+      int ci;
+
+      /* Replace the quantization tables with the standard tables scaled to
+         TJPARAM_QUALITY, and assign them to components in the same way that
+         jpeg_set_colorspace() would.  jtransform_execute_transformation()
+         requantizes the coefficients accordingly. */
+      jpeg_set_quality(cinfo, this->quality, TRUE);
+      for (ci = 0; ci < cinfo->num_components; ci++)
+        cinfo->comp_info[ci].quant_tbl_no =
+          (ci == 1 || ci == 2) && (cinfo->jpeg_color_space == JCS_YCbCr ||
+                                   cinfo->jpeg_color_space == JCS_YCCK);
+    }
     if (this->optimize || t[i].options & TJXOPT_OPTIMIZE)
       cinfo->optimize_coding = TRUE;
 #ifdef C_PROGRESSIVE_SUPPORTED
@@ -2823,12 +4318,124 @@ DLLEXPORT int tj3Transform(tjhandle handle, const unsigned char *jpegBuf,
   jpeg_finish_decompress(dinfo);
 
 bailout:
+  if (this->collectStats) finishDecompStats(this, jpegSize);
   if (cinfo->global_state > CSTATE_START) {
     if (alloc) (*cinfo->dest->term_destination) (cinfo);
     jpeg_abort_compress(cinfo);
   }
   if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
-  free(xinfo);
+  FREE(xinfo);
+  if (this->jerr.warning) retval = -1;
+  return retval;
+}
+
+
+/* Longjmp value used by estimate_progress_monitor() */
+#define ESTIMATE_DONE  2
+
+/* tj3EstimateMemory() uses this progress monitor to stop the library once all
+   of the active modules have been initialized and before any entropy-coded
+   data is consumed. */
+static void estimate_progress_monitor(j_common_ptr dinfo)
+{
+  my_error_ptr myerr = (my_error_ptr)dinfo->err;
+
+  longjmp(myerr->setjmp_buffer, ESTIMATE_DONE);
+}
+
+/* TurboJPEG 3.1+ */
+DLLEXPORT int tj3EstimateMemory(tjhandle handle, const unsigned char *jpegBuf,
+                                size_t jpegSize, int pixelFormat,
+                                const tjtransform *transform,
+                                size_t *memSize)
+{
+  static const char FUNCTION_NAME[] = "tj3EstimateMemory";
+  int retval = 0;
+  jpeg_transform_info xinfo;
+  struct jpeg_progress_mgr progress;
+
+  GET_DINSTANCE(handle);
+  if ((this->init & DECOMPRESS) == 0)
+    THROW("Instance has not been initialized for decompression");
+  if (transform != NULL && (this->init & COMPRESS) == 0)
+    THROW("Instance has not been initialized for transformation");
+
+  if (jpegBuf == NULL || jpegSize <= 0 || memSize == NULL ||
+      (transform == NULL &&
+       (pixelFormat < 0 || pixelFormat >= TJ_NUMPF)) ||
+      (transform != NULL &&
+       (transform->op < 0 || transform->op >= TJ_NUMXOP)))
+    THROW("Invalid argument");
+
+  memset(&progress, 0, sizeof(struct jpeg_progress_mgr));
+  progress.progress_monitor = estimate_progress_monitor;
+  dinfo->progress = &progress;
+
+  dinfo->mem->max_memory_to_use = (long)this->maxMemory * 1048576L;
+
+  switch (setjmp(this->jerr.setjmp_buffer)) {
+  case 0:
+    break;
+  case ESTIMATE_DONE:
+    goto done;
+  default:
+    /* If we get here, the JPEG code has signaled an error. */
+    retval = -1;  goto bailout;
+  }
+
+  /* Set up the operation in the same way as tj3Decompress*() or
+     tj3Transform(), but put the memory manager into estimation mode so that
+     the whole-image buffers are accounted for rather than allocated. */
+  if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
+  jpeg_mem_peak((j_common_ptr)dinfo, TRUE);
+  jpeg_mem_src_tj(dinfo, jpegBuf, jpegSize);
+  if (transform != NULL) {
+    memset(&xinfo, 0, sizeof(jpeg_transform_info));
+    setTransformInfo(&xinfo, transform);
+    jcopy_markers_setup(dinfo, (transform->options & TJXOPT_COPYNONE) ?
+                               JCOPYOPT_NONE : JCOPYOPT_ALL);
+  }
+  jpeg_read_header(dinfo, TRUE);
+  jpeg_mem_estimate((j_common_ptr)dinfo);
+
+  if (transform != NULL) {
+    if (this->maxPixels &&
+        (unsigned long long)dinfo->image_width * dinfo->image_height >
+        (unsigned long long)this->maxPixels)
+      THROW("Image is too large");
+    if (!jtransform_request_workspace(dinfo, &xinfo))
+      THROW("Transform is not perfect");
+    jpeg_read_coefficients(dinfo);
+  } else {
+    setDecompParameters(this);
+    if (this->maxPixels &&
+        (unsigned long long)this->jpegWidth * this->jpegHeight >
+        (unsigned long long)this->maxPixels)
+      THROW("Image is too large");
+    dinfo->out_color_space = pf2cs[pixelFormat];
+    dinfo->do_fancy_upsampling = !this->fastUpsample;
+    dinfo->master->color_matrix = (J_COLOR_MATRIX)this->colorMatrix;
+    dinfo->dct_method = this->fastDCT ? JDCT_FASTEST : JDCT_ISLOW;
+    dinfo->scale_num = this->scalingFactor.num;
+    dinfo->scale_denom = this->scalingFactor.denom;
+    jpeg_start_decompress(dinfo);
+  }
+
+done:
+  *memSize = jpeg_mem_peak((j_common_ptr)dinfo, FALSE);
+  if (transform == NULL) {
+    /* The decompression functions also allocate one row pointer per row of
+       the (cropped) destination image.  Cropping does not otherwise reduce the
+       memory usage. */
+    if (this->croppingRegion.y != 0 || this->croppingRegion.h != 0)
+      *memSize += sizeof(JSAMPROW) * this->croppingRegion.h;
+    else
+      *memSize += sizeof(JSAMPROW) * dinfo->output_height;
+  }
+
+bailout:
+  if (dinfo->global_state > DSTATE_START) jpeg_abort_decompress(dinfo);
+  dinfo->progress = NULL;
   if (this->jerr.warning) retval = -1;
   return retval;
 }
@@ -425,6 +425,43 @@ enum TJCS {
 };
 
 
+/**
+ * The number of color matrices
+ */
+#define TJ_NUMCM  4
+
+/**
+ * Color matrices
+ *
+ * The color matrix determines how RGB pixels are converted to and from YCbCr
+ * (see #TJPARAM_COLORMATRIX.)
+ */
+enum TJCM {
+  /**
+   * ITU-R BT.601, full range.  This is the color matrix specified by JFIF,
+   * and it is the only color matrix that other JPEG decompressors can be
+   * expected to assume.
+   */
+  TJCM_BT601,
+  /**
+   * ITU-R BT.601, limited range.  Y is in the range [16, 235], and Cb and Cr
+   * are in the range [16, 240] (scaled to the data precision.)  This is the
+   * color matrix typically used with standard-definition video.
+   */
+  TJCM_BT601_LIMITED,
+  /**
+   * ITU-R BT.709, full range
+   */
+  TJCM_BT709,
+  /**
+   * ITU-R BT.709, limited range.  Y is in the range [16, 235], and Cb and Cr
+   * are in the range [16, 240] (scaled to the data precision.)  This is the
+   * color matrix typically used with high-definition video.
+   */
+  TJCM_BT709_LIMITED
+};
+
+
 /**
  * Parameters
  */
@@ -465,7 +502,7 @@ enum TJPARAM {
    * **Value**
    * - `1`-`100` (`1` = worst quality but best compression, `100` = best
    * quality but worst compression) *[no default; must be explicitly
-   * specified]*
+   * specified unless #TJPARAM_TARGETSIZE is set]*
    */
   TJPARAM_QUALITY,
   /**
@@ -554,10 +591,18 @@ enum TJPARAM {
    * - `1` Optimal Huffman tables will be computed for the JPEG image.  For
    * lossless transformation, this can also be specified using
    * #TJXOPT_OPTIMIZE.
+   * - `2` Approximately optimal Huffman tables will be computed for the JPEG
+   * image from a representative subset of its MCU rows, and the image will
+   * then be compressed in a single pass.  This applies only to
+   * 8-bit-per-sample baseline (non-progressive, non-arithmetic) compression
+   * using #tj3Compress8().  Otherwise, or if the image is too small for
+   * sampling to be worthwhile, `2` is equivalent to `1`.
    *
    * Optimized baseline entropy coding will improve compression slightly
    * (generally 5% or less), but it will reduce compression performance
-   * considerably.
+   * considerably.  Approximately optimal baseline entropy coding achieves most
+   * of the same improvement at a fraction of the cost, and it does not require
+   * the whole image to be buffered in the DCT domain.
    */
   TJPARAM_OPTIMIZE,
   /**
@@ -785,6 +830,11 @@ enum TJPARAM {
    * intermediate buffers, which are used with progressive JPEG compression and
    * decompression, optimized baseline entropy coding, lossless JPEG
    * compression, and lossless transformation *[default: `0` (no limit)]*
+   *
+   * On Un*x systems, intermediate buffers that do not fit within this limit
+   * are stored in an anonymous temporary file (created in the directory
+   * specified by the `TMPDIR` environment variable, or in /tmp if `TMPDIR` is
+   * not set.)  On Windows, exceeding this limit causes an error.
    */
   TJPARAM_MAXMEMORY,
   /**
@@ -800,7 +850,90 @@ enum TJPARAM {
    * - maximum number of pixels that the decompression, transform, and image
    * loading functions will process *[default: `0` (no limit)]*
    */
-  TJPARAM_MAXPIXELS
+  TJPARAM_MAXPIXELS,
+  /**
+   * Target JPEG image size [8-bit-per-sample lossy compression only]
+   *
+   * Setting this parameter causes #tj3Compress8() to generate a JPEG image
+   * using the highest quality level that produces a JPEG image no larger than
+   * the specified size.  If #TJPARAM_QUALITY is set, then its value is the
+   * highest quality level that will be considered.  Color conversion,
+   * chrominance subsampling, and the forward DCT are performed only once,
+   * and only quantization and entropy coding are repeated while searching for
+   * the quality level.  If the JPEG image is too large even with a quality
+   * level of 1, then that JPEG image is returned, and #tj3Compress8() issues
+   * a warning.
+   *
+   * **Value**
+   * - maximum size (in bytes) of the JPEG image *[default: `0` (no limit)]*
+   */
+  TJPARAM_TARGETSIZE,
+  /**
+   * Chunked JPEG output [compression, lossless transformation]
+   *
+   * Setting this parameter causes the compression and transform functions to
+   * write the JPEG image into a list of fixed-size chunks owned by the
+   * TurboJPEG instance, rather than into a single contiguous JPEG buffer.
+   * When the JPEG image outgrows a chunk, the next chunk is used, so the data
+   * written so far is never reallocated or copied.  The chunk list can be
+   * retrieved with #tj3GetChunks() (for instance, in order to pass it to
+   * `writev()`), and the chunks are reused by subsequent compression or
+   * transform operations, so no memory is allocated once the chunk list is
+   * large enough to hold the largest JPEG image.  When this parameter is set,
+   * the `jpegBuf` argument of the compression functions and the `dstBufs`
+   * argument of #tj3Transform() are ignored and can be NULL,
+   * #TJPARAM_NOREALLOC is ignored, and the `jpegSize` and `dstSizes`
+   * arguments receive the total size of the JPEG image.  Chunked output cannot
+   * be used with #tj3CompressMulti8() or with multiple simultaneous
+   * transforms.
+   *
+   * **Value**
+   * - size (in bytes) of each chunk *[default: `0` (chunked output
+   * disabled)]*
+   */
+  TJPARAM_CHUNKSIZE,
+  /**
+   * Decompression instrumentation [decompression, lossless transformation]
+   *
+   * **Value**
+   * - `0` *[default]* Do not collect statistics.  The decompression pipeline
+   * is not modified, so this has no cost.
+   * - `1` Collect timing and counter statistics for each decompression or
+   * lossless transform operation.  The statistics for the most recent
+   * operation can be retrieved with #tj3GetStats().  The decompression modules
+   * are timed individually, which adds a small amount of overhead (generally a
+   * few percent) to each operation.
+   */
+  TJPARAM_STATS,
+  /**
+   * Color matrix [lossy compression, decompression]
+   *
+   * This parameter specifies the color matrix that is used when converting
+   * RGB pixels to YCbCr (when compressing a packed-pixel image into a YCbCr
+   * JPEG image or encoding a packed-pixel image into a YUV image) or YCbCr
+   * pixels to RGB (when decompressing a YCbCr JPEG image into a packed-pixel
+   * image or decoding a YUV image into a packed-pixel image.)  Thus, planar
+   * YUV images produced from or consumed by video codecs can be encoded and
+   * decoded directly in the color matrix used by the video codec.  The color
+   * matrix does not affect conversion from RGB to grayscale or conversion to
+   * or from CMYK.  When decompressing a YCbCr JPEG image or decoding a YUV
+   * image into a grayscale image, a limited-range color matrix causes the
+   * luminance values to be expanded to the full range.  The SIMD color
+   * conversion routines support only the default color matrix, so other color
+   * matrices are slower.  Also, when decompressing with
+   * #TJPARAM_FASTUPSAMPLE set, chrominance upsampling and color conversion
+   * cannot be merged unless the default color matrix is used.
+   *
+   * YCbCr JPEG images generated with a non-default color matrix do not
+   * conform to the JFIF specification, so the JFIF APP0 marker is not written
+   * to them, and the same color matrix must be specified when decompressing
+   * them in order to obtain the correct colors.
+   *
+   * **Value**
+   * - One of the @ref TJCM "color matrices" *[default for compression and
+   * decompression: #TJCM_BT601]*
+   */
+  TJPARAM_COLORMATRIX
 };
 
 
@@ -943,6 +1076,20 @@ enum TJXOP {
  * will improve compression slightly (generally 5% or less.)
  */
 #define TJXOPT_OPTIMIZE  (1 << 8)
+/**
+ * This option will requantize the DCT coefficients of the JPEG image generated
+ * by this particular transform, using the standard quantization tables scaled
+ * to the JPEG quality level specified in #TJPARAM_QUALITY.  This reduces the
+ * size of the JPEG image without fully decompressing and recompressing it, so
+ * it is faster than recompression and avoids the generation loss caused by
+ * color conversion, chrominance resampling, and the inverse and forward DCTs.
+ * Quantization table entries that are finer than the corresponding entries
+ * in the source image are raised to match the source, since requantization
+ * cannot restore information that was discarded when the source image was
+ * compressed.  This option can be combined with any
+ * transform operation and with any other transform option.
+ */
+#define TJXOPT_REQUANT  (1 << 9)
 
 
 /**
@@ -990,6 +1137,216 @@ typedef struct {
  */
 static const tjregion TJUNCROPPED = { 0, 0, 0, 0 };
 
+/**
+ * JPEG output chunk
+ *
+ * The members of this structure are in the same order as the members of the
+ * POSIX `struct iovec`.
+ */
+typedef struct {
+  /**
+   * Pointer to the chunk data
+   */
+  unsigned char *buf;
+  /**
+   * Number of bytes of JPEG data in the chunk
+   */
+  size_t size;
+} tjchunk;
+
+
+/**
+ * The number of decompression stages
+ */
+#define TJ_NUMSTAGES  5
+
+/**
+ * Decompression stages (see #tjstats)
+ */
+enum TJSTAGE {
+  /**
+   * Entropy decoding (Huffman or arithmetic), including the reading of the
+   * entropy-coded data
+   */
+  TJSTAGE_ENTROPY,
+  /**
+   * Dequantization and inverse DCT (lossy) or undifferencing (lossless)
+   */
+  TJSTAGE_IDCT,
+  /**
+   * Chrominance upsampling.  If merged upsampling is used (see
+   * #TJPARAM_FASTUPSAMPLE), then this also includes color conversion.
+   */
+  TJSTAGE_UPSAMPLE,
+  /**
+   * Color conversion
+   */
+  TJSTAGE_COLOR,
+  /**
+   * Everything else, including marker parsing, memory allocation, buffer
+   * management, and copying the decompressed image into the destination
+   * buffer
+   */
+  TJSTAGE_OTHER
+};
+
+
+/**
+ * Decompression statistics (see #TJPARAM_STATS and #tj3GetStats())
+ */
+typedef struct {
+  /**
+   * Time (in nanoseconds) spent in each decompression stage, indexed by
+   * @ref TJSTAGE "stage"
+   */
+  unsigned long long stageNs[TJ_NUMSTAGES];
+  /**
+   * Total time (in nanoseconds) spent in the operation
+   */
+  unsigned long long totalNs;
+  /**
+   * Number of MCUs entropy-decoded.  (For progressive JPEG images, each MCU is
+   * counted once per scan in which it appears.)
+   */
+  unsigned long long mcus;
+  /**
+   * Number of DCT blocks entropy-decoded, counted in the same way as `mcus`
+   * (lossy JPEG images only)
+   */
+  unsigned long long blocks;
+  /**
+   * Number of bytes of JPEG data consumed
+   */
+  size_t bytesConsumed;
+  /**
+   * Number of scans read
+   */
+  int scans;
+  /**
+   * Peak amount of memory (in bytes) allocated by the libjpeg memory manager
+   * during the operation, not including the destination buffer or any memory
+   * allocated by the TurboJPEG API
+   */
+  size_t peakMemory;
+  /**
+   * Bitmask of the stages that used SIMD instructions (bit n is set if stage
+   * n, as defined in @ref TJSTAGE "Decompression stages", used SIMD
+   * instructions)
+   */
+  int simdStages;
+} tjstats;
+
+
+/**
+ * Custom memory allocator (see #tj3SetAllocator())
+ */
+typedef struct {
+  /**
+   * Allocate `size` bytes and return a pointer to the allocated memory, or
+   * NULL if the memory cannot be allocated.  The memory must be suitably
+   * aligned for any type.  `large` is non-zero if the memory will be used
+   * for image samples or DCT coefficients, which typically account for most
+   * of the memory used by an operation.  `opaque` is the value of
+   * #tjallocator::opaque.
+   */
+  void *(*alloc) (void *opaque, size_t size, int large);
+  /**
+   * Free memory that was allocated by #tjallocator::alloc.  `size` and
+   * `large` are the values that were passed to #tjallocator::alloc when the
+   * memory was allocated.
+   */
+  void (*free) (void *opaque, void *ptr, size_t size, int large);
+  /**
+   * Arbitrary pointer that is passed to #tjallocator::alloc and
+   * #tjallocator::free
+   */
+  void *opaque;
+} tjallocator;
+
+
+/**
+ * The number of tensor element types
+ */
+#define TJ_NUMTT  3
+
+/**
+ * Tensor element types (see #tjtensor)
+ */
+enum TJTT {
+  /**
+   * 32-bit IEEE floating point
+   */
+  TJTT_FLOAT32,
+  /**
+   * 16-bit IEEE floating point (half precision), stored as an unsigned short
+   * in the native byte order
+   */
+  TJTT_FLOAT16,
+  /**
+   * Signed 8-bit integer.  The scaled value of each element is rounded to the
+   * nearest integer and clamped to the range [-128, 127].
+   */
+  TJTT_INT8
+};
+
+
+/**
+ * Tensor description (see #tj3DecompressToTensor8())
+ *
+ * The value of each tensor element is computed from the corresponding
+ * decompressed sample `s` (0 to 255) as `s * scale[c] + bias[c]`, where `c`
+ * is the index of the sample within the pixel, in the order that the pixel
+ * format specifies.  For example, mean/standard deviation normalization of an
+ * RGB image can be specified by setting `scale[c]` to
+ * `1 / (255 * std[c])` and `bias[c]` to `-mean[c] / std[c]`.
+ */
+typedef struct {
+  /**
+   * Element type (see @ref TJTT "Tensor element types")
+   */
+  int type;
+  /**
+   * Non-zero if the tensor is planar (channels x height x width, or "CHW"),
+   * or zero if it is interleaved (height x width x channels, or "HWC")
+   */
+  int planar;
+  /**
+   * Per-channel scale factors
+   */
+  float scale[4];
+  /**
+   * Per-channel offsets, which are added after scaling
+   */
+  float bias[4];
+} tjtensor;
+
+
+/**
+ * The number of semi-planar chrominance orders
+ */
+#define TJ_NUMUV  2
+
+/**
+ * Semi-planar chrominance orders
+ *
+ * A semi-planar YUV image consists of a Y plane followed by a single plane in
+ * which the U (Cb) and V (Cr) samples are interleaved.  The plane widths,
+ * plane heights, and level of chrominance subsampling are the same as those
+ * of a planar YUV image (see @ref YUVnotes "YUV Image Format Notes"), except
+ * that each row of the chrominance plane contains twice as many samples.
+ */
+enum TJUV {
+  /**
+   * U (Cb) first (NV12 and NV16 for 8-bit-per-sample images, P010, P012, and
+   * P016 for 12-bit-per-sample images)
+   */
+  TJUV_CBCR,
+  /**
+   * V (Cr) first (NV21 and NV61)
+   */
+  TJUV_CRCB
+};
+
 /**
  * Lossless transform
  */
@@ -1115,6 +1472,33 @@ DLLEXPORT int tj3Set(tjhandle handle, int param, int value);
 DLLEXPORT int tj3Get(tjhandle handle, int param);
 
 
+/**
+ * Set the memory allocator used by a TurboJPEG instance.
+ *
+ * The allocator is used for all memory that the TurboJPEG instance and the
+ * underlying libjpeg instance allocate for the duration of an operation,
+ * including the libjpeg image buffers, row pointers, and intermediate buffers.
+ * This allows the calling program to allocate that memory from an arena, from
+ * huge pages, or from a specific NUMA node.  The allocator is not used for
+ * JPEG destination buffers or images that are returned to the calling program
+ * (which are allocated using #tj3Alloc() and must be freed using #tj3Free()),
+ * for the TurboJPEG instance itself, or for the small amount of memory that
+ * libjpeg allocates when the instance is created and retains until the
+ * instance is destroyed.
+ *
+ * @param handle handle to a TurboJPEG instance
+ *
+ * @param allocator pointer to a #tjallocator structure that specifies the
+ * allocator (the structure is copied), or NULL to restore the default
+ * allocator (`malloc()` and `free()`.)  The allocator must remain usable until
+ * the instance is destroyed or another allocator is set.
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3SetAllocator(tjhandle handle, const tjallocator *allocator);
+
+
 /**
  * Compress an 8-bit-per-sample packed-pixel RGB, grayscale, or CMYK image into
  * an 8-bit-per-sample JPEG image.
@@ -1192,6 +1576,236 @@ DLLEXPORT int tj3Compress16(tjhandle handle, const unsigned short *srcBuf,
                             unsigned char **jpegBuf, size_t *jpegSize);
 
 
+/**
+ * Compress an 8-bit-per-sample packed-pixel RGB, grayscale, or CMYK image into
+ * multiple 8-bit-per-sample JPEG images, each with a different quality level.
+ *
+ * This function produces the same JPEG images as calling #tj3Compress8() once
+ * for each quality level, but color conversion, chrominance subsampling, and
+ * the forward DCT are performed only once.  Only quantization and entropy
+ * coding are repeated for each quality level.  #TJPARAM_QUALITY and
+ * #TJPARAM_TARGETSIZE are ignored, and lossless JPEG images cannot be
+ * generated using this function.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression
+ *
+ * @param srcBuf pointer to a buffer containing a packed-pixel RGB, grayscale,
+ * or CMYK source image to be compressed (see #tj3Compress8().)
+ *
+ * @param width width (in pixels) of the source image
+ *
+ * @param pitch samples per row in the source image (see #tj3Compress8().)
+ *
+ * @param height height (in pixels) of the source image
+ *
+ * @param pixelFormat pixel format of the source image (see @ref TJPF
+ * "Pixel formats".)
+ *
+ * @param numQualities number of JPEG images to generate
+ *
+ * @param qualities pointer to an array of `numQualities` JPEG quality levels
+ * (1 to 100 inclusive), one for each JPEG image
+ *
+ * @param jpegBufs pointer to an array of `numQualities` pointers to byte
+ * buffers, each of which will receive the JPEG image generated using the
+ * corresponding quality level.  Each JPEG buffer is handled in the same manner
+ * as the `jpegBuf` argument of #tj3Compress8().
+ *
+ * @param jpegSizes pointer to an array of `numQualities` size_t variables,
+ * each of which is handled in the same manner as the `jpegSize` argument of
+ * #tj3Compress8().
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3CompressMulti8(tjhandle handle, const unsigned char *srcBuf,
+                                int width, int pitch, int height,
+                                int pixelFormat, int numQualities,
+                                const int *qualities, unsigned char **jpegBufs,
+                                size_t *jpegSizes);
+
+
+/**
+ * Retrieve the chunk list containing the JPEG image generated by the most
+ * recent compression or transform operation performed with #TJPARAM_CHUNKSIZE
+ * set.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression or lossless transformation
+ *
+ * @param chunks pointer to a pointer that will receive the address of an array
+ * of #tjchunk structures, one for each chunk.  The chunks are owned by the
+ * TurboJPEG instance, and they remain valid until the next compression or
+ * transform operation or until the instance is destroyed.  The caller must
+ * not free them.
+ *
+ * @param numChunks pointer to an integer variable that will receive the number
+ * of chunks.  The concatenation of the chunks, in order, is the JPEG image.
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3GetChunks(tjhandle handle, const tjchunk **chunks,
+                           int *numChunks);
+
+
+/**
+ * Retrieve the statistics collected during the most recent decompression or
+ * lossless transform operation performed with #TJPARAM_STATS set.
+ *
+ * Statistics are collected by #tj3Decompress8(), #tj3Decompress12(),
+ * #tj3Decompress16(), #tj3DecompressPyramid8(), #tj3DecompressPyramid12(),
+ * #tj3DecompressToYUVPlanes8() (and, by extension, #tj3DecompressToYUV8()),
+ * and #tj3Transform().  Lossless transformation does not perform the inverse
+ * DCT, upsampling, or color conversion, and the time spent writing the
+ * transformed images is included in #TJSTAGE_OTHER.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * decompression or lossless transformation
+ *
+ * @param stats pointer to a #tjstats structure that will receive the
+ * statistics
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3GetStats(tjhandle handle, tjstats *stats);
+
+
+/**
+ * Estimate the size of the JPEG image that would be generated by compressing
+ * an 8-bit-per-sample packed-pixel RGB, grayscale, or CMYK image with the
+ * current compression parameters.
+ *
+ * Rather than using a worst-case bound, as #tj3JPEGBufSize() does, this
+ * function compresses a representative subset of the MCU rows in the source
+ * image (about 1/8 of them) and extrapolates the size of the JPEG image from
+ * the size of the compressed subset.  For natural images, the estimate is
+ * usually within a few percent of the actual size, and for small images, the
+ * estimate is exact.  However, the estimate is not a bound, so if it is used
+ * to size a pre-allocated JPEG buffer with #TJPARAM_NOREALLOC set, then the
+ * calling program should add a safety margin and be prepared to retry the
+ * compression with a larger buffer if the buffer turns out to be too small.
+ * #TJPARAM_TARGETSIZE is ignored.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression
+ *
+ * @param srcBuf pointer to a buffer containing a packed-pixel RGB, grayscale,
+ * or CMYK source image (see #tj3Compress8().)
+ *
+ * @param width width (in pixels) of the source image
+ *
+ * @param pitch samples per row in the source image (see #tj3Compress8().)
+ *
+ * @param height height (in pixels) of the source image
+ *
+ * @param pixelFormat pixel format of the source image (see @ref TJPF
+ * "Pixel formats".)
+ *
+ * @param jpegSize pointer to a size_t variable that will receive the estimated
+ * size (in bytes) of the JPEG image
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3EstimateJPEGSize8(tjhandle handle,
+                                   const unsigned char *srcBuf, int width,
+                                   int pitch, int height, int pixelFormat,
+                                   size_t *jpegSize);
+
+
+/**
+ * Gather Huffman symbol statistics from an 8-bit-per-sample packed-pixel RGB,
+ * grayscale, or CMYK image for the purpose of training Huffman tables.
+ *
+ * The image is compressed with the current compression parameters and
+ * optimized baseline entropy coding, and the Huffman symbol counts are added
+ * to a running total stored in the TurboJPEG instance.  Calling this function
+ * for each image in a representative set of images with the same compression
+ * parameters (quality, subsampling, and colorspace) and then calling
+ * #tj3GetHuffmanTables() produces Huffman tables that can be loaded, using
+ * #tj3SetHuffmanTables(), into a TurboJPEG instance that compresses similar
+ * images.  That instance can then compress those images in a single pass with
+ * nearly the same compression ratio as #TJPARAM_OPTIMIZE.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression
+ *
+ * @param srcBuf pointer to a buffer containing a packed-pixel RGB, grayscale,
+ * or CMYK source image (see #tj3Compress8().)
+ *
+ * @param width width (in pixels) of the source image
+ *
+ * @param pitch samples per row in the source image (see #tj3Compress8().)
+ *
+ * @param height height (in pixels) of the source image
+ *
+ * @param pixelFormat pixel format of the source image (see @ref TJPF
+ * "Pixel formats".)
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3TrainHuffmanTables8(tjhandle handle,
+                                     const unsigned char *srcBuf, int width,
+                                     int pitch, int height, int pixelFormat);
+
+
+/**
+ * Generate Huffman tables from the statistics gathered by
+ * #tj3TrainHuffmanTables8(), and reset the statistics so that the next call
+ * to #tj3TrainHuffmanTables8() starts a new training set.
+ *
+ * The tables are returned as an abbreviated table-specification datastream (a
+ * JPEG SOI marker, a DHT marker containing the tables, and a JPEG EOI marker),
+ * which can be stored and later passed to #tj3SetHuffmanTables().  The tables
+ * can encode any symbol, including symbols that did not occur in the training
+ * images.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression
+ *
+ * @param tables address of a pointer to a byte buffer that will receive the
+ * Huffman tables.  The buffer is allocated by this function and should be
+ * freed by the calling program using #tj3Free().
+ *
+ * @param size pointer to a size_t variable that will receive the size (in
+ * bytes) of the Huffman tables
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3GetHuffmanTables(tjhandle handle, unsigned char **tables,
+                                  size_t *size);
+
+
+/**
+ * Load Huffman tables into a TurboJPEG instance.
+ *
+ * Subsequent 8-bit-per-sample baseline (non-progressive, non-arithmetic)
+ * lossy compression operations performed with the TurboJPEG instance will use
+ * the loaded tables instead of the default Huffman tables, unless
+ * #TJPARAM_OPTIMIZE is set.  A table that is not defined in the loaded tables
+ * retains its default value.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression
+ *
+ * @param tables pointer to a byte buffer containing Huffman tables, in the
+ * format returned by #tj3GetHuffmanTables(), or NULL to restore the default
+ * Huffman tables
+ *
+ * @param size size (in bytes) of the Huffman tables
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3SetHuffmanTables(tjhandle handle,
+                                  const unsigned char *tables, size_t size);
+
+
 /**
  * Compress an 8-bit-per-sample unified planar YUV image into an
  * 8-bit-per-sample JPEG image.
@@ -1316,6 +1930,65 @@ DLLEXPORT int tj3CompressFromYUVPlanes8(tjhandle handle,
                                         size_t *jpegSize);
 
 
+/**
+ * Compress an 8-bit-per-sample semi-planar YUV image (such as NV12 or NV21)
+ * into an 8-bit-per-sample JPEG image.  The chrominance samples are
+ * de-interleaved one MCU row at a time, so no intermediate planar image is
+ * needed.  The level of chrominance subsampling is specified using
+ * #TJPARAM_SUBSAMP, which cannot be #TJSAMP_GRAY.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * compression
+ *
+ * @param srcPlanes an array of two pointers to the Y plane and the
+ * interleaved chrominance plane of the source image (see @ref TJUV
+ * "Semi-planar chrominance orders".)  These planes can be contiguous or
+ * non-contiguous in memory.
+ *
+ * @param width width (in pixels) of the source image
+ *
+ * @param strides an array of two integers, each specifying the number of
+ * samples per row in the corresponding plane of the source image.  Setting the
+ * stride for the Y plane to 0 is the same as setting it to the Y plane width,
+ * and setting the stride for the chrominance plane to 0 is the same as setting
+ * it to twice the chrominance plane width.  If `strides` is NULL, then both
+ * strides will be set in that manner.
+ *
+ * @param height height (in pixels) of the source image
+ *
+ * @param uvOrder order of the chrominance samples in the chrominance plane
+ * (see @ref TJUV "Semi-planar chrominance orders")
+ *
+ * @param jpegBuf address of a pointer to a byte buffer that will receive the
+ * JPEG image (see #tj3CompressFromYUVPlanes8() for more details)
+ *
+ * @param jpegSize pointer to a size_t variable that holds the size of the JPEG
+ * buffer (see #tj3CompressFromYUVPlanes8() for more details)
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3CompressFromSemiPlanar8(tjhandle handle,
+                                         const unsigned char * const *srcPlanes,
+                                         int width, const int *strides,
+                                         int height, int uvOrder,
+                                         unsigned char **jpegBuf,
+                                         size_t *jpegSize);
+
+/**
+ * Compress a semi-planar YUV image with 16-bit samples (such as P010) into a
+ * 12-bit-per-sample JPEG image.  The 12 most significant bits of each sample
+ * are used, so 10-bit-per-sample (P010) and 12-bit-per-sample (P012) images
+ * are compressed without loss of precision.
+ *
+ * \details \copydetails tj3CompressFromSemiPlanar8()
+ */
+DLLEXPORT int tj3CompressFromSemiPlanar12
+  (tjhandle handle, const unsigned short * const *srcPlanes, int width,
+   const int *strides, int height, int uvOrder, unsigned char **jpegBuf,
+   size_t *jpegSize);
+
+
 /**
  * The maximum size of the buffer (in bytes) required to hold a JPEG image with
  * the given parameters.  The number of bytes returned by this function is
@@ -1686,6 +2359,114 @@ DLLEXPORT int tj3Decompress16(tjhandle handle, const unsigned char *jpegBuf,
                               int pitch, int pixelFormat);
 
 
+/**
+ * Decompress an 8-bit-per-sample lossy JPEG image into multiple
+ * 8-bit-per-sample packed-pixel RGB, grayscale, or CMYK images, each at a
+ * different scaling factor.  The JPEG image is entropy-decoded only once, and
+ * the decoded DCT coefficients are then rendered at each of the specified
+ * scaling factors.  This is faster than calling #tj3SetScalingFactor() and
+ * #tj3Decompress8() once for each scaling factor, at the expense of buffering
+ * the DCT coefficients for the whole image.  (Buffering the DCT coefficients
+ * is subject to #TJPARAM_MAXMEMORY.)  The scaling factor set with
+ * #tj3SetScalingFactor() is ignored, and cropping (see
+ * #tj3SetCroppingRegion()) is not supported.  The @ref TJPARAM "parameters"
+ * that describe the JPEG image will be set when this function returns.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * decompression
+ *
+ * @param jpegBuf pointer to a byte buffer containing the JPEG image to
+ * decompress
+ *
+ * @param jpegSize size of the JPEG image (in bytes)
+ *
+ * @param numScalingFactors number of scaling factors in `scalingFactors` and
+ * number of destination images in `dstBufs`
+ *
+ * @param scalingFactors pointer to an array of #tjscalingfactor structures,
+ * each of which specifies a fractional scaling factor that the decompressor
+ * supports (see #tj3GetScalingFactors().)  The scaling factors must be
+ * specified in descending order.
+ *
+ * @param dstBufs pointer to an array of pointers to buffers that will receive
+ * the packed-pixel decompressed images.  `dstBufs[i]` should normally be
+ * `pitches[i] * TJSCALED(jpegHeight, scalingFactors[i])` samples in size.
+ *
+ * @param pitches pointer to an array of integers specifying the number of
+ * samples per row in each destination image, or NULL if all destination
+ * images are unpadded.  (Setting `pitches[i]` to 0 is the equivalent of
+ * setting it to <tt>TJSCALED(jpegWidth, scalingFactors[i]) *
+ * #tjPixelSize[pixelFormat]</tt>.)
+ *
+ * @param pixelFormat pixel format of the destination images (see @ref
+ * TJPF "Pixel formats".)
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3DecompressPyramid8(tjhandle handle,
+                                    const unsigned char *jpegBuf,
+                                    size_t jpegSize, int numScalingFactors,
+                                    const tjscalingfactor *scalingFactors,
+                                    unsigned char **dstBufs,
+                                    const int *pitches, int pixelFormat);
+
+/**
+ * Decompress a 12-bit-per-sample lossy JPEG image into multiple
+ * 12-bit-per-sample packed-pixel RGB, grayscale, or CMYK images, each at a
+ * different scaling factor.
+ *
+ * \details \copydetails tj3DecompressPyramid8()
+ */
+DLLEXPORT int tj3DecompressPyramid12(tjhandle handle,
+                                     const unsigned char *jpegBuf,
+                                     size_t jpegSize, int numScalingFactors,
+                                     const tjscalingfactor *scalingFactors,
+                                     short **dstBufs, const int *pitches,
+                                     int pixelFormat);
+
+
+/**
+ * Decompress an 8-bit-per-sample JPEG image directly into a tensor of
+ * normalized floating point or integer values, such as is used as the input
+ * to a neural network.  The image is decompressed a few rows at a time, and
+ * each group of rows is converted into tensor elements while it is still in
+ * the CPU cache, so no full-size intermediate packed-pixel image is needed.
+ * The scaling factor set with #tj3SetScalingFactor(), the cropping region set
+ * with #tj3SetCroppingRegion(), and #TJPARAM_BOTTOMUP are honored.  The @ref
+ * TJPARAM "parameters" that describe the JPEG image will be set when this
+ * function returns.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * decompression
+ *
+ * @param jpegBuf pointer to a byte buffer containing the JPEG image to
+ * decompress
+ *
+ * @param jpegSize size of the JPEG image (in bytes)
+ *
+ * @param dstBuf pointer to a buffer that will receive the tensor.  The tensor
+ * is unpadded, so this buffer should be `width * height * channels` elements
+ * in size, where `width` and `height` are the dimensions of the scaled and
+ * cropped image and `channels` is #tjPixelSize[pixelFormat].
+ *
+ * @param pixelFormat pixel format that determines the number and order of the
+ * channels in the tensor.  Only #TJPF_RGB, #TJPF_BGR, #TJPF_GRAY, and
+ * #TJPF_CMYK are supported.
+ *
+ * @param tensor pointer to a #tjtensor structure that specifies the element
+ * type, the layout, and the per-channel scale factors and offsets of the
+ * tensor
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3DecompressToTensor8(tjhandle handle,
+                                     const unsigned char *jpegBuf,
+                                     size_t jpegSize, void *dstBuf,
+                                     int pixelFormat, const tjtensor *tensor);
+
+
 /**
  * Decompress an 8-bit-per-sample JPEG image into an 8-bit-per-sample unified
  * planar YUV image.  This function performs JPEG decompression but leaves out
@@ -1766,6 +2547,66 @@ DLLEXPORT int tj3DecompressToYUVPlanes8(tjhandle handle,
                                         int *strides);
 
 
+/**
+ * Decompress an 8-bit-per-sample JPEG image into an 8-bit-per-sample
+ * semi-planar YUV image (such as NV12 or NV21.)  The chrominance samples are
+ * interleaved one MCU row at a time, so no intermediate planar image is
+ * needed.  The JPEG image must have three components.  The scaling factor set
+ * with #tj3SetScalingFactor() is honored, but cropping is not supported.  The
+ * @ref TJPARAM "parameters" that describe the JPEG image will be set when this
+ * function returns.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * decompression
+ *
+ * @param jpegBuf pointer to a byte buffer containing the JPEG image to
+ * decompress
+ *
+ * @param jpegSize size of the JPEG image (in bytes)
+ *
+ * @param dstPlanes an array of two pointers to the Y plane and the
+ * interleaved chrominance plane of the semi-planar YUV image (see @ref TJUV
+ * "Semi-planar chrominance orders".)  These planes can be contiguous or
+ * non-contiguous in memory.  The Y plane should be at least
+ * <tt>#tj3YUVPlaneSize(0, scaledWidth, strides[0], scaledHeight,
+ * #TJPARAM_SUBSAMP)</tt> samples in size, and the chrominance plane should be
+ * at least <tt>#tj3YUVPlaneSize(1, scaledWidth, strides[1], scaledHeight,
+ * #TJPARAM_SUBSAMP) * 2</tt> samples in size if `strides[1]` is 0.
+ *
+ * @param strides an array of two integers, each specifying the number of
+ * samples per row in the corresponding plane of the semi-planar YUV image.
+ * Setting the stride for the Y plane to 0 is the same as setting it to the Y
+ * plane width, and setting the stride for the chrominance plane to 0 is the
+ * same as setting it to twice the chrominance plane width.  If `strides` is
+ * NULL, then both strides will be set in that manner.
+ *
+ * @param uvOrder order of the chrominance samples in the chrominance plane
+ * (see @ref TJUV "Semi-planar chrominance orders")
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3DecompressToSemiPlanar8(tjhandle handle,
+                                         const unsigned char *jpegBuf,
+                                         size_t jpegSize,
+                                         unsigned char **dstPlanes,
+                                         const int *strides, int uvOrder);
+
+/**
+ * Decompress a 12-bit-per-sample JPEG image into a semi-planar YUV image with
+ * 16-bit samples (such as P012.)  Each 12-bit sample is stored in the 12 most
+ * significant bits of a 16-bit sample, so the image can also be read as a
+ * P010 or P016 image.
+ *
+ * \details \copydetails tj3DecompressToSemiPlanar8()
+ */
+DLLEXPORT int tj3DecompressToSemiPlanar12(tjhandle handle,
+                                          const unsigned char *jpegBuf,
+                                          size_t jpegSize,
+                                          unsigned short **dstPlanes,
+                                          const int *strides, int uvOrder);
+
+
 /**
  * Decode an 8-bit-per-sample unified planar YUV image into an 8-bit-per-sample
  * packed-pixel RGB or grayscale image.  This function performs color
@@ -1936,6 +2777,55 @@ DLLEXPORT int tj3Transform(tjhandle handle, const unsigned char *jpegBuf,
                            size_t *dstSizes, const tjtransform *transforms);
 
 
+/**
+ * Estimate the amount of memory that a decompression or lossless transform
+ * operation will require.
+ *
+ * This function reads only the headers of the JPEG image.  It then initializes
+ * the decompression modules in the same way as #tj3Decompress8(),
+ * #tj3Decompress12(), #tj3Decompress16(), or #tj3Transform(), using the
+ * current parameters (including #TJPARAM_MAXMEMORY, #TJPARAM_FASTUPSAMPLE,
+ * #TJPARAM_FASTDCT, the scaling factor, and the cropping region), but it does
+ * not allocate the whole-image buffers that would be used with multi-scan
+ * JPEG images or lossless transforms.  Instead, their sizes are computed
+ * using the same logic that the libjpeg memory manager uses to allocate them.
+ * Thus, the returned value is the peak amount of memory that the libjpeg
+ * memory manager will allocate during the operation (see
+ * #tjstats::peakMemory), plus the row pointers that the decompression
+ * functions allocate.  The estimate does not include the destination buffer.
+ * For lossless transforms, the estimate also does not include the memory used
+ * by the compressor, which is small and independent of the image size.
+ * Quantization and Huffman tables that are defined after the first scan of a
+ * multi-scan JPEG image are allocated when they are read, so the estimate may
+ * be smaller than the actual peak by a few hundred bytes per table if the
+ * instance has not previously used the same table slots.
+ *
+ * @param handle handle to a TurboJPEG instance that has been initialized for
+ * decompression or lossless transformation
+ *
+ * @param jpegBuf pointer to a byte buffer containing the JPEG image
+ *
+ * @param jpegSize size of the JPEG image (in bytes)
+ *
+ * @param pixelFormat pixel format of the destination image (see
+ * @ref TJPF "Pixel formats".)  This is ignored if `transform` is non-NULL.
+ *
+ * @param transform pointer to a #tjtransform structure that specifies a
+ * lossless transform, or NULL to estimate the memory required to decompress
+ * the JPEG image.  (The `customFilter` field is ignored.)
+ *
+ * @param memSize pointer to a size_t variable that will receive the estimated
+ * amount of memory (in bytes)
+ *
+ * @return 0 if successful, or -1 if an error occurred (see #tj3GetErrorStr()
+ * and #tj3GetErrorCode().)
+ */
+DLLEXPORT int tj3EstimateMemory(tjhandle handle, const unsigned char *jpegBuf,
+                                size_t jpegSize, int pixelFormat,
+                                const tjtransform *transform,
+                                size_t *memSize);
+
+
 /**
  * Destroy a TurboJPEG instance.
  *